@@ -0,0 +1,110 @@
+/* Copyright (c) 2010-2018 Sander Mertens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* Build time and peak RSS over repeated in-process builds.
+ *
+ * Discovers and builds the projects in a directory a number of times in the
+ * same process, and reports the time spent and the peak resident set size
+ * after every build. With per-project arenas the peak should stay flat after
+ * the first build, as all memory allocated for a project is released when its
+ * crawler is freed. After the first build, a "build" is a no-op build, which
+ * mostly measures crawling, dependency checking and logging overhead. Logging
+ * runs at the default verbosity unless UT_VERBOSITY is set.
+ *
+ * Build from the repository root, after building bake (so the util library
+ * is in place), and run in an environment initialized with `bake env`:
+ *
+ *   cc -std=c99 -D_XOPEN_SOURCE=600 -DBAKE_IMPL -O2 -I. -Iutil bench/build.c \
+ *     $(ls src/[a-z]*.c | grep -v main.c) util/src/[a-z]*.c \
+ *     -lrt -ldl -lpthread -lm -o bench_build
+ *   ./bench_build examples 20 rebuild
+ */
+
+#include "../src/bake.h"
+#include <sys/resource.h>
+
+ut_tls BAKE_DRIVER_KEY;
+ut_tls BAKE_FILELIST_KEY;
+ut_tls BAKE_PROJECT_KEY;
+ut_tls BAKE_UNIT_KEY;
+
+static
+long peak_rss(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = argc > 1 ? argv[1] : ".";
+    int i, count = argc > 2 ? atoi(argv[2]) : 10;
+    const char *action = argc > 3 ? argv[3] : "build";
+    bake_config config = {};
+
+    ut_init("bench_build");
+    ut_tls_new(&BAKE_DRIVER_KEY, NULL);
+    ut_tls_new(&BAKE_FILELIST_KEY, NULL);
+    ut_tls_new(&BAKE_PROJECT_KEY, NULL);
+    ut_tls_new(&BAKE_UNIT_KEY, NULL);
+
+    if (bake_config_load(&config, "debug", "default", false)) {
+        ut_raise();
+        return -1;
+    }
+
+    ut_load_init(
+        ut_getenv("BAKE_TARGET"),
+        ut_getenv("BAKE_HOME"),
+        ut_getenv("BAKE_CONFIG"));
+
+    bake_crawler_cb cb = !strcmp(action, "rebuild")
+        ? bake_do_rebuild
+        : bake_do_build
+        ;
+
+    for (i = 0; i < count; i ++) {
+        struct timespec start, stop;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        bake_crawler *crawler = bake_crawler_new(&config);
+        uint32_t projects = bake_crawler_search(crawler, path);
+
+        if (bake_crawler_walk(&config, crawler, action, cb)) {
+            ut_raise();
+            return -1;
+        }
+
+        bake_crawler_free(crawler);
+
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        double ms = (stop.tv_sec - start.tv_sec) * 1000.0 +
+                    (stop.tv_nsec - start.tv_nsec) / 1000000.0;
+
+        printf("build %3d: %u projects, %.2f ms, peak rss %ld KB\n",
+            i + 1, projects, ms, peak_rss());
+    }
+
+    ut_deinit();
+
+    return 0;
+}
@@ -2,6 +2,9 @@
 #include <bake>
 
 #define OBJ_DIR ".bake_cache/obj"
+#define PCH_DIR ".bake_cache/pch"
+#define UNITY_DIR ".bake_cache/unity"
+#define SOURCE_PATTERN "//*.c|*.cpp|*.cxx"
 
 static
 char* get_short_name(
@@ -122,6 +125,1061 @@ const char *cc(
     }
 }
 
+/* Store debug information in .dwo files next to objects, so the linker does
+ * not have to process it. Not supported by the Mach-O toolchain. */
+static
+bool split_debug(
+    bake_config *config)
+{
+    return config->symbols && config->split_debug && !is_darwin();
+}
+
+/* -- Link time optimization */
+
+/* Directory in which incremental LTO caches the results of LTRANS units */
+#define LTO_CACHE_DIR ".bake_cache/lto"
+
+static
+bool is_clang(
+    bool cpp)
+{
+    /* On macOS gcc is an alias for clang */
+    return is_darwin() || strstr(cc(cpp), "clang") != NULL;
+}
+
+/* Incremental LTO for gcc (-flto-incremental) is probed once per process, as
+ * older gcc versions reject the option. */
+static ut_mutex_s lto_lock = UT_MUTEX_INIT;
+static int8_t lto_incremental_probed[2] = {-1, -1};
+
+static
+bool lto_incremental(
+    bool cpp)
+{
+    int lang = cpp ? 1 : 0;
+
+    ut_mutex_lock(&lto_lock);
+    if (lto_incremental_probed[lang] == -1) {
+        char *argv[] = {
+            (char*)cc(cpp), "-flto-incremental=/tmp", "-x", cpp ? "c++" : "c",
+            "-c", "/dev/null", "-o", "/dev/null", NULL};
+        int8_t rc = 0;
+
+        lto_incremental_probed[lang] = 0;
+        ut_proc pid = ut_proc_runRedirect(argv[0], argv, stdin, NULL, NULL);
+        if (pid > 0) {
+            lto_incremental_probed[lang] = !ut_proc_wait(pid, &rc) && !rc;
+        }
+
+        /* An unsupported option is not an error */
+        ut_catch();
+
+        if (!lto_incremental_probed[lang]) {
+            ut_trace("%s does not support incremental LTO, using full LTO",
+                cc(cpp));
+        }
+    }
+    ut_mutex_unlock(&lto_lock);
+
+    return lto_incremental_probed[lang];
+}
+
+/* LTO flag for compiling. Objects only contain the intermediate
+ * representation, code is generated when linking. */
+static
+void lto_compile_flags(
+    bake_config *config,
+    bool cpp,
+    ut_strbuf *buf)
+{
+    if (config->lto == BAKE_LTO_OFF) {
+        return;
+    }
+
+    if (config->lto == BAKE_LTO_THIN && is_clang(cpp)) {
+        ut_strbuf_appendstr(buf, " -flto=thin");
+    } else {
+        ut_strbuf_appendstr(buf, " -flto");
+    }
+}
+
+/* LTO flags for linking. For gcc, code generation (LTRANS) is split up in
+ * partitions which are compiled in parallel. Without a fixed number of jobs,
+ * -flto=auto takes job slots from the bake jobserver if there is one, and
+ * otherwise uses all CPUs. */
+static
+void lto_link_flags(
+    bake_config *config,
+    bake_project *project,
+    bool cpp,
+    ut_strbuf *buf)
+{
+    if (config->lto == BAKE_LTO_OFF) {
+        return;
+    }
+
+    if (is_clang(cpp)) {
+        if (config->lto == BAKE_LTO_THIN) {
+            ut_strbuf_appendstr(buf, " -flto=thin");
+        } else {
+            ut_strbuf_appendstr(buf, " -flto");
+        }
+        return;
+    }
+
+    if (config->lto_jobs) {
+        ut_strbuf_append(buf, " -flto=%u", config->lto_jobs);
+    } else {
+        ut_strbuf_appendstr(buf, " -flto=auto");
+    }
+
+    if (config->lto == BAKE_LTO_THIN && lto_incremental(cpp)) {
+        char *dir = ut_asprintf("%s/" LTO_CACHE_DIR "/%s-%s",
+            project->path, UT_PLATFORM_STRING, config->configuration);
+        if (!ut_mkdir(dir)) {
+            ut_strbuf_append(buf, " -flto-incremental=%s", dir);
+        } else {
+            ut_catch();
+        }
+        free(dir);
+    }
+}
+
+/* Archiver for static libraries. Archives with LTO objects need a symbol
+ * index, which plain ar can only create with the linker plugin loaded. The
+ * gcc-ar wrapper of the compiler in use (x86_64-linux-gnu-gcc-12 uses
+ * x86_64-linux-gnu-gcc-ar-12) takes care of that. */
+static
+char* archiver(
+    bake_config *config,
+    bool cpp)
+{
+    const char *ar = ut_getenv("AR");
+    if (ar) {
+        return ut_strdup(ar);
+    }
+
+    if (config->lto == BAKE_LTO_OFF || is_darwin()) {
+        return ut_strdup("ar");
+    }
+
+    if (is_clang(cpp)) {
+        return ut_strdup("llvm-ar");
+    }
+
+    const char *compiler = cc(cpp);
+    const char *name = cpp ? "g++" : "gcc";
+    const char *ptr = strstr(compiler, name);
+    if (!ptr) {
+        return ut_strdup("gcc-ar");
+    }
+
+    return ut_asprintf("%.*sgcc-ar%s",
+        (int)(ptr - compiler), compiler, ptr + strlen(name));
+}
+
+/* Append flag with a path. Commands that don't run in the current directory
+ * need an absolute path. */
+static
+void append_path(
+    ut_strbuf *buf,
+    const char *flag,
+    const char *path,
+    bool absolute)
+{
+    ut_strbuf_appendstr(buf, flag);
+    if (absolute && path[0] != '/') {
+        ut_strbuf_appendstr(buf, ut_cwd());
+        ut_strbuf_appendch(buf, '/');
+    }
+    ut_strbuf_appendstr(buf, path);
+}
+
+/* -- Profile guided optimization */
+
+/* Instrumented binaries write their profiles to the profile directory of the
+ * project when they exit, so the directory must be an absolute path. Optimized
+ * builds only use profiles when bake found them to be up to date with the
+ * sources. Partial training keeps code that was not run by the training
+ * command optimized for speed instead of size. */
+static
+void pgo_flags(
+    bake_config *config,
+    bake_project *project,
+    bool cpp,
+    ut_strbuf *buf)
+{
+    if (config->pgo == BAKE_PGO_GENERATE) {
+        append_path(buf, " -fprofile-generate=", project->pgo_path, true);
+        if (!is_clang(cpp)) {
+            /* Don't lose counts of multithreaded training runs */
+            ut_strbuf_appendstr(buf, " -fprofile-update=prefer-atomic");
+        }
+    } else if (config->pgo == BAKE_PGO_USE && project->pgo_profile) {
+        append_path(buf, " -fprofile-use=", project->pgo_path, true);
+        if (!is_clang(cpp)) {
+            ut_strbuf_appendstr(buf,
+                " -fprofile-partial-training -Wno-missing-profile");
+        }
+    }
+}
+
+/* The compiler names profiles after the path of the object, prefixed with the
+ * working directory when relative. Batches are compiled in the object
+ * directory, so remove '.' and '..' elements from the path of single files to
+ * get the same profile names in both cases. */
+static
+void pgo_target(
+    bake_config *config,
+    const char *target,
+    ut_strbuf *buf)
+{
+    if (config->pgo != BAKE_PGO_OFF && strlen(target) < UT_MAX_PATH_LENGTH) {
+        char path[UT_MAX_PATH_LENGTH], clean[UT_MAX_PATH_LENGTH];
+        strcpy(path, target);
+        ut_strbuf_appendstr(buf, ut_path_clean(clean, path));
+    } else {
+        ut_strbuf_appendstr(buf, target);
+    }
+}
+
+/* -- Instruction set */
+
+/* Instruction set and tuning apply to compiling and linking, as with LTO code
+ * is generated by the linker. */
+static
+void arch_flags(
+    bake_config *config,
+    ut_strbuf *buf)
+{
+    if (config->arch) {
+        ut_strbuf_append(buf, " -march=%s", config->arch);
+    }
+    if (config->tune) {
+        ut_strbuf_append(buf, " -mtune=%s", config->tune);
+    }
+}
+
+/* Functions marked with <ID>_CLONES in prebaked.h are compiled for each of the
+ * configured targets, and the version for the CPU is selected by the dynamic
+ * loader (with an ifunc, which Mach-O does not support). The targets are
+ * passed as a macro, so prebaked.h does not change with the configuration. */
+static
+void target_clones_flags(
+    bake_config *config,
+    ut_strbuf *buf)
+{
+    const char *targets = config->target_clones;
+    if (!targets || !targets[0] || is_darwin()) {
+        return;
+    }
+
+    ut_strbuf_append(buf, " -DBAKE_TARGET_CLONES=\"%s", targets);
+
+    /* The compiler requires a default version */
+    char *list = ut_asprintf(",%s,", targets);
+    if (!strstr(list, ",default,")) {
+        ut_strbuf_appendstr(buf, ",default");
+    }
+    free(list);
+
+    ut_strbuf_appendch(buf, '"');
+}
+
+/* -- C++ modules */
+
+/* Directory with the module interfaces (BMIs) built for a configuration */
+#define BMI_DIR ".bake_cache/bmi"
+
+/* Modules are enabled with the modules attribute of C++ projects */
+static
+bool modules_enabled(
+    bake_driver_api *driver,
+    bake_project *project)
+{
+    return is_cpp(project) && driver->get_attr_bool("modules");
+}
+
+static
+char* module_bmi_dir(
+    bake_config *config,
+    bake_project *project)
+{
+    return ut_asprintf("%s/" BMI_DIR "/%s-%s",
+        project->path, UT_PLATFORM_STRING, config->configuration);
+}
+
+/* The module mapper tells the compiler where to find and store the interface
+ * of a module. It is stored outside of the BMI directory, which is installed. */
+static
+char* module_mapper(
+    bake_config *config,
+    bake_project *project)
+{
+    return ut_asprintf("%s/" BMI_DIR "/%s-%s.map",
+        project->path, UT_PLATFORM_STRING, config->configuration);
+}
+
+/* -- Release profile */
+
+/* Optimized builds use the release profile, which removes unused code and data
+ * from binaries and only exports the interface of packages. */
+static
+bool release_profile(
+    bake_config *config)
+{
+    return config->optimizations;
+}
+
+/* Packages only export symbols marked with <ID>_EXPORT, unless the project
+ * sets export_symbols. Declarations exported by modules are not marked. */
+static
+bool symbols_hidden(
+    bake_driver_api *driver,
+    bake_project *project)
+{
+    return project->type == BAKE_PACKAGE &&
+        !driver->get_attr_bool("export_symbols") &&
+        !modules_enabled(driver, project) &&
+        !is_darwin();
+}
+
+/* Append compiler and flags for compiling a file of the project. Precompiled
+ * headers are built with the same flags, as the compiler rejects them when the
+ * flags don't match. */
+static
+void compile_flags(
+    bake_driver_api *driver,
+    bake_config *config,
+    bake_project *project,
+    bool cpp,
+    bool absolute,
+    ut_strbuf *buf)
+{
+    ut_strbuf_appendstr(buf, cc(cpp));
+    ut_strbuf_appendstr(buf, " -Wall -fPIC -fno-stack-protector");
+
+    if (cpp && modules_enabled(driver, project)) {
+        char *mapper = module_mapper(config, project);
+        ut_strbuf_appendstr(buf, " -std=c++20 -fmodules-ts -Wno-write-strings");
+        append_path(buf, " -fmodule-mapper=", mapper, true);
+        free(mapper);
+    } else if (cpp) {
+        ut_strbuf_appendstr(buf, " -std=c++0x -Wno-write-strings");
+    } else {
+        ut_strbuf_appendstr(buf, " -std=c99 -D_XOPEN_SOURCE=600");
+    }
+
+    ut_strbuf_appendstr(buf, " -DBAKE_PROJECT_ID=\"");
+    ut_strbuf_appendstr(buf, project->id);
+    ut_strbuf_appendch(buf, '"');
+
+    /* Append building macro (<PROJECT_ID>_IMPL) */
+    ut_strbuf_appendstr(buf, " -D");
+    const char *ptr;
+    for (ptr = project->id_underscore; *ptr; ptr ++) {
+        ut_strbuf_appendch(buf, toupper(*ptr));
+    }
+    ut_strbuf_appendstr(buf, "_IMPL");
+
+    if (config->symbols) {
+        ut_strbuf_appendstr(buf, " -g");
+        if (split_debug(config)) {
+            ut_strbuf_appendstr(buf, " -gsplit-dwarf");
+        }
+    }
+    if (!config->debug) {
+        ut_strbuf_appendstr(buf, " -DNDEBUG");
+    }
+    if (config->optimizations) {
+        ut_strbuf_appendstr(buf, " -O3");
+    } else {
+        ut_strbuf_appendstr(buf, " -O0");
+    }
+    arch_flags(config, buf);
+    target_clones_flags(config, buf);
+    if (symbols_hidden(driver, project)) {
+        ut_strbuf_appendstr(buf, " -fvisibility=hidden");
+    }
+    if (release_profile(config)) {
+        /* Let the linker remove unused functions and data */
+        ut_strbuf_appendstr(buf, " -ffunction-sections -fdata-sections");
+    }
+    lto_compile_flags(config, cpp, buf);
+    pgo_flags(config, project, cpp, buf);
+    if (config->strict) {
+        ut_strbuf_appendstr(buf, " -Werror -Wextra -pedantic");
+    }
+
+    if (!cpp) {
+        /* CFLAGS for c projects */
+        bake_attr *flags_attr = driver->get_attr("cflags");
+        if (flags_attr) {
+            ut_iter it = ut_ll_iter(flags_attr->is.array);
+            while (ut_iter_hasNext(&it)) {
+                bake_attr *flag = ut_iter_next(&it);
+                ut_strbuf_appendch(buf, ' ');
+                ut_strbuf_appendstr(buf, flag->is.string);
+            }
+        }
+    } else {
+        /* CXXFLAGS for c4cpp projects */
+        bake_attr *flags_attr = driver->get_attr("cxxflags");
+        if (flags_attr) {
+            ut_iter it = ut_ll_iter(flags_attr->is.array);
+            while (ut_iter_hasNext(&it)) {
+                bake_attr *flag = ut_iter_next(&it);
+                ut_strbuf_appendch(buf, ' ');
+                ut_strbuf_appendstr(buf, flag->is.string);
+            }
+        }
+    }
+
+    bake_attr *include_attr = driver->get_attr("include");
+    if (include_attr) {
+        ut_iter it = ut_ll_iter(include_attr->is.array);
+        while (ut_iter_hasNext(&it)) {
+            bake_attr *include = ut_iter_next(&it);
+            append_path(buf, " -I", include->is.string, absolute);
+        }
+    }
+
+    append_path(buf, " -I ", config->target, absolute);
+    ut_strbuf_appendstr(buf, "/include");
+
+    if (strcmp(config->target, config->home)) {
+        append_path(buf, " -I ", config->home, absolute);
+        ut_strbuf_appendstr(buf, "/include");
+    }
+
+    append_path(buf, " -I", project->path, absolute);
+}
+
+/* -- Precompiled headers */
+
+/* Header to precompile, or NULL if precompiled headers are disabled. The pch
+ * attribute is a boolean, the path of a header in the project, or "auto" (the
+ * default), which precompiles prebaked.h for C++ projects with dependencies. */
+static
+char* pch_source(
+    bake_driver_api *driver,
+    bake_project *project)
+{
+    bake_attr *attr = driver->get_attr("pch");
+
+    if (modules_enabled(driver, project)) {
+        /* With modules, the compiler builds headers as header units */
+        return NULL;
+    } else if (!attr || (attr->kind == BAKE_STRING && !strcmp(attr->is.string, "auto"))) {
+        if (!is_cpp(project)) {
+            return NULL;
+        }
+        if (!ut_ll_count(project->use) && !ut_ll_count(project->use_private)) {
+            return NULL;
+        }
+    } else if (attr->kind == BAKE_BOOLEAN) {
+        if (!attr->is.boolean) {
+            return NULL;
+        }
+    } else if (attr->kind == BAKE_STRING) {
+        return ut_asprintf("%s/%s", project->path, attr->is.string);
+    } else {
+        ut_throw("attribute 'pch' must be a boolean, \"auto\" or a header");
+        project->error = true;
+        return NULL;
+    }
+
+    return ut_asprintf("%s/include/prebaked.h", project->path);
+}
+
+/* Header that is force-included when compiling sources. It includes the
+ * precompiled header, and is stored next to the .gch file so the compiler
+ * finds the .gch. A .gch is built per configuration. */
+static
+char* pch_header(
+    bake_config *config,
+    bake_project *project,
+    const char *source)
+{
+    const char *name = strrchr(source, '/');
+    name = name ? name + 1 : source;
+    return ut_asprintf("%s/" PCH_DIR "/%s-%s/%s",
+        project->path, UT_PLATFORM_STRING, config->configuration, name);
+}
+
+/* Write file only if its content changed, so its timestamp doesn't invalidate
+ * the files that depend on it */
+static
+int16_t write_if_changed(
+    const char *file,
+    const char *content)
+{
+    char *old = ut_file_test(file) == 1 ? ut_file_load(file) : NULL;
+    if (old && !strcmp(old, content)) {
+        free(old);
+        return 0;
+    }
+    free(old);
+
+    FILE *f = fopen(file, "w");
+    if (!f) {
+        ut_throw("failed to open file '%s'", file);
+        return -1;
+    }
+    fputs(content, f);
+    fclose(f);
+
+    return 0;
+}
+
+/* The precompiled header is outdated when it doesn't exist, when it was built
+ * with a different command, or when one of the headers it includes (stored in
+ * the dependency file written by the compiler) changed. */
+static
+bool pch_outdated(
+    const char *gch,
+    const char *dep_file,
+    const char *cmd_file,
+    const char *cmd)
+{
+    bool result = true;
+    char *old_cmd = NULL, *deps = NULL;
+
+    if (ut_file_test(gch) != 1) {
+        goto done;
+    }
+
+    old_cmd = ut_file_test(cmd_file) == 1 ? ut_file_load(cmd_file) : NULL;
+    if (!old_cmd || strcmp(old_cmd, cmd)) {
+        goto done;
+    }
+
+    deps = ut_file_test(dep_file) == 1 ? ut_file_load(dep_file) : NULL;
+    if (!deps) {
+        goto done;
+    }
+
+    time_t built = ut_lastmodified(gch);
+
+    /* Projects are built in parallel, so use the reentrant strtok_r */
+    char *save = NULL;
+    char *tok = strtok_r(deps, " \t\r\n\\", &save);
+    while (tok) {
+        /* Skip target of make rule */
+        if (tok[strlen(tok) - 1] != ':') {
+            if (ut_file_test(tok) != 1 || ut_lastmodified(tok) > built) {
+                ut_trace("precompiled header outdated by '%s'", tok);
+                goto done;
+            }
+        }
+        tok = strtok_r(NULL, " \t\r\n\\", &save);
+    }
+
+    result = false;
+done:
+    free(old_cmd);
+    free(deps);
+    return result;
+}
+
+static
+void build_pch(
+    bake_driver_api *driver,
+    bake_config *config,
+    bake_project *project)
+{
+    char *source = pch_source(driver, project);
+    if (!source) {
+        return;
+    }
+
+    if (ut_file_test(source) != 1) {
+        ut_throw("header '%s' for precompiled header not found", source);
+        project->error = true;
+        free(source);
+        return;
+    }
+
+    char *header = pch_header(config, project, source);
+    char *gch = ut_asprintf("%s.gch", header);
+    char *dep_file = ut_asprintf("%s.d", header);
+    char *cmd_file = ut_asprintf("%s.cmd", header);
+    bool cpp = is_cpp(project);
+
+    /* Force-included header includes the actual header by absolute path, so
+     * that the precompiled header can be stored in the cache */
+    char *include = source[0] == '/'
+        ? ut_asprintf("#include \"%s\"\n", source)
+        : ut_asprintf("#include \"%s/%s\"\n", ut_cwd(), source);
+
+    ut_strbuf cmd = UT_STRBUF_INIT;
+    compile_flags(driver, config, project, cpp, false, &cmd);
+    ut_strbuf_append(&cmd, " -x %s -c %s -o %s -MD -MF %s",
+        cpp ? "c++-header" : "c-header", header, gch, dep_file);
+    char *cmdstr = ut_strbuf_get(&cmd);
+
+    if (ut_mkdir("%s/" PCH_DIR "/%s-%s",
+        project->path, UT_PLATFORM_STRING, config->configuration))
+    {
+        project->error = true;
+    } else if (write_if_changed(header, include)) {
+        project->error = true;
+    } else if (pch_outdated(gch, dep_file, cmd_file, cmdstr)) {
+        ut_ok("#[bold]%s#[normal]", gch);
+        driver->exec(cmdstr);
+        if (project->error) {
+            /* Don't use a partially written precompiled header */
+            remove(gch);
+        } else if (write_if_changed(cmd_file, cmdstr)) {
+            project->error = true;
+        }
+    }
+
+    free(cmdstr);
+    free(include);
+    free(cmd_file);
+    free(dep_file);
+    free(gch);
+    free(header);
+    free(source);
+}
+
+/* -- Unity builds */
+
+/* Amount of source (in bytes) per unity file when the number of unity files is
+ * not specified */
+#define UNITY_BATCH_SIZE (256 * 1024)
+
+typedef struct unity_source {
+    char *file;             /* Path of source, relative to project */
+    off_t size;
+    bool cpp;
+    bool excluded;
+    int batch;
+} unity_source;
+
+typedef struct unity_walk_t {
+    ut_expr_program program;
+    const char *dir;
+    ut_ll exclude;
+    unity_source *sources;
+    int count;
+} unity_walk_t;
+
+/* Number of unity files per language, 0 if unity builds are disabled, or -1 if
+ * the number should be derived from the size of the sources. */
+static
+int unity_setting(
+    bake_driver_api *driver,
+    bake_project *project)
+{
+    bake_attr *attr = driver->get_attr("unity");
+
+    if (!attr) {
+        return 0;
+    } else if (modules_enabled(driver, project)) {
+        /* Module declarations must be at the start of a translation unit */
+        ut_trace("unity build disabled for project with modules");
+        return 0;
+    } else if (attr->kind == BAKE_BOOLEAN) {
+        return attr->is.boolean ? -1 : 0;
+    } else if (attr->kind == BAKE_NUMBER && attr->is.number >= 1) {
+        return attr->is.number;
+    } else {
+        ut_throw("attribute 'unity' must be a boolean or a positive number");
+        project->error = true;
+        return 0;
+    }
+}
+
+static
+bool is_unity(
+    bake_driver_api *driver,
+    bake_config *config,
+    bake_project *project)
+{
+    return unity_setting(driver, project) != 0;
+}
+
+static
+bool is_not_unity(
+    bake_driver_api *driver,
+    bake_config *config,
+    bake_project *project)
+{
+    return !is_unity(driver, config, project);
+}
+
+static
+int unity_walk_cb(
+    ut_dir_entry *entry,
+    void *ctx)
+{
+    unity_walk_t *data = ctx;
+
+    if (!entry->is_dir && ut_expr_run(data->program, entry->relative)) {
+        struct stat st;
+        if (stat(entry->path, &st)) {
+            ut_throw("cannot stat '%s': %s", entry->path, strerror(errno));
+            return -1;
+        }
+
+        char *file = ut_asprintf("%s/%s", data->dir, entry->relative);
+        const char *ext = strrchr(entry->name, '.');
+        bool excluded = false;
+
+        ut_iter it = ut_ll_iter(data->exclude);
+        while (ut_iter_hasNext(&it)) {
+            bake_attr *attr = ut_iter_next(&it);
+            if (attr->kind == BAKE_STRING && !strcmp(attr->is.string, file)) {
+                excluded = true;
+                break;
+            }
+        }
+
+        data->sources = realloc(
+            data->sources, (data->count + 1) * sizeof(unity_source));
+        data->sources[data->count ++] = (unity_source){
+            .file = file,
+            .size = st.st_size,
+            .cpp = ext && strcmp(ext, ".c"),
+            .excluded = excluded
+        };
+    }
+
+    return 0;
+}
+
+static
+int unity_compare_name(
+    const void *p1,
+    const void *p2)
+{
+    return strcmp(((unity_source*)p1)->file, ((unity_source*)p2)->file);
+}
+
+static
+int unity_compare_size(
+    const void *p1,
+    const void *p2)
+{
+    const unity_source *s1 = *(unity_source**)p1, *s2 = *(unity_source**)p2;
+    if (s1->size != s2->size) {
+        return s1->size < s2->size ? 1 : -1;
+    }
+    return strcmp(s1->file, s2->file);
+}
+
+/* Assign sources of one language to batches. Largest sources are assigned
+ * first to the smallest batch, so batches end up with similar amounts of code.
+ * Excluded sources get a batch of their own. */
+static
+void unity_assign(
+    unity_source *sources,
+    int count,
+    bool cpp,
+    int setting)
+{
+    unity_source **list = malloc(count * sizeof(unity_source*));
+    int i, n = 0, batches = setting;
+    off_t total = 0;
+
+    for (i = 0; i < count; i ++) {
+        if (sources[i].cpp == cpp && !sources[i].excluded) {
+            list[n ++] = &sources[i];
+            total += sources[i].size;
+        }
+    }
+
+    if (batches < 0) {
+        batches = (total + UNITY_BATCH_SIZE - 1) / UNITY_BATCH_SIZE;
+    }
+    if (batches > n) {
+        batches = n;
+    }
+    if (!batches && n) {
+        batches = 1;
+    }
+
+    qsort(list, n, sizeof(unity_source*), unity_compare_size);
+
+    off_t *size = calloc(batches + 1, sizeof(off_t));
+    for (i = 0; i < n; i ++) {
+        int b, smallest = 0;
+        for (b = 1; b < batches; b ++) {
+            if (size[b] < size[smallest]) {
+                smallest = b;
+            }
+        }
+        list[i]->batch = smallest;
+        size[smallest] += list[i]->size;
+    }
+
+    for (i = 0; i < count; i ++) {
+        if (sources[i].cpp == cpp && sources[i].excluded) {
+            sources[i].batch = batches ++;
+        }
+    }
+
+    free(size);
+    free(list);
+}
+
+static
+char* unity_file(
+    bake_project *project,
+    bool cpp,
+    int batch)
+{
+    return ut_asprintf("%s/" UNITY_DIR "/unity_%s_%d.%s",
+        project->path, cpp ? "cpp" : "c", batch, cpp ? "cpp" : "c");
+}
+
+static
+int16_t unity_write(
+    bake_project *project,
+    unity_source *sources,
+    int count,
+    bool cpp,
+    int batches)
+{
+    int b, i;
+
+    for (b = 0; b < batches; b ++) {
+        ut_strbuf buf = UT_STRBUF_INIT;
+        ut_strbuf_appendstr(&buf, "/* Generated by bake, do not modify */\n\n");
+
+        for (i = 0; i < count; i ++) {
+            if (sources[i].cpp == cpp && sources[i].batch == b) {
+                ut_strbuf_append(&buf, "#include \"../../%s\"\n", sources[i].file);
+            }
+        }
+
+        char *content = ut_strbuf_get(&buf);
+        char *file = unity_file(project, cpp, b);
+        int16_t ret = write_if_changed(file, content);
+        free(file);
+        free(content);
+        if (ret) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Sources are compiled again when the unity file is newer than its object, so
+ * update the unity files that include a source that changed */
+static
+int16_t unity_touch(
+    bake_project *project,
+    unity_source *sources,
+    int count)
+{
+    int i;
+
+    for (i = 0; i < count; i ++) {
+        char *file = unity_file(project, sources[i].cpp, sources[i].batch);
+        char *src = ut_asprintf("%s/%s", project->path, sources[i].file);
+        time_t t = ut_file_test(file) == 1 ? ut_lastmodified(file) : 0;
+
+        if (t && ut_lastmodified(src) > t) {
+            char *content = ut_file_load(file);
+            if (!content || remove(file) || write_if_changed(file, content)) {
+                ut_throw("failed to update '%s'", file);
+                free(content);
+                free(src);
+                free(file);
+                return -1;
+            }
+            free(content);
+        }
+
+        free(src);
+        free(file);
+    }
+
+    return 0;
+}
+
+/* Generate the unity files that are compiled instead of the sources. Batches
+ * are stored in a manifest, and are only formed again when the set of sources
+ * or the unity attributes change, so that editing a file doesn't move sources
+ * to other batches (which would recompile all of them). */
+static
+void generate_unity(
+    bake_driver_api *driver,
+    bake_config *config,
+    bake_project *project)
+{
+    int setting = unity_setting(driver, project);
+    if (!setting) {
+        return;
+    }
+
+    bake_attr *exclude_attr = driver->get_attr("unity_exclude");
+    unity_walk_t data = {
+        .program = ut_expr_compile(SOURCE_PATTERN, TRUE, TRUE),
+        .exclude = exclude_attr && exclude_attr->kind == BAKE_ARRAY
+            ? exclude_attr->is.array
+            : NULL
+    };
+    char *manifest_file = ut_asprintf(
+        "%s/" UNITY_DIR "/manifest", project->path);
+    char *manifest = NULL, *old_manifest = NULL;
+    int i;
+
+    ut_iter it = ut_ll_iter(project->sources);
+    while (ut_iter_hasNext(&it)) {
+        char *dir = ut_iter_next(&it);
+        char *path = ut_asprintf("%s/%s", project->path, dir);
+        data.dir = dir;
+        if (ut_file_test(path) == 1 &&
+            ut_dir_walk(path, 0, unity_walk_cb, &data))
+        {
+            free(path);
+            goto error;
+        }
+        free(path);
+    }
+
+    qsort(data.sources, data.count, sizeof(unity_source), unity_compare_name);
+
+    /* Assign batches, and store the sources in the manifest */
+    unity_assign(data.sources, data.count, false, setting);
+    unity_assign(data.sources, data.count, true, setting);
+
+    ut_strbuf buf = UT_STRBUF_INIT;
+    ut_strbuf_append(&buf, "unity %d\n", setting);
+    for (i = 0; i < data.count; i ++) {
+        ut_strbuf_append(&buf, "%s %s\n",
+            data.sources[i].excluded ? "exclude" : "source",
+            data.sources[i].file);
+    }
+    manifest = ut_strbuf_get(&buf);
+
+    /* If the sources didn't change, restore the previous assignment, as
+     * batches formed from the current file sizes may be different */
+    old_manifest = ut_file_test(manifest_file) == 1
+        ? ut_file_load(manifest_file)
+        : NULL;
+
+    size_t len = strlen(manifest);
+    if (old_manifest && !strncmp(old_manifest, manifest, len) &&
+        old_manifest[len] == '\n')
+    {
+        char *ptr = &old_manifest[len + 1];
+        for (i = 0; i < data.count; i ++) {
+            data.sources[i].batch = strtol(ptr, &ptr, 10);
+        }
+    } else {
+        /* Remove unity files of the previous assignment */
+        char *dir = ut_asprintf("%s/" UNITY_DIR, project->path);
+        ut_ok("#[bold]%s#[normal]", dir);
+        int16_t ret = ut_file_test(dir) == 1 ? ut_rm(dir) : 0;
+        if (!ret) {
+            ret = ut_mkdir(dir);
+        }
+        free(dir);
+        if (ret) {
+            goto error;
+        }
+
+        free(old_manifest);
+        old_manifest = NULL;
+    }
+
+    int c_batches = 0, cpp_batches = 0;
+    for (i = 0; i < data.count; i ++) {
+        int *batches = data.sources[i].cpp ? &cpp_batches : &c_batches;
+        if (data.sources[i].batch >= *batches) {
+            *batches = data.sources[i].batch + 1;
+        }
+    }
+
+    if (unity_write(project, data.sources, data.count, false, c_batches) ||
+        unity_write(project, data.sources, data.count, true, cpp_batches))
+    {
+        goto error;
+    }
+
+    /* Manifest is written after the unity files, so an interrupted build
+     * doesn't leave behind an incomplete set of unity files */
+    if (!old_manifest) {
+        ut_strbuf_appendstr(&buf, manifest);
+        ut_strbuf_appendch(&buf, '\n');
+        for (i = 0; i < data.count; i ++) {
+            ut_strbuf_append(&buf, "%d\n", data.sources[i].batch);
+        }
+        char *content = ut_strbuf_get(&buf);
+        int16_t ret = write_if_changed(manifest_file, content);
+        free(content);
+        if (ret) {
+            goto error;
+        }
+    }
+
+    if (unity_touch(project, data.sources, data.count)) {
+        goto error;
+    }
+
+    goto done;
+error:
+    project->error = true;
+done:
+    for (i = 0; i < data.count; i ++) {
+        free(data.sources[i].file);
+    }
+    free(data.sources);
+    ut_expr_free(data.program);
+    free(old_manifest);
+    free(manifest);
+    free(manifest_file);
+}
+
+static
+bool is_cpp_file(
+    bake_project *project,
+    const char *source)
+{
+    const char *ext = strrchr(source, '.');
+
+    if (ext && strcmp(ext, ".c")) {
+        /* If extension is not c, treat as a C++ file */
+        return true;
+    }
+
+    return is_cpp(project);
+}
+
+/* Append compiler, flags and precompiled header for compiling sources */
+static
+void compile_cmd(
+    bake_driver_api *driver,
+    bake_config *config,
+    bake_project *project,
+    bool cpp,
+    bool absolute,
+    ut_strbuf *cmd)
+{
+    compile_flags(driver, config, project, cpp, absolute, cmd);
+
+    /* Use precompiled header if it was built for the language of the file */
+    if (cpp == is_cpp(project)) {
+        char *pch = pch_source(driver, project);
+        if (pch) {
+            char *header = pch_header(config, project, pch);
+            char *gch = ut_asprintf("%s.gch", header);
+            if (ut_file_test(gch) == 1) {
+                append_path(cmd, " -include ", header, absolute);
+            }
+            free(gch);
+            free(header);
+            free(pch);
+        }
+    }
+}
+
 static
 void compile_src(
     bake_driver_api *driver,
@@ -131,88 +1189,627 @@ void compile_src(
     char *target)
 {
     ut_strbuf cmd = UT_STRBUF_INIT;
-    char *ext = strrchr(source, '.');
-    bool cpp = is_cpp(project);
 
-    if (ext && strcmp(ext, ".c")) {
-        /* If extension is not c, treat as a C++ file */
-        cpp = true;
+    compile_cmd(driver, config, project, is_cpp_file(project, source), false,
+        &cmd);
+
+    /* Profiles are matched with the source path, which is absolute in batches */
+    append_path(&cmd, " -c ", source, config->pgo != BAKE_PGO_OFF);
+    ut_strbuf_appendstr(&cmd, " -o ");
+    pgo_target(config, target, &cmd);
+
+    char *cmdstr = ut_strbuf_get(&cmd);
+    driver->exec(cmdstr);
+    free(cmdstr);
+}
+
+/* -- C++ modules (build) */
+
+typedef struct module_unit {
+    char *source;       /* Source file, prefixed with project path */
+    char *object;       /* Object file, prefixed with project path */
+    char *name;         /* Module or partition the unit builds a BMI for */
+    char *module;       /* Module the unit belongs to (for partitions) */
+    ut_ll imports;      /* Imported modules */
+    int state;          /* 0 = not visited, 1 = visiting, 2 = built */
+    bool rebuilt;       /* Was interface compiled in this build */
+} module_unit;
+
+typedef struct module_walk_t {
+    bake_project *project;
+    bake_config *config;
+    bake_driver_api *driver;
+    ut_expr_program program;
+    const char *dir;
+    module_unit *units;
+    int count;
+} module_walk_t;
+
+/* Replace comments with spaces, so declarations in comments are ignored */
+static
+void module_strip_comments(
+    char *content)
+{
+    char *ptr = content;
+
+    while (*ptr) {
+        if (ptr[0] == '/' && ptr[1] == '/') {
+            while (*ptr && *ptr != '\n') {
+                *(ptr ++) = ' ';
+            }
+        } else if (ptr[0] == '/' && ptr[1] == '*') {
+            ptr[0] = ptr[1] = ' ';
+            ptr += 2;
+            while (*ptr && !(ptr[0] == '*' && ptr[1] == '/')) {
+                if (*ptr != '\n') {
+                    *ptr = ' ';
+                }
+                ptr ++;
+            }
+            if (*ptr) {
+                ptr[0] = ptr[1] = ' ';
+                ptr += 2;
+            }
+        } else {
+            ptr ++;
+        }
+    }
+}
+
+/* Match keyword at start of declaration, return text after keyword */
+static
+char* module_keyword(
+    char *ptr,
+    const char *keyword)
+{
+    size_t len = strlen(keyword);
+    if (strncmp(ptr, keyword, len)) {
+        return NULL;
+    }
+    if (ptr[len] != ' ' && ptr[len] != '\t' && ptr[len] != ':' &&
+        ptr[len] != ';' && ptr[len] != '<' && ptr[len] != '"')
+    {
+        return NULL;
+    }
+    ptr += len;
+    while (*ptr == ' ' || *ptr == '\t') {
+        ptr ++;
+    }
+    return ptr;
+}
+
+/* Name of a module declaration or import, up to the ';' */
+static
+char* module_name(
+    char *ptr)
+{
+    char *end = strchr(ptr, ';');
+    char *nl = strchr(ptr, '\n');
+    if (!end || (nl && nl < end)) {
+        return NULL;
+    }
+    while (end > ptr && (end[-1] == ' ' || end[-1] == '\t')) {
+        end --;
+    }
+    char *result = ut_strdup(ptr);
+    result[end - ptr] = '\0';
+    return result;
+}
+
+/* Scan module and import declarations. Header units are not supported, and are
+ * left to the compiler. */
+static
+void module_scan(
+    module_unit *unit,
+    char *content)
+{
+    char *line = content;
+
+    module_strip_comments(content);
+
+    while (line && *line) {
+        char *ptr = line, *decl, *name;
+        bool exported = false;
+
+        while (*ptr == ' ' || *ptr == '\t') {
+            ptr ++;
+        }
+
+        if ((decl = module_keyword(ptr, "export"))) {
+            exported = true;
+            ptr = decl;
+        }
+
+        if ((decl = module_keyword(ptr, "module"))) {
+            /* Skip global module fragment and private module fragment */
+            if ((name = module_name(decl)) && name[0] && name[0] != ':') {
+                char *part = strchr(name, ':');
+                free(unit->module);
+                unit->module = ut_strdup(name);
+                if (part) {
+                    unit->module[part - name] = '\0';
+                }
+                if (exported || part) {
+                    /* Interface units and partitions (including internal
+                     * partitions, which are not exported) produce a BMI */
+                    free(unit->name);
+                    unit->name = name;
+                    name = NULL;
+                } else {
+                    /* Implementation units import their interface */
+                    ut_ll_append(unit->imports, name);
+                    name = NULL;
+                }
+            }
+            free(name);
+        } else if ((decl = module_keyword(ptr, "import"))) {
+            if ((name = module_name(decl)) && name[0] != '<' && name[0] != '"') {
+                if (name[0] == ':' && unit->module) {
+                    char *full = ut_asprintf("%s%s", unit->module, name);
+                    free(name);
+                    name = full;
+                }
+                ut_ll_append(unit->imports, name);
+                name = NULL;
+            }
+            free(name);
+        }
+
+        line = strchr(line, '\n');
+        if (line) {
+            line ++;
+        }
+    }
+}
+
+static
+int module_walk_cb(
+    ut_dir_entry *entry,
+    void *ctx)
+{
+    module_walk_t *data = ctx;
+
+    if (entry->is_dir || !ut_expr_run(data->program, entry->relative) ||
+        !is_cpp_file(data->project, entry->name))
+    {
+        return 0;
+    }
+
+    char *content = ut_file_load(entry->path);
+    if (!content) {
+        ut_throw("failed to read '%s'", entry->path);
+        return -1;
+    }
+
+    module_unit unit = {
+        .source = ut_asprintf("%s/%s/%s",
+            data->project->path, data->dir, entry->relative),
+        .imports = ut_ll_new()
+    };
+
+    char *obj = src_to_obj(
+        data->driver, data->config, data->project, entry->relative);
+    unit.object = ut_asprintf("%s/%s", data->project->path, obj);
+    free(obj);
+
+    module_scan(&unit, content);
+    free(content);
+
+    data->units = realloc(
+        data->units, (data->count + 1) * sizeof(module_unit));
+    data->units[data->count ++] = unit;
+
+    return 0;
+}
+
+static
+module_unit* module_find(
+    module_unit *units,
+    int count,
+    const char *name)
+{
+    int i;
+    for (i = 0; i < count; i ++) {
+        if (units[i].name && !strcmp(units[i].name, name)) {
+            return &units[i];
+        }
+    }
+    return NULL;
+}
+
+/* File name of the BMI of a module. Partitions are stored as module-part, which
+ * is unambiguous as module names cannot contain a '-'. */
+static
+char* module_bmi_file(
+    const char *name)
+{
+    char *result = ut_asprintf("%s.gcm", name), *ptr;
+    for (ptr = result; *ptr; ptr ++) {
+        if (*ptr == ':') {
+            *ptr = '-';
+        }
+    }
+    return result;
+}
+
+static
+time_t module_lastmodified(
+    const char *file)
+{
+    return ut_file_test(file) == 1 ? ut_lastmodified(file) : 0;
+}
+
+/* Add the interfaces installed by the dependencies of the project to the
+ * mapper, so that dependents can import them. */
+static
+void module_mapper_deps(
+    bake_config *config,
+    ut_ll deps,
+    ut_strbuf *buf)
+{
+    ut_iter it = ut_ll_iter(deps);
+    while (ut_iter_hasNext(&it)) {
+        char *dep = ut_iter_next(&it);
+        char *dir = ut_asprintf("%s/bmi/%s", config->target, dep);
+
+        if (ut_file_test(dir) == 1) {
+            ut_iter dir_it;
+            if (!ut_dir_iter(dir, "*.gcm", &dir_it)) {
+                while (ut_iter_hasNext(&dir_it)) {
+                    char *file = ut_iter_next(&dir_it);
+                    char *name = ut_strdup(file), *ptr;
+                    name[strlen(name) - 4] = '\0';
+                    if ((ptr = strchr(name, '-'))) {
+                        *ptr = ':';
+                    }
+                    ut_strbuf_append(buf, "%s ", name);
+                    append_path(buf, "", dir, true);
+                    ut_strbuf_append(buf, "/%s\n", file);
+                    free(name);
+                }
+            }
+        }
+
+        free(dir);
+    }
+}
+
+/* Find the latest installed interface of a dependency with this module */
+static
+time_t module_dep_lastmodified(
+    bake_config *config,
+    bake_project *project,
+    const char *name)
+{
+    ut_ll lists[] = {project->use, project->use_private};
+    char *bmi = module_bmi_file(name);
+    time_t result = 0;
+    int i;
+
+    for (i = 0; i < 2 && !result; i ++) {
+        ut_iter it = ut_ll_iter(lists[i]);
+        while (ut_iter_hasNext(&it)) {
+            char *dep = ut_iter_next(&it);
+            char *file = ut_asprintf("%s/bmi/%s/%s", config->target, dep, bmi);
+            result = module_lastmodified(file);
+            free(file);
+            if (result) {
+                break;
+            }
+        }
+    }
+
+    free(bmi);
+    return result;
+}
+
+/* Compile interface unit after the interfaces it imports. An interface is
+ * compiled again when its source or one of its imports changed. */
+static
+int16_t module_build(
+    bake_driver_api *driver,
+    bake_config *config,
+    bake_project *project,
+    module_unit *units,
+    int count,
+    module_unit *unit,
+    const char *bmi_dir)
+{
+    if (unit->state == 2) {
+        return 0;
+    } else if (unit->state == 1) {
+        ut_throw("cyclic import of module '%s'", unit->name);
+        return -1;
+    }
+
+    unit->state = 1;
+
+    time_t built = module_lastmodified(unit->object);
+    bool outdated = !built || ut_lastmodified(unit->source) > built;
+
+    ut_iter it = ut_ll_iter(unit->imports);
+    while (ut_iter_hasNext(&it)) {
+        char *name = ut_iter_next(&it);
+        module_unit *dep = module_find(units, count, name);
+        if (dep) {
+            if (module_build(
+                driver, config, project, units, count, dep, bmi_dir))
+            {
+                ut_throw("required by module '%s'", unit->name);
+                return -1;
+            }
+            if (dep->rebuilt || module_lastmodified(dep->object) > built) {
+                outdated = true;
+            }
+        } else if (module_dep_lastmodified(config, project, name) > built) {
+            outdated = true;
+        }
+    }
+
+    char *bmi_file = module_bmi_file(unit->name);
+    char *bmi = ut_asprintf("%s/%s", bmi_dir, bmi_file);
+    if (ut_file_test(bmi) != 1) {
+        outdated = true;
+    }
+
+    if (outdated) {
+        char *obj_dir = ut_strdup(unit->object);
+        strrchr(obj_dir, '/')[0] = '\0';
+        ut_ok("#[bold]%s#[normal] (module %s)", unit->source, unit->name);
+        remove(unit->object);
+        if (ut_mkdir(obj_dir)) {
+            project->error = true;
+        } else {
+            compile_src(driver, config, project, unit->source, unit->object);
+            unit->rebuilt = true;
+        }
+        free(obj_dir);
+    }
+
+    free(bmi);
+    free(bmi_file);
+    unit->state = 2;
+
+    return project->error ? -1 : 0;
+}
+
+/* Compile module interfaces before the sources that import them. Interfaces
+ * are compiled in dependency order when the project is initialized. Objects of
+ * the sources that import a changed interface are removed, so that they are
+ * compiled again by the objects rule. */
+static
+void build_modules(
+    bake_driver_api *driver,
+    bake_config *config,
+    bake_project *project)
+{
+    if (!modules_enabled(driver, project)) {
+        return;
+    }
+
+    if (is_clang(true)) {
+        ut_throw("C++ modules are only supported for gcc");
+        project->error = true;
+        return;
     }
 
-    ut_strbuf_append(&cmd, "%s -Wall -fPIC -fno-stack-protector", cc(cpp));
+    module_walk_t data = {
+        .project = project,
+        .config = config,
+        .driver = driver,
+        .program = ut_expr_compile(SOURCE_PATTERN, TRUE, TRUE)
+    };
+    char *bmi_dir = module_bmi_dir(config, project);
+    char *mapper = module_mapper(config, project);
+    ut_strbuf buf = UT_STRBUF_INIT;
+    char *content = NULL;
+    int i;
+
+    ut_iter it = ut_ll_iter(project->sources);
+    while (ut_iter_hasNext(&it)) {
+        char *dir = ut_iter_next(&it);
+        char *path = ut_asprintf("%s/%s", project->path, dir);
+        data.dir = dir;
+        if (ut_file_test(path) == 1 &&
+            ut_dir_walk(path, 0, module_walk_cb, &data))
+        {
+            free(path);
+            goto error;
+        }
+        free(path);
+    }
 
-    if (cpp) {
-        ut_strbuf_appendstr(&cmd, " -std=c++0x -Wno-write-strings");
-    } else {
-        ut_strbuf_appendstr(&cmd, " -std=c99 -D_XOPEN_SOURCE=600");
+    /* Interfaces of the project are stored relative to the BMI directory */
+    ut_strbuf_appendstr(&buf, "$root ");
+    append_path(&buf, "", bmi_dir, true);
+    ut_strbuf_appendch(&buf, '\n');
+    for (i = 0; i < data.count; i ++) {
+        if (data.units[i].name) {
+            char *bmi_file = module_bmi_file(data.units[i].name);
+            ut_strbuf_append(&buf, "%s %s\n", data.units[i].name, bmi_file);
+            free(bmi_file);
+        }
     }
+    module_mapper_deps(config, project->use, &buf);
+    module_mapper_deps(config, project->use_private, &buf);
 
-    ut_strbuf_append(&cmd, " -DBAKE_PROJECT_ID=\"%s\"", project->id);
+    content = ut_strbuf_get(&buf);
+    if (ut_mkdir(bmi_dir) || write_if_changed(mapper, content)) {
+        goto error;
+    }
 
-    char *building_macro = ut_asprintf(" -D%s_IMPL", project->id_underscore);
-    strupper(building_macro);
+    for (i = 0; i < data.count; i ++) {
+        if (data.units[i].name && module_build(driver, config, project,
+            data.units, data.count, &data.units[i], bmi_dir))
+        {
+            goto error;
+        }
+    }
 
-    ut_strbuf_appendstr(&cmd, building_macro);
-    free(building_macro);
+    for (i = 0; i < data.count; i ++) {
+        module_unit *unit = &data.units[i];
+        time_t built;
 
-    if (config->symbols) {
-        ut_strbuf_appendstr(&cmd, " -g");
+        if (unit->name || !(built = module_lastmodified(unit->object))) {
+            continue;
+        }
+
+        it = ut_ll_iter(unit->imports);
+        while (ut_iter_hasNext(&it)) {
+            char *name = ut_iter_next(&it);
+            module_unit *dep = module_find(data.units, data.count, name);
+            time_t t = dep
+                ? module_lastmodified(dep->object)
+                : module_dep_lastmodified(config, project, name);
+            if ((dep && dep->rebuilt) || t > built) {
+                ut_trace("'%s' outdated by module '%s'", unit->source, name);
+                remove(unit->object);
+                break;
+            }
+        }
     }
-    if (!config->debug) {
-        ut_strbuf_appendstr(&cmd, " -DNDEBUG");
+
+    goto done;
+error:
+    project->error = true;
+done:
+    for (i = 0; i < data.count; i ++) {
+        module_unit *unit = &data.units[i];
+        it = ut_ll_iter(unit->imports);
+        while (ut_iter_hasNext(&it)) {
+            free(ut_iter_next(&it));
+        }
+        ut_ll_free(unit->imports);
+        free(unit->source);
+        free(unit->object);
+        free(unit->name);
+        free(unit->module);
     }
-    if (config->optimizations) {
-        ut_strbuf_appendstr(&cmd, " -O3 -flto");
+    free(data.units);
+    ut_expr_free(data.program);
+    free(content);
+    free(mapper);
+    free(bmi_dir);
+}
+
+/* Maximum number of sources passed to a single compiler invocation, unless
+ * specified by the batch attribute. Limits the length of the command, and how
+ * many files are compiled again when a batch fails. */
+#define BATCH_SIZE (32)
+
+static
+int batch_size(
+    bake_driver_api *driver,
+    bake_project *project)
+{
+    bake_attr *attr = driver->get_attr("batch");
+
+    if (!attr) {
+        return BATCH_SIZE;
+    } else if (attr->kind == BAKE_BOOLEAN) {
+        return attr->is.boolean ? BATCH_SIZE : 1;
+    } else if (attr->kind == BAKE_NUMBER && attr->is.number >= 1) {
+        return attr->is.number;
     } else {
-        ut_strbuf_appendstr(&cmd, " -O0");
-    }
-    if (config->strict) {
-        ut_strbuf_appendstr(&cmd, " -Werror -Wextra -pedantic");
+        ut_throw("attribute 'batch' must be a boolean or a positive number");
+        project->error = true;
+        return 1;
     }
+}
 
-    if (!cpp) {
-        /* CFLAGS for c projects */
-        bake_attr *flags_attr = driver->get_attr("cflags");
-        if (flags_attr) {
-            ut_iter it = ut_ll_iter(flags_attr->is.array);
-            while (ut_iter_hasNext(&it)) {
-                bake_attr *flag = ut_iter_next(&it);
-                ut_strbuf_append(&cmd, " %s", flag->is.string);
-            }
+/* The compiler can't write the objects of multiple sources to a specified
+ * file, and instead writes <source name>.o to its working directory. A source
+ * can only be compiled in a batch if that is the name of its target. */
+static
+bool batch_target_matches(
+    const char *source,
+    const char *target)
+{
+    const char *src_name = strrchr(source, '/');
+    const char *dst_name = strrchr(target, '/');
+    src_name = src_name ? src_name + 1 : source;
+    dst_name = dst_name ? dst_name + 1 : target;
+
+    const char *ext = strrchr(src_name, '.');
+    size_t len = ext ? (size_t)(ext - src_name) : strlen(src_name);
+
+    return !strncmp(src_name, dst_name, len) && !strcmp(&dst_name[len], ".o");
+}
+
+/* Compile a batch of sources. Sources of the same language and with the same
+ * object directory are compiled by a single compiler invocation, which runs in
+ * the object directory. When it fails, the sources are compiled one by one, so
+ * diagnostics are reported for the file that caused them. */
+static
+void compile_batch(
+    bake_driver_api *driver,
+    bake_config *config,
+    bake_project *project,
+    int count,
+    char **sources,
+    char **targets)
+{
+    int max = batch_size(driver, project);
+    int *chunk = malloc(count * sizeof(int));
+    bool *done = calloc(count, sizeof(bool));
+    int i, j, n;
+
+    for (i = 0; i < count && !project->error; i ++) {
+        if (done[i]) {
+            continue;
         }
-    } else {
-        /* CXXFLAGS for c4cpp projects */
-        bake_attr *flags_attr = driver->get_attr("cxxflags");
-        if (flags_attr) {
-            ut_iter it = ut_ll_iter(flags_attr->is.array);
-            while (ut_iter_hasNext(&it)) {
-                bake_attr *flag = ut_iter_next(&it);
-                ut_strbuf_append(&cmd, " %s", flag->is.string);
+
+        bool cpp = is_cpp_file(project, sources[i]);
+        const char *dir_end = strrchr(targets[i], '/');
+        size_t dir_len = dir_end ? (size_t)(dir_end - targets[i]) : 0;
+
+        /* Collect sources for chunk */
+        n = 0;
+        if (max > 1 && batch_target_matches(sources[i], targets[i])) {
+            for (j = i; j < count && n < max; j ++) {
+                if (!done[j] &&
+                    is_cpp_file(project, sources[j]) == cpp &&
+                    !strncmp(targets[j], targets[i], dir_len) &&
+                    targets[j][dir_len] == '/' &&
+                    !strchr(&targets[j][dir_len + 1], '/') &&
+                    batch_target_matches(sources[j], targets[j]))
+                {
+                    chunk[n ++] = j;
+                }
             }
         }
-    }
 
-    bake_attr *include_attr = driver->get_attr("include");
-    if (include_attr) {
-        ut_iter it = ut_ll_iter(include_attr->is.array);
-        while (ut_iter_hasNext(&it)) {
-            bake_attr *include = ut_iter_next(&it);
-            char* file = include->is.string;
-            ut_strbuf_append(&cmd, " -I%s", file);
+        if (n < 2) {
+            done[i] = true;
+            compile_src(driver, config, project, sources[i], targets[i]);
+            continue;
         }
-    }
 
-    ut_strbuf_append(&cmd, " -I %s/include", config->target);
+        ut_strbuf cmd = UT_STRBUF_INIT;
+        compile_cmd(driver, config, project, cpp, true, &cmd);
+        ut_strbuf_appendstr(&cmd, " -c");
+        for (j = 0; j < n; j ++) {
+            append_path(&cmd, " ", sources[chunk[j]], true);
+            done[chunk[j]] = true;
+        }
 
-    if (strcmp(config->target, config->home)) {
-        ut_strbuf_append(&cmd, " -I %s/include", config->home);
-    }
+        char *cmdstr = ut_strbuf_get(&cmd);
+        char *dir = ut_asprintf("%.*s", (int)dir_len, targets[i]);
 
-    ut_strbuf_append(&cmd, " -I%s -c %s -o %s", project->path, source, target);
+        if (!driver->try_exec(dir_len ? dir : NULL, cmdstr)) {
+            for (j = 0; j < n && !project->error; j ++) {
+                remove(targets[chunk[j]]);
+                compile_src(driver, config, project,
+                    sources[chunk[j]], targets[chunk[j]]);
+            }
+        }
 
-    char *cmdstr = ut_strbuf_get(&cmd);
-    driver->exec(cmdstr);
-    free(cmdstr);
+        free(dir);
+        free(cmdstr);
+    }
+
+    free(done);
+    free(chunk);
 }
 
 static
@@ -301,6 +1898,386 @@ bool is_dylib(
     }
 }
 
+/* -- Linker selection */
+
+/* Linkers to look for when no linker is specified, fastest first */
+static const char *linkers[] = {"mold", "lld", "gold", NULL};
+
+/* Linkers are probed once per process, for the C and C++ compiler */
+static ut_mutex_s linker_lock = UT_MUTEX_INIT;
+static const char *linker_probed[2];
+
+static
+bool linker_available(
+    const char *compiler,
+    const char *linker)
+{
+    char *use_ld = ut_asprintf("-fuse-ld=%s", linker);
+    char *argv[] = {(char*)compiler, use_ld, "-Wl,--version", NULL};
+    int8_t rc = 0;
+    bool result = false;
+
+    ut_proc pid = ut_proc_runRedirect(compiler, argv, stdin, NULL, NULL);
+    if (pid > 0) {
+        result = !ut_proc_wait(pid, &rc) && !rc;
+    }
+
+    /* A linker that is not available is not an error */
+    ut_catch();
+    free(use_ld);
+
+    return result;
+}
+
+/* Linker to pass to the compiler, or NULL to use the default linker. The
+ * linker attribute of the project overrides the linker configuration
+ * parameter. If neither is set, the fastest available linker is used when
+ * optimizations are disabled, as linking is the serial tail of incremental
+ * builds. */
+static
+const char* linker(
+    bake_driver_api *driver,
+    bake_config *config,
+    bake_project *project,
+    bool cpp)
+{
+    const char *setting = config->linker;
+    int lang = cpp ? 1 : 0;
+
+    bake_attr *attr = driver->get_attr("linker");
+    if (attr) {
+        if (attr->kind != BAKE_STRING) {
+            ut_throw("attribute 'linker' must be a string");
+            project->error = true;
+            return NULL;
+        }
+        setting = attr->is.string;
+    }
+
+    if (!setting) {
+        setting = config->optimizations ? "default" : "auto";
+    }
+
+    if (strcmp(setting, "default") && strcmp(setting, "auto")) {
+        const char **l;
+        for (l = linkers; *l; l ++) {
+            if (!strcmp(setting, *l)) {
+                break;
+            }
+        }
+        if (!*l) {
+            ut_throw("invalid linker '%s' "
+                "(expected mold, lld, gold, auto or default)", setting);
+            project->error = true;
+            return NULL;
+        }
+    }
+
+    if (!strcmp(setting, "default")) {
+        return NULL;
+    } else if (strcmp(setting, "auto")) {
+        return setting;
+    } else if (is_darwin()) {
+        return NULL;
+    }
+
+    ut_mutex_lock(&linker_lock);
+    if (!linker_probed[lang]) {
+        const char **l;
+        linker_probed[lang] = "";
+        for (l = linkers; *l; l ++) {
+            if (linker_available(cc(cpp), *l)) {
+                linker_probed[lang] = *l;
+                break;
+            }
+        }
+        ut_trace("using linker '%s' for %s",
+            linker_probed[lang][0] ? linker_probed[lang] : "default",
+            cc(cpp));
+    }
+    ut_mutex_unlock(&linker_lock);
+
+    return linker_probed[lang][0] ? linker_probed[lang] : NULL;
+}
+
+/* -- Release link profile */
+
+typedef struct export_scan_t {
+    const char *macro;      /* <ID>_EXPORT */
+    ut_ll symbols;          /* Names of exported declarations */
+} export_scan_t;
+
+static
+bool is_ident_char(
+    char ch)
+{
+    return isalnum(ch) || ch == '_';
+}
+
+static
+void export_add(
+    export_scan_t *data,
+    const char *name,
+    int len)
+{
+    ut_iter it = ut_ll_iter(data->symbols);
+    while (ut_iter_hasNext(&it)) {
+        char *symbol = ut_iter_next(&it);
+        if (!strncmp(symbol, name, len) && !symbol[len]) {
+            return;
+        }
+    }
+
+    ut_ll_append(data->symbols, ut_asprintf("%.*s", len, name));
+}
+
+/* Keywords and builtin types that are never the name of a declaration */
+static const char *export_keywords[] = {
+    "auto", "bool", "char", "const", "double", "enum", "extern", "float",
+    "inline", "int", "long", "register", "restrict", "short", "signed",
+    "static", "struct", "typedef", "union", "unsigned", "void", "volatile",
+    "_Bool", NULL};
+
+static
+const char* export_keyword(
+    const char *ident,
+    int len)
+{
+    const char **kw;
+    for (kw = export_keywords; *kw; kw ++) {
+        if (!strncmp(*kw, ident, len) && !(*kw)[len]) {
+            return *kw;
+        }
+    }
+    return NULL;
+}
+
+/* Find declarations marked with the export macro. The name of a declaration is
+ * the last identifier that is not a keyword or struct tag before its parameter
+ * list, array size, initializer or terminator. A pointer declarator, like
+ * (*name)(int), is followed by the name. Types (which are followed by a body)
+ * and typedefs have no symbol. */
+static
+void export_scan(
+    export_scan_t *data,
+    const char *content)
+{
+    size_t len = strlen(data->macro);
+    const char *ptr = content;
+
+    while ((ptr = strstr(ptr, data->macro))) {
+        const char *start = ptr;
+        ptr += len;
+
+        if ((start != content && is_ident_char(start[-1])) ||
+            is_ident_char(*ptr))
+        {
+            continue;
+        }
+
+        /* Skip preprocessor directives, like the definition of the macro */
+        const char *line = start;
+        while (line != content && line[-1] != '\n') {
+            line --;
+        }
+        while (*line == ' ' || *line == '\t') {
+            line ++;
+        }
+        if (*line == '#') {
+            continue;
+        }
+
+        const char *cur = ptr, *name = NULL;
+        int name_len = 0;
+        bool is_tag = false, is_typedef = false;
+
+        while (*cur && !strchr(";[=,{", *cur)) {
+            if (is_ident_char(*cur)) {
+                const char *ident = cur;
+                while (is_ident_char(*cur)) {
+                    cur ++;
+                }
+
+                const char *kw = export_keyword(ident, cur - ident);
+                if (kw) {
+                    is_tag = !strcmp(kw, "struct") || !strcmp(kw, "union") ||
+                        !strcmp(kw, "enum");
+                    is_typedef |= !strcmp(kw, "typedef");
+                } else if (is_tag) {
+                    is_tag = false;
+                } else if (!isdigit(*ident)) {
+                    name = ident;
+                    name_len = cur - ident;
+                }
+                continue;
+            }
+
+            if (*cur == '(') {
+                const char *next = cur + 1;
+                while (isspace(*next)) {
+                    next ++;
+                }
+                if (*next != '*') {
+                    break; /* Parameter list */
+                }
+                name = NULL;
+            }
+
+            cur ++;
+        }
+
+        if (*cur && *cur != '{' && name && !is_typedef) {
+            export_add(data, name, name_len);
+        }
+    }
+}
+
+static
+int export_scan_cb(
+    ut_dir_entry *entry,
+    void *ctx)
+{
+    const char *ext = strrchr(entry->name, '.');
+    if (entry->is_dir || !ext || (strcmp(ext, ".h") && strcmp(ext, ".c"))) {
+        return 0;
+    }
+
+    char *content = ut_file_load(entry->path);
+    if (content) {
+        export_scan(ctx, content);
+        free(content);
+    }
+
+    return 0;
+}
+
+/* Generate a version script that only exports the declarations marked with
+ * <ID>_EXPORT in the headers and sources of the project. This also hides the
+ * symbols of static libraries linked with the package. Returns NULL when the
+ * project has no marked declarations, or for C++, which has mangled names. */
+static
+char* version_script(
+    bake_config *config,
+    bake_project *project)
+{
+    if (is_cpp(project)) {
+        return NULL;
+    }
+
+    char *macro = ut_asprintf("%s_EXPORT", project->id_underscore);
+    strupper(macro);
+    export_scan_t data = {.macro = macro, .symbols = ut_ll_new()};
+    char *result = NULL;
+
+    ut_ll dirs[] = {project->includes, project->sources};
+    int i;
+    for (i = 0; i < 2; i ++) {
+        ut_iter it = ut_ll_iter(dirs[i]);
+        while (ut_iter_hasNext(&it)) {
+            char *dir = ut_iter_next(&it);
+            char *path = ut_asprintf("%s/%s", project->path, dir);
+            if (ut_file_test(path) == 1) {
+                ut_dir_walk(path, 0, export_scan_cb, &data);
+            }
+            free(path);
+        }
+    }
+
+    if (ut_ll_count(data.symbols)) {
+        ut_strbuf buf = UT_STRBUF_INIT;
+        ut_strbuf_appendstr(&buf, "{\n    global:\n");
+        ut_iter it = ut_ll_iter(data.symbols);
+        while (ut_iter_hasNext(&it)) {
+            char *symbol = ut_iter_next(&it);
+            ut_strbuf_append(&buf, "        %s;\n", symbol);
+            free(symbol);
+        }
+        ut_strbuf_appendstr(&buf, "    local:\n        *;\n};\n");
+
+        char *content = ut_strbuf_get(&buf);
+        result = ut_asprintf("%s/" OBJ_DIR "/%s-%s/%s.map", project->path,
+            UT_PLATFORM_STRING, config->configuration, project->artefact);
+        if (write_if_changed(result, content)) {
+            free(result);
+            result = NULL;
+        }
+        free(content);
+    }
+
+    ut_ll_free(data.symbols);
+    free(macro);
+
+    return result;
+}
+
+/* Remove unused sections, optimize the symbol hash table, only link with
+ * libraries that are used and limit exported symbols to the package API. A
+ * binary that exports fewer symbols is smaller and loads faster, as the
+ * dynamic loader has fewer symbols to resolve. */
+static
+void release_link_flags(
+    bake_driver_api *driver,
+    bake_config *config,
+    bake_project *project,
+    const char *ld,
+    bool hide_symbols,
+    ut_strbuf *buf)
+{
+    if (is_darwin()) {
+        ut_strbuf_appendstr(buf, " -Wl,-dead_strip");
+        return;
+    }
+
+    bake_attr *attr = driver->get_attr("version_script");
+    if (attr && attr->kind != BAKE_BOOLEAN) {
+        ut_throw("attribute 'version_script' must be a boolean");
+        project->error = true;
+        return;
+    }
+
+    ut_strbuf_appendstr(buf,
+        " -Wl,--gc-sections -Wl,-O1 -Wl,--as-needed -Wl,--hash-style=gnu");
+
+    if (hide_symbols && (!attr || attr->is.boolean)) {
+        char *script = version_script(config, project);
+        if (script) {
+            ut_strbuf_append(buf, " -Wl,--version-script=%s", script);
+
+            /* lld rejects symbols in the script that are not defined */
+            if (ld && !strcmp(ld, "lld")) {
+                ut_strbuf_appendstr(buf, " -Wl,--undefined-version");
+            }
+            free(script);
+        }
+    }
+}
+
+/* Report the size of an artefact compared to the installed artefact, so the
+ * effect of changes on binary size is visible in builds. */
+static
+void report_size(
+    bake_config *config,
+    bake_project *project,
+    const char *target,
+    off_t installed)
+{
+    struct stat st;
+    if (stat(target, &st)) {
+        return;
+    }
+
+    if (installed < 0) {
+        ut_log("#[grey]size#[normal] %s %ldKB\n",
+            project->artefact, (long)(st.st_size / 1024));
+    } else {
+        long delta = st.st_size - installed;
+        ut_log("#[grey]size#[normal] %s %ldKB (%s%ld bytes, %+.1f%%)\n",
+            project->artefact, (long)(st.st_size / 1024),
+            delta > 0 ? "+" : "", delta,
+            installed ? 100.0 * delta / installed : 0);
+    }
+}
+
 static
 void link_dynamic_binary(
     bake_driver_api *driver,
@@ -314,15 +2291,27 @@ void link_dynamic_binary(
     ut_ll static_object_paths = NULL;
 
     bool cpp = is_cpp(project);
-    bool export_symbols = driver->get_attr_bool("export_symbols");
 
-    ut_strbuf_append(&cmd, "%s -Wall -fPIC", cc(cpp));
+    ut_strbuf_appendstr(&cmd, cc(cpp));
+    ut_strbuf_appendstr(&cmd, " -Wall -fPIC");
+
+    const char *ld = linker(driver, config, project, cpp);
+    if (project->error) {
+        ut_strbuf_reset(&cmd);
+        return;
+    } else if (ld) {
+        ut_strbuf_append(&cmd, " -fuse-ld=%s", ld);
+    }
+
+    /* Let the linker build an index of the split debug information, so the
+     * debugger doesn't have to load all .dwo files (not supported by bfd) */
+    if (split_debug(config) && ld && strcmp(ld, "bfd")) {
+        ut_strbuf_appendstr(&cmd, " -Wl,--gdb-index");
+    }
 
     if (project->type == BAKE_PACKAGE) {
-        if (!export_symbols && !is_darwin()) {
-            ut_strbuf_appendstr(&cmd, " -Wl,-fvisibility=hidden");
-            hide_symbols = true;
-        }
+        /* Symbols are hidden when compiling, with -fvisibility=hidden */
+        hide_symbols = symbols_hidden(driver, project);
         ut_strbuf_appendstr(&cmd, " -fno-stack-protector --shared");
         if (!is_darwin()) {
             ut_strbuf_appendstr(&cmd, " -Wl,-z,defs");
@@ -335,6 +2324,18 @@ void link_dynamic_binary(
         ut_strbuf_appendstr(&cmd, " -O0");
     }
 
+    arch_flags(config, &cmd);
+    lto_link_flags(config, project, cpp, &cmd);
+
+    if (release_profile(config)) {
+        release_link_flags(driver, config, project, ld, hide_symbols, &cmd);
+        if (project->error) {
+            ut_strbuf_reset(&cmd);
+            return;
+        }
+    }
+    pgo_flags(config, project, cpp, &cmd);
+
     if (config->strict) {
         ut_strbuf_appendstr(&cmd, " -Werror -pedantic");
     }
@@ -349,24 +2350,30 @@ void link_dynamic_binary(
         ut_iter it = ut_ll_iter(flags_attr->is.array);
         while (ut_iter_hasNext(&it)) {
             bake_attr *flag = ut_iter_next(&it);
-            ut_strbuf_append(&cmd, " %s", flag->is.string);
+            ut_strbuf_appendch(&cmd, ' ');
+            ut_strbuf_appendstr(&cmd, flag->is.string);
         }
     }
 
-    ut_strbuf_append(&cmd, " %s", source);
+    ut_strbuf_appendch(&cmd, ' ');
+    ut_strbuf_appendstr(&cmd, source);
 
     if (ut_file_test(config->target_lib)) {
-        ut_strbuf_append(&cmd, " -L%s", config->target_lib);
+        ut_strbuf_appendstr(&cmd, " -L");
+        ut_strbuf_appendstr(&cmd, config->target_lib);
     }
 
     if (strcmp(config->target, config->home)) {
-        ut_strbuf_append(&cmd, " -L%s/lib", config->home);
+        ut_strbuf_appendstr(&cmd, " -L");
+        ut_strbuf_appendstr(&cmd, config->home);
+        ut_strbuf_appendstr(&cmd, "/lib");
     }
 
     ut_iter it = ut_ll_iter(project->link);
     while (ut_iter_hasNext(&it)) {
         char *dep = ut_iter_next(&it);
-        ut_strbuf_append(&cmd, " -l%s", dep);
+        ut_strbuf_appendstr(&cmd, " -l");
+        ut_strbuf_appendstr(&cmd, dep);
     }
 
     bake_attr *static_lib_attr = driver->get_attr("static_lib");
@@ -385,22 +2392,27 @@ void link_dynamic_binary(
                     continue;
                 }
 
-                char *cwd = strdup(ut_cwd());
                 char *obj_path = ut_asprintf(".bake_cache/obj_%s/%s-%s",
                     lib->is.string, UT_PLATFORM_STRING, config->configuration);
-                char *unpack_cmd = ut_asprintf("ar x %s", static_lib);
+                ut_strbuf unpack = UT_STRBUF_INIT;
+                append_path(&unpack, "ar x ", static_lib, true);
+                char *unpack_cmd = ut_strbuf_get(&unpack);
 
                 /* The ar command doesn't have an option to output files to a
-                 * specific directory, so have to use chdir. This will be an
-                 * issue for multithreaded builds. */
+                 * specific directory, so run it in the directory. Don't
+                 * change the directory of bake, as other projects may be
+                 * building in parallel. */
                 ut_mkdir(obj_path);
-                ut_chdir(obj_path);
-                driver->exec(unpack_cmd);
+                if (!driver->try_exec(obj_path, unpack_cmd)) {
+                    ut_throw("failed to unpack static library '%s'",
+                        static_lib);
+                    project->error = true;
+                }
                 free(unpack_cmd);
                 free(static_lib);
-                ut_chdir(cwd);
-                free(cwd);
-                ut_strbuf_append(&cmd, " %s/*", obj_path);
+                ut_strbuf_appendch(&cmd, ' ');
+                ut_strbuf_appendstr(&cmd, obj_path);
+                ut_strbuf_appendstr(&cmd, "/*");
 
                 if (!static_object_paths) {
                     static_object_paths = ut_ll_new();
@@ -408,7 +2420,8 @@ void link_dynamic_binary(
 
                 ut_ll_append(static_object_paths, obj_path);
             } else {
-                ut_strbuf_append(&cmd, " -l%s", lib->is.string);
+                ut_strbuf_appendstr(&cmd, " -l");
+                ut_strbuf_appendstr(&cmd, lib->is.string);
             }
         }
     }
@@ -418,11 +2431,12 @@ void link_dynamic_binary(
         ut_iter it = ut_ll_iter(libpath_attr->is.array);
         while (ut_iter_hasNext(&it)) {
             bake_attr *lib = ut_iter_next(&it);
-            ut_strbuf_append(&cmd, " -L%s", lib->is.string);
+            ut_strbuf_appendstr(&cmd, " -L");
+            ut_strbuf_appendstr(&cmd, lib->is.string);
 
             if (is_darwin()) {
-                ut_strbuf_append(
-                    &cmd, " -Xlinker -rpath -Xlinker %s", lib->is.string);
+                ut_strbuf_appendstr(&cmd, " -Xlinker -rpath -Xlinker ");
+                ut_strbuf_appendstr(&cmd, lib->is.string);
             }
         }
     }
@@ -434,12 +2448,14 @@ void link_dynamic_binary(
             bake_attr *lib = ut_iter_next(&it);
             const char *mapped = lib_map(lib->is.string);
             if (mapped) {
-                ut_strbuf_append(&cmd, " -l%s", mapped);
+                ut_strbuf_appendstr(&cmd, " -l");
+                ut_strbuf_appendstr(&cmd, mapped);
             }
         }
     }
 
-    ut_strbuf_append(&cmd, " -o %s", target);
+    ut_strbuf_appendstr(&cmd, " -o ");
+    ut_strbuf_appendstr(&cmd, target);
 
     char *cmdstr = ut_strbuf_get(&cmd);
     driver->exec(cmdstr);
@@ -467,7 +2483,12 @@ void link_static_binary(
     char *target)
 {
     ut_strbuf cmd = UT_STRBUF_INIT;
-    ut_strbuf_append(&cmd, "ar rcs %s %s", target, source);
+    char *ar = archiver(config, is_cpp(project));
+    ut_strbuf_append(&cmd, "%s rcs ", ar);
+    free(ar);
+    ut_strbuf_appendstr(&cmd, target);
+    ut_strbuf_appendch(&cmd, ' ');
+    ut_strbuf_appendstr(&cmd, source);
     char *cmdstr = ut_strbuf_get(&cmd);
     driver->exec(cmdstr);
     free(cmdstr);
@@ -482,12 +2503,28 @@ void link_binary(
     char *target)
 {
     bool link_static = driver->get_attr_bool("static_artefact");
+    off_t installed = -1;
+
+    if (release_profile(config)) {
+        struct stat st;
+        char *file = ut_asprintf("%s/%s", project->type == BAKE_PACKAGE
+            ? config->target_lib
+            : config->target_bin, project->artefact);
+        if (!stat(file, &st)) {
+            installed = st.st_size;
+        }
+        free(file);
+    }
 
     if (link_static) {
         link_static_binary(driver, config, project, source, target);
     } else {
         link_dynamic_binary(driver, config, project, source, target);
     }
+
+    if (release_profile(config) && !project->error) {
+        report_size(config, project, target, installed);
+    }
 }
 
 static
@@ -496,7 +2533,9 @@ void init(
     bake_config *config,
     bake_project *project)
 {
-
+    build_pch(driver, config, project);
+    generate_unity(driver, config, project);
+    build_modules(driver, config, project);
 }
 
 static
@@ -745,12 +2784,15 @@ void generate(
     /* Ensure include directory exists */
     ut_mkdir("%s/include", project->path);
 
-    /* Create main header file */
+    /* Create main header file. The header is written to a temporary file
+     * first, so it is only replaced when it changed, which would invalidate
+     * the precompiled header. */
     char *header_filename = ut_asprintf(
         "%s/include/prebaked.h", project->path);
-    FILE *f = fopen(header_filename, "w");
+    char *tmp_filename = ut_asprintf("%s.tmp", header_filename);
+    FILE *f = fopen(tmp_filename, "w");
     if (!f) {
-        ut_throw("failed to open file '%s'", header_filename);
+        ut_throw("failed to open file '%s'", tmp_filename);
         project->error = true;
         return;
     }
@@ -796,8 +2838,28 @@ void generate(
       "#define %s_EXPORT\n"
       "#endif\n", id_upper, id_upper, id_upper, id_upper, id_upper, id_upper);
 
+    fprintf(f, "\n/* Convenience macro for compiling a function for multiple "
+               "instruction sets */\n");
+    fprintf(f,
+      "#if defined(BAKE_TARGET_CLONES) && defined(__GNUC__)\n"
+      "#define %s_CLONES __attribute__((target_clones(BAKE_TARGET_CLONES)))\n"
+      "#else\n"
+      "#define %s_CLONES\n"
+      "#endif\n", id_upper, id_upper);
+
     fprintf(f, "%s", "\n#endif\n\n");
     fclose(f);
+
+    char *content = ut_file_load(tmp_filename);
+    remove(tmp_filename);
+    if (!content || write_if_changed(header_filename, content)) {
+        project->error = true;
+    }
+
+    free(content);
+    free(tmp_filename);
+    free(header_filename);
+    free(id_upper);
 }
 
 /* -- Rules */
@@ -806,20 +2868,27 @@ int bakemain(bake_driver_api *driver) {
     ut_init("driver/bake/c");
 
     /* Create pattern that matches source files */
-    driver->pattern("SOURCES", "//*.c|*.cpp|*.cxx");
+    driver->pattern("SOURCES", SOURCE_PATTERN);
 
     /* Create rule for dynamically generating dep files from source files */
     driver->rule("deps", "$SOURCES", driver->target_map(src_to_dep), generate_deps);
 
-    /* Create rule for dynamically generating object files from source files */
-    driver->rule("objects", "$SOURCES", driver->target_map(src_to_obj), compile_src);
+    /* Create rule for dynamically generating object files from source files.
+     * Outdated sources are compiled in batches. */
+    driver->batch_rule("objects", "$SOURCES", driver->target_map(src_to_obj), compile_batch);
+
+    /* In unity mode, compile the generated unity files instead of sources */
+    driver->pattern("UNITY", UNITY_DIR "/*.c|*.cpp");
+    driver->batch_rule("unity_objects", "$UNITY", driver->target_map(src_to_obj), compile_batch);
+    driver->condition("objects", is_not_unity);
+    driver->condition("unity_objects", is_unity);
 
     /* Create rule for dynamically generating dependencies for every object in
      * $objects, using the generated dependency files. */
     driver->dependency_rule("$objects", "$deps", driver->target_map(obj_to_dep), obj_deps);
 
     /* Create rule for creating binary from objects */
-    driver->rule("ARTEFACT", "$objects", driver->target_pattern(NULL), link_binary);
+    driver->rule("ARTEFACT", "$objects,$unity_objects", driver->target_pattern(NULL), link_binary);
 
     /* Generate header file that automatically includes project dependencies */
     driver->generate(generate);
@@ -0,0 +1,8 @@
+#ifndef APP_EXPORTS_H
+#define APP_EXPORTS_H
+
+/* This generated file contains includes for project dependencies */
+#include "prebaked.h"
+
+#endif
+
@@ -0,0 +1,14 @@
+#include <include/app_exports.h>
+#include <stdio.h>
+
+static
+void app_exports_print(int count) {
+    printf("app_exports called %d time(s)\n", count);
+}
+
+int main(int argc, char *argv[]) {
+    pkg_exports_call();
+    pkg_exports_cb = app_exports_print;
+    pkg_exports_call();
+    return pkg_exports_calls.count != 2;
+}
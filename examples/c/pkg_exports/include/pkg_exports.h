@@ -0,0 +1,22 @@
+#ifndef PKG_EXPORTS_H
+#define PKG_EXPORTS_H
+
+/* This generated file contains includes for project dependencies */
+#include "prebaked.h"
+
+typedef struct pkg_exports_counter {
+    int count;
+} pkg_exports_counter;
+
+/* Exported variable */
+PKG_EXPORTS_EXPORT
+extern pkg_exports_counter pkg_exports_calls;
+
+/* Exported function pointer */
+PKG_EXPORTS_EXPORT
+extern void (*pkg_exports_cb)(int count);
+
+PKG_EXPORTS_EXPORT
+void pkg_exports_call(void);
+
+#endif
@@ -0,0 +1,16 @@
+#include <include/pkg_exports.h>
+#include <stdio.h>
+
+pkg_exports_counter pkg_exports_calls;
+
+static
+void pkg_exports_print(int count) {
+    printf("pkg_exports called %d time(s)\n", count);
+}
+
+void (*pkg_exports_cb)(int count) = pkg_exports_print;
+
+void pkg_exports_call(void) {
+    pkg_exports_calls.count ++;
+    pkg_exports_cb(pkg_exports_calls.count);
+}
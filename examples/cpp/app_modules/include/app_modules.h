@@ -0,0 +1,9 @@
+#ifndef APP_MODULES_H
+#define APP_MODULES_H
+
+/* This generated file contains includes for project dependencies */
+#include "prebaked.h"
+
+
+#endif
+
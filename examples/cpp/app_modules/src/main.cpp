@@ -0,0 +1,9 @@
+#include <include/app_modules.h>
+#include <iostream>
+
+import greeting;
+
+int main(int argc, char *argv[]) {
+    std::cout << greeting_text() << " (" << greeting_length() << ")" << std::endl;
+    return 0;
+}
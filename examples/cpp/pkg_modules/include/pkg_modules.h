@@ -0,0 +1,9 @@
+#ifndef PKG_MODULES_H
+#define PKG_MODULES_H
+
+/* This generated file contains includes for project dependencies */
+#include "prebaked.h"
+
+
+#endif
+
@@ -0,0 +1,9 @@
+module greeting:count;
+
+int count(const char *str) {
+    int result = 0;
+    while (str[result]) {
+        result ++;
+    }
+    return result;
+}
@@ -0,0 +1,11 @@
+export module greeting;
+
+/* Exported partition, which importers of greeting can use */
+export import :text;
+
+/* Internal partition, only visible within the module */
+import :count;
+
+export int greeting_length() {
+    return count(greeting_text());
+}
@@ -0,0 +1,5 @@
+export module greeting:text;
+
+export const char* greeting_text() {
+    return "Hello modules!";
+}
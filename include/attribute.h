@@ -50,16 +50,4 @@ bake_attr *bake_attr_get(
     ut_ll attributes,
     const char *name);
 
-/** Free attribute */
-void bake_attr_free(
-    bake_attr *attr);
-
-/** Free attribute list */
-void bake_attr_free_attr_array(
-    ut_ll list);
-
-/** Free list of strings (used for array attributes) */
-void bake_attr_free_string_array(
-    ut_ll list);
-
 #endif
@@ -31,6 +31,21 @@
 extern "C" {
 #endif
 
+/* Link time optimization mode */
+typedef enum bake_lto {
+    BAKE_LTO_DEFAULT,           /* Enabled when optimizations are enabled */
+    BAKE_LTO_OFF,
+    BAKE_LTO_ON,
+    BAKE_LTO_THIN               /* Incremental LTO, if supported by toolchain */
+} bake_lto;
+
+/* Profile guided optimization mode */
+typedef enum bake_pgo {
+    BAKE_PGO_OFF,
+    BAKE_PGO_GENERATE,          /* Build instrumented binaries (bake pgo) */
+    BAKE_PGO_USE                /* Optimize with profiles, if up to date */
+} bake_pgo;
+
 struct bake_config {
     const char *environment;    /* Id of environment in use */
     const char *configuration;  /* Id of configuration in use */
@@ -41,6 +56,20 @@ struct bake_config {
     bool optimizations;         /* Enable optimizations in binaries */
     bool coverage;              /* Enable code coverage in binaries */
     bool strict;                /* Enable strict compiler settings */
+    bool split_debug;           /* Store debug information outside objects */
+    bake_lto lto;               /* Link time optimization (never DEFAULT) */
+    uint32_t lto_jobs;          /* Parallel LTO jobs (0 = use job slots) */
+    bake_pgo pgo;               /* Profile guided optimization */
+    char *linker;               /* Linker to use (mold, lld, gold, default) */
+    char *arch;                 /* Instruction set to generate code for */
+    char *tune;                 /* Processor to tune generated code for */
+    char *target_clones;        /* Comma separated targets for <ID>_CLONES */
+
+    /* Build settings */
+    uint32_t jobs;              /* Number of jobs that run in parallel */
+    uint64_t mem_budget;        /* Memory available to parallel jobs (KB) */
+    double load_average;        /* Don't start jobs above this load (0 = off) */
+    bool keep_going;            /* Build what doesn't depend on failures */
 
     /* Environment attribubtes */
     ut_ll env_variables;        /* List with environment variable names */
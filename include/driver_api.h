@@ -67,6 +67,17 @@ void (*bake_rule_action_cb)(
     char *src,
     char *target);
 
+/** Batch action rule callback. Invoked with a number of outdated inputs of a
+ * map rule and their targets. */
+typedef
+void (*bake_rule_batch_cb)(
+    bake_driver_api *driver,
+    bake_config *config,
+    bake_project *project,
+    int count,
+    char **sources,
+    char **targets);
+
 /** Map rule callback */
 typedef
 char* (*bake_rule_map_cb)(
@@ -199,6 +210,21 @@ struct bake_driver_api {
     /* Get a driver-specific attribute */
     bool (*get_attr_bool)(
         const char *name);
+
+    /* Create a map rule with an action that is invoked for batches of
+     * outdated inputs, to save the cost of starting a command per input */
+    void (*batch_rule)(
+        const char *name,
+        const char *source,
+        bake_rule_target target,
+        bake_rule_batch_cb action);
+
+    /* Execute a command in a directory (NULL for the current directory).
+     * Returns false if the command failed, without reporting the error or the
+     * output of the command, so the driver can try another way. */
+    bool (*try_exec)(
+        const char *dir,
+        const char *cmd);
 };
 
 #endif
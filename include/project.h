@@ -73,6 +73,7 @@ struct bake_project {
     char *artefact_file;    /* Project path including artefact name */
     char *bin_path;         /* Project bin path (not including platform) */
     char *cache_path;       /* Project path containing temporary build files */
+    char *pgo_path;         /* Project path containing PGO profiles */
     char *id_underscore;    /* Id with underscores instead of dots */
     char *id_dash;          /* Id with dashes instead of dots */
     char *id_short;         /* Last element of id */
@@ -80,10 +81,14 @@ struct bake_project {
     /* Direct access to the parson JSON data */
     void *json;
 
+    /* Memory owned by project, released by bake_project_free */
+    ut_arena *arena;
+
     /* Runtime status (managed by language binding) */
     bool error;
     bool freshly_baked;
     bool changed;
+    bool pgo_profile;       /* PGO profiles are available and up to date */
 
     /* Should project be rebuilt (managed by bake action) */
     bool artefact_outdated;
@@ -93,6 +98,9 @@ struct bake_project {
     int unresolved_dependencies; /* number of dependencies still to be built */
     ut_ll dependents; /* projects that depend on this project */
     bool built;
+    bool skipped; /* not built because a dependency failed (keep-going) */
+    double priority; /* estimated duration of longest path to end of build */
+    bool priority_set;
 
     /* Files to be cleaned other than objects and artefact (populated by
      * language binding) */
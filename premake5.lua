@@ -23,7 +23,7 @@ workspace "bake"
       symbols "On"
 
     configuration "release"
-      defines { "NDEBUG" }
+      defines { "NDEBUG", "UT_LOG_MIN_LEVEL=UT_OK" }
       optimize "On"
 
     filter { "system:macosx", "action:gmake"}
@@ -177,11 +177,13 @@ char* bake_attr_replace(
 {
     const char *func = input, *next = NULL;
     ut_strbuf output = UT_STRBUF_INIT;
-    bool replaced = false;
 
-    while ((next = strchr(func, '$'))) {
-        replaced = true;
+    /* Most strings don't contain functions */
+    if (!strchr(input, '$')) {
+        return ut_strdup(input);
+    }
 
+    while ((next = strchr(func, '$'))) {
         /* Add everything up until next $ */
         ut_strbuf_appendstrn(&output, (char*)func, next - func);
 
@@ -195,7 +197,7 @@ char* bake_attr_replace(
             }
             if (!end) {
                 ut_throw("no matching '}' in '%s'", input);
-                free (ut_strbuf_get(&output));
+                ut_strbuf_reset(&output);
                 goto error;
             }
 
@@ -205,7 +207,7 @@ char* bake_attr_replace(
             for (ptr = start; ptr < end; ptr ++) {
                 if (!isalpha(*ptr) && *ptr != '_' && !isdigit(*ptr)) {
                     ut_throw("invalid function identifier in '%s'", input);
-                    free (ut_strbuf_get(&output));
+                    ut_strbuf_reset(&output);
                     goto error;
                 }
                 func_id[ptr - start] = *ptr;
@@ -219,7 +221,7 @@ char* bake_attr_replace(
                 for (ptr = start; ptr < end; ptr ++) {
                     if (!isalpha(*ptr) && *ptr != '_' && !isdigit(*ptr)) {
                         ut_throw("invalid function argument in '%s'", input);
-                        free (ut_strbuf_get(&output));
+                        ut_strbuf_reset(&output);
                         goto error;
                     }
                     arg_id[ptr - start] = *ptr;
@@ -235,14 +237,14 @@ char* bake_attr_replace(
                 func_id,
                 arg_id))
             {
-                free (ut_strbuf_get(&output));
+                ut_strbuf_reset(&output);
                 goto error;
             }
 
             func = func_end + 1;
         } else {
             /* Keep $ */
-            ut_strbuf_appendstrn(&output, "$", 1);
+            ut_strbuf_appendch(&output, '$');
             func = next + 1;
         }
     }
@@ -252,12 +254,7 @@ char* bake_attr_replace(
         ut_strbuf_appendstr(&output, func);
     }
 
-    if (replaced) {
-        char *str = ut_strbuf_get(&output);
-        return str;
-    } else {
-        return ut_strdup(input);
-    }
+    return ut_strbuf_get(&output);
 error:
     return NULL;
 }
@@ -274,9 +271,10 @@ bake_attr* bake_attr_parse_array(
     uint32_t i, count = json_array_get_count(a);
     bake_attr *result = existing;
     if (!result) {
-        result = ut_calloc(sizeof(bake_attr));
+        result = ut_arena_calloc(project->arena, sizeof(bake_attr));
         result->kind = BAKE_ARRAY;
-        result->is.array = ut_ll_new();
+        result->is.array = ut_arena_own(
+            project->arena, ut_ll_new(), (ut_arena_free_cb)ut_ll_free);
     }
 
     for (i = 0; i < count; i ++) {
@@ -292,7 +290,6 @@ bake_attr* bake_attr_parse_array(
 
     return result;
 error:
-    /* TODO: cleanup memory */
     return NULL;
 }
 
@@ -304,16 +301,16 @@ bake_attr* bake_attr_parse_string(
     const char *package_id,
     const char *str)
 {
-    bake_attr *result = ut_calloc(sizeof(bake_attr));
+    bake_attr *result = ut_arena_calloc(project->arena, sizeof(bake_attr));
     result->kind = BAKE_STRING;
 
     if (str) {
-        result->is.string = bake_attr_replace(
-            config, project, package_id, str);
-        if (!result->is.string) {
-            free(result);
+        char *value = bake_attr_replace(config, project, package_id, str);
+        if (!value) {
             return NULL;
         }
+        result->is.string = ut_arena_strdup(project->arena, value);
+        free(value);
     } else {
         result->is.string = NULL;
     }
@@ -324,9 +321,10 @@ bake_attr* bake_attr_parse_string(
 /* Return NUMBER attribute */
 static
 bake_attr* bake_attr_parse_number(
+    bake_project *project,
     double v)
 {
-    bake_attr *result = ut_calloc(sizeof(bake_attr));
+    bake_attr *result = ut_arena_calloc(project->arena, sizeof(bake_attr));
     result->kind = BAKE_NUMBER;
 
     result->is.number = v;
@@ -337,9 +335,10 @@ bake_attr* bake_attr_parse_number(
 /* Return BOOLEAN attribute */
 static
 bake_attr* bake_attr_parse_bool(
+    bake_project *project,
     bool v)
 {
-    bake_attr *result = ut_calloc(sizeof(bake_attr));
+    bake_attr *result = ut_arena_calloc(project->arena, sizeof(bake_attr));
     result->kind = BAKE_BOOLEAN;
 
     result->is.boolean = v;
@@ -370,14 +369,14 @@ bake_attr* bake_attr_parse_value(
             config, project, package_id, json_value_get_string(v));
         break;
     case JSONNumber:
-        attr = bake_attr_parse_number(json_value_get_number(v));
+        attr = bake_attr_parse_number(project, json_value_get_number(v));
         break;
     case JSONBoolean:
-        attr = bake_attr_parse_bool(json_value_get_boolean(v));
+        attr = bake_attr_parse_bool(project, json_value_get_boolean(v));
         break;
     case JSONObject:
         /* Ignore objects- placeholder */
-        attr = ut_calloc(sizeof(bake_attr));
+        attr = ut_arena_calloc(project->arena, sizeof(bake_attr));
         attr->kind = BAKE_BOOLEAN;
         break;
     default:
@@ -403,7 +402,8 @@ ut_ll bake_attr_parse_object(
     }
 
     uint32_t i, count = json_object_get_count(jo);
-    ut_ll result = existing ? existing : ut_ll_new();
+    ut_ll result = existing ? existing : ut_arena_own(
+        project->arena, ut_ll_new(), (ut_arena_free_cb)ut_ll_free);
 
     for (i = 0; i < count; i ++) {
         bake_attr *attr = NULL;
@@ -413,12 +413,14 @@ ut_ll bake_attr_parse_object(
 
         if (name[0] == '$') {
             /* If name contains function, parse it */
-            name = bake_attr_replace(
+            char *replaced = bake_attr_replace(
                 config, project, NULL, json_name);
-            if (!name) {
+            if (!replaced) {
                 printf("function error\n");
                 goto error;
             }
+            name = ut_arena_strdup(project->arena, replaced);
+            free(replaced);
         }
 
         if (!strcmp(name, "1") || !stricmp(name, "true")) {
@@ -448,7 +450,7 @@ ut_ll bake_attr_parse_object(
             /* Add member to list of project attributes */
             attr = bake_attr_parse_value(config, project, project_id, attr, v);
             if (new_attr) {
-                attr->name = ut_strdup(name);
+                attr->name = ut_arena_strdup(project->arena, name);
                 ut_ll_append(result, attr);
             } else if (!attr) {
                 ut_throw("failed to parse member '%s'", name);
@@ -492,36 +494,3 @@ bake_attr *bake_attr_get(
 
     return NULL;
 }
-
-void bake_attr_free_string_array(
-    ut_ll list)
-{
-    ut_iter it = ut_ll_iter(list);
-    while (ut_iter_hasNext(&it)) {
-        free( ut_iter_next(&it));
-    }
-    ut_ll_free(list);
-}
-
-void bake_attr_free_attr_array(
-    ut_ll list)
-{
-    ut_iter it = ut_ll_iter(list);
-    while (ut_iter_hasNext(&it)) {
-        bake_attr *attr = ut_iter_next(&it);
-        bake_attr_free(attr);
-    }
-    ut_ll_free(list);
-}
-
-void bake_attr_free(
-    bake_attr *attr)
-{
-    if (attr->kind == BAKE_STRING) {
-        free(attr->is.string);
-    } else if (attr->kind == BAKE_ARRAY) {
-        bake_attr_free_string_array(attr->is.array);
-    }
-    free(attr->name);
-    free(attr);
-}
@@ -44,6 +44,11 @@ int16_t bake_config_export(
     bake_config *cfg,
     const char *expr);
 
+/** Parse a memory size in KB, with an optional K, M or G suffix (default M) */
+int16_t bake_config_parse_size(
+    const char *str,
+    uint64_t *size_out);
+
 /** Remove variable from bake configuration */
 int16_t bake_config_unset(
     bake_config *cfg,
@@ -163,6 +168,9 @@ struct bake_driver {
     bake_driver_impl impl;        /* See above */
 };
 
+/* Initialize driver administration */
+int16_t bake_driver_init(void);
+
 /* Find or load driver */
 bake_driver* bake_driver_get(
     const char *id);
@@ -198,6 +206,12 @@ int16_t bake_driver__generate(
     bake_config *config,
     bake_project *project);
 
+/* Initialize driver before building project */
+int16_t bake_driver__init(
+    bake_driver *driver,
+    bake_config *config,
+    bake_project *project);
+
 /* -- Filelist -- */
 
 /** File matched by a pattern, created from map or added explicitly to filelist */
@@ -280,6 +294,7 @@ typedef struct bake_rule {
     const char *source;     /* Source pattern */
     bake_rule_target target;      /* Rule target (MAP or PATTERN) */
     bake_rule_action_cb action;   /* Action to execute for rule */
+    bake_rule_batch_cb batch;     /* Action to execute for a batch of inputs */
 } bake_rule;
 
 /** Dependency rule
@@ -356,14 +371,16 @@ int16_t bake_json_set_boolean(
     const char *member,
     JSON_Value *v);
 
-/** Set string value from JSON value */
+/** Set string value from JSON value, allocated from arena */
 int16_t bake_json_set_string(
+    ut_arena *arena,
     char **ptr,
     const char *member,
     JSON_Value *v);
 
-/** Set array value from JSON value */
+/** Set array value from JSON value, allocated from arena */
 int16_t bake_json_set_array(
+    ut_arena *arena,
     ut_ll *ptr,
     const char *member,
     JSON_Value *v);
@@ -373,6 +390,104 @@ JSON_Object* bake_json_find_or_create_object(
     JSON_Object *value,
     const char *member);
 
+/* -- Build history -- */
+
+/** Load durations of previous builds from $BAKE_HOME/.history */
+int16_t bake_history_load(
+    bake_config *config);
+
+/** Write durations to $BAKE_HOME/.history & free loaded history */
+int16_t bake_history_save(
+    bake_config *config);
+
+/** Get estimated duration of project in seconds, -1 if unknown */
+double bake_history_get_project(
+    const char *id);
+
+/** Add measured duration of project */
+void bake_history_set_project(
+    const char *id,
+    double duration);
+
+/** Get estimated duration (seconds) & peak memory (KB) of unit of project.
+ * Returns -1 if unit has no history. */
+int16_t bake_history_get_unit(
+    const char *id,
+    const char *unit,
+    double *duration,
+    long *memory);
+
+/** Get the largest peak memory (KB) of the units of a project */
+long bake_history_get_peak_memory(
+    const char *id);
+
+/** Add measured duration & peak memory of unit (object, link) of project */
+void bake_history_set_unit(
+    const char *id,
+    const char *unit,
+    double duration,
+    long memory);
+
+/* -- Job admission -- */
+
+/** Job that is admitted by memory budget */
+typedef struct bake_job {
+    long memory;            /* Estimated peak memory usage (KB) */
+    char token;             /* Jobserver token held by job (0 if none) */
+} bake_job;
+
+/** Set up job slots, memory budget and jobserver from configuration. If the
+ * number of jobs is not set, it is set to the default. */
+int16_t bake_jobs_init(
+    bake_config *config);
+
+/** Take the first job from the list that fits in a free slot and the memory
+ * budget, blocks until a job fits. Returns NULL if the list is empty. */
+bake_job* bake_jobs_take(
+    ut_ll jobs);
+
+/** Wait until job fits in a free slot and the memory budget. Returns -1 if
+ * the build was cancelled while waiting. */
+int16_t bake_jobs_acquire(
+    bake_job *job);
+
+/** Release the slot and memory of a job */
+void bake_jobs_release(
+    bake_job *job);
+
+/** Cancel the build: don't start new jobs and kill processes of running jobs */
+void bake_jobs_cancel(void);
+
+/** Cancel the build from a signal handler, forwards sig to running processes */
+void bake_jobs_interrupt(
+    int sig);
+
+/** Was the build cancelled or interrupted */
+bool bake_jobs_cancelled(void);
+
+/* -- Build report -- */
+
+/** Start collecting resource usage of processes spawned during the build */
+void bake_report_begin(
+    uint32_t slots);
+
+/** Add resource usage of a process spawned for a unit of a project */
+void bake_report_add_proc(
+    bake_project *project,
+    const char *unit,
+    const char *cmd,
+    ut_proc_usage *usage);
+
+/** Add time spent in the build action of a project */
+void bake_report_add_project(
+    bake_project *project,
+    double wall);
+
+/** Print build report & write it to <path>/.bake_cache/last_build.json */
+int16_t bake_report_end(
+    const char *path,
+    const char *action);
+
 /* -- Setup -- */
 
 /* Install bake */
@@ -126,6 +126,120 @@ error:
 #define CFG_OPTIMIZATIONS "optimizations"
 #define CFG_COVERAGE "coverage"
 #define CFG_STRICT "strict"
+#define CFG_SPLIT_DEBUG "split_debug"
+#define CFG_LTO "lto"
+#define CFG_LTO_JOBS "lto_jobs"
+#define CFG_PGO "pgo"
+#define CFG_JOBS "jobs"
+#define CFG_LOAD_AVERAGE "load_average"
+#define CFG_MEM_BUDGET "mem_budget"
+#define CFG_LINKER "linker"
+#define CFG_ARCH "arch"
+#define CFG_TUNE "tune"
+#define CFG_TARGET_CLONES "target_clones"
+
+int16_t bake_config_parse_size(
+    const char *str,
+    uint64_t *size_out)
+{
+    char *end = NULL;
+    double size = str ? strtod(str, &end) : 0;
+
+    if (!str || end == str || size < 0) {
+        ut_throw("invalid size '%s'", str);
+        goto error;
+    }
+
+    switch (toupper(*end)) {
+    case '\0': size *= 1024; break;
+    case 'K': end ++; break;
+    case 'M': end ++; size *= 1024; break;
+    case 'G': end ++; size *= 1024 * 1024; break;
+    default:
+        goto invalid;
+    }
+
+    /* Allow a B after the suffix, like 16GB */
+    if (toupper(*end) == 'B') {
+        end ++;
+    }
+    if (*end) {
+        goto invalid;
+    }
+
+    *size_out = size;
+
+    return 0;
+invalid:
+    ut_throw("invalid size '%s' (expected K, M or G suffix)", str);
+error:
+    return -1;
+}
+
+static
+int16_t bake_config_set_number(
+    double *ptr,
+    const char *member,
+    JSON_Value *v)
+{
+    if (json_value_get_type(v) != JSONNumber || json_value_get_number(v) < 0) {
+        ut_throw("expected positive number for member '%s'", member);
+        return -1;
+    }
+
+    *ptr = json_value_get_number(v);
+
+    return 0;
+}
+
+static
+int16_t bake_config_set_string(
+    char **ptr,
+    const char *member,
+    JSON_Value *v)
+{
+    if (json_value_get_type(v) != JSONString) {
+        ut_throw("expected string for member '%s'", member);
+        return -1;
+    }
+
+    free(*ptr);
+    *ptr = ut_strdup(json_value_get_string(v));
+
+    return 0;
+}
+
+/* Store list of strings as comma separated string */
+static
+int16_t bake_config_set_list(
+    char **ptr,
+    const char *member,
+    JSON_Value *v)
+{
+    JSON_Array *a = json_value_get_array(v);
+    ut_strbuf buf = UT_STRBUF_INIT;
+    size_t i, count = a ? json_array_get_count(a) : 0;
+
+    if (!a) {
+        ut_throw("expected array for member '%s'", member);
+        return -1;
+    }
+
+    for (i = 0; i < count; i ++) {
+        const char *elem = json_array_get_string(a, i);
+        if (!elem || strchr(elem, ',')) {
+            ut_throw("invalid element in member '%s'", member);
+            ut_strbuf_reset(&buf);
+            return -1;
+        }
+        ut_strbuf_append(&buf, i ? ",%s" : "%s", elem);
+    }
+
+    free(*ptr);
+    *ptr = ut_strbuf_get(&buf);
+
+    return 0;
+}
 
 static
 int16_t bake_config_loadConfiguration(
@@ -135,22 +249,69 @@ int16_t bake_config_loadConfiguration(
     ut_log_push("load-cfg");
     int i;
     for (i = 0; i < json_object_get_count(cfg); i++) {
+        const char *member = json_object_get_name(cfg, i);
         JSON_Value *value = json_object_get_value_at(cfg, i);
-
-        if (bake_json_set_boolean(&cfg_out->symbols, CFG_SYMBOLS, value)) {
-            goto error;
-        }
-        if (bake_json_set_boolean(&cfg_out->debug, CFG_DEBUG, value)) {
-            goto error;
-        }
-        if (bake_json_set_boolean(&cfg_out->optimizations, CFG_OPTIMIZATIONS, value)) {
-            goto error;
-        }
-        if (bake_json_set_boolean(&cfg_out->coverage, CFG_COVERAGE, value)) {
-            goto error;
-        }
-        if (bake_json_set_boolean(&cfg_out->strict, CFG_STRICT, value)) {
-            goto error;
+        double number;
+
+        if (!strcmp(member, CFG_SYMBOLS)) {
+            ut_try (bake_json_set_boolean(&cfg_out->symbols, member, value), NULL);
+        } else if (!strcmp(member, CFG_DEBUG)) {
+            ut_try (bake_json_set_boolean(&cfg_out->debug, member, value), NULL);
+        } else if (!strcmp(member, CFG_OPTIMIZATIONS)) {
+            ut_try (bake_json_set_boolean(&cfg_out->optimizations, member, value), NULL);
+        } else if (!strcmp(member, CFG_COVERAGE)) {
+            ut_try (bake_json_set_boolean(&cfg_out->coverage, member, value), NULL);
+        } else if (!strcmp(member, CFG_STRICT)) {
+            ut_try (bake_json_set_boolean(&cfg_out->strict, member, value), NULL);
+        } else if (!strcmp(member, CFG_SPLIT_DEBUG)) {
+            ut_try (bake_json_set_boolean(&cfg_out->split_debug, member, value), NULL);
+        } else if (!strcmp(member, CFG_LTO)) {
+            /* Accept a boolean, or "thin" for incremental LTO */
+            if (json_value_get_type(value) == JSONString &&
+                !strcmp(json_value_get_string(value), "thin"))
+            {
+                cfg_out->lto = BAKE_LTO_THIN;
+            } else if (json_value_get_type(value) == JSONBoolean) {
+                cfg_out->lto = json_value_get_boolean(value)
+                    ? BAKE_LTO_ON
+                    : BAKE_LTO_OFF;
+            } else {
+                ut_throw("expected boolean or \"thin\" for member '%s'", member);
+                goto error;
+            }
+        } else if (!strcmp(member, CFG_LTO_JOBS)) {
+            ut_try (bake_config_set_number(&number, member, value), NULL);
+            cfg_out->lto_jobs = number;
+        } else if (!strcmp(member, CFG_PGO)) {
+            bool pgo = false;
+            ut_try (bake_json_set_boolean(&pgo, member, value), NULL);
+            cfg_out->pgo = pgo ? BAKE_PGO_USE : BAKE_PGO_OFF;
+        } else if (!strcmp(member, CFG_JOBS)) {
+            ut_try (bake_config_set_number(&number, member, value), NULL);
+            cfg_out->jobs = number;
+        } else if (!strcmp(member, CFG_LOAD_AVERAGE)) {
+            ut_try (bake_config_set_number(
+                &cfg_out->load_average, member, value), NULL);
+        } else if (!strcmp(member, CFG_MEM_BUDGET)) {
+            /* Accept both a number (in MB) and a string with a unit */
+            if (json_value_get_type(value) == JSONString) {
+                ut_try (bake_config_parse_size(
+                    json_value_get_string(value), &cfg_out->mem_budget), NULL);
+            } else {
+                ut_try (bake_config_set_number(&number, member, value), NULL);
+                cfg_out->mem_budget = number * 1024;
+            }
+        } else if (!strcmp(member, CFG_LINKER)) {
+            ut_try (bake_config_set_string(&cfg_out->linker, member, value), NULL);
+        } else if (!strcmp(member, CFG_ARCH)) {
+            ut_try (bake_config_set_string(&cfg_out->arch, member, value), NULL);
+        } else if (!strcmp(member, CFG_TUNE)) {
+            ut_try (bake_config_set_string(&cfg_out->tune, member, value), NULL);
+        } else if (!strcmp(member, CFG_TARGET_CLONES)) {
+            ut_try (bake_config_set_list(
+                &cfg_out->target_clones, member, value), NULL);
+        } else {
+            ut_warning("unknown configuration parameter '%s'", member);
         }
     }
     ut_log_pop();
@@ -409,7 +570,9 @@ int16_t bake_config_load(
         .debug = true,
         .optimizations = false,
         .coverage = false,
-        .strict = false
+        .strict = false,
+        .split_debug = false,
+        .lto = BAKE_LTO_DEFAULT
     };
 
     cfg_out->env_variables = ut_ll_new();
@@ -431,6 +594,11 @@ int16_t bake_config_load(
         ut_ok("no bake configuration files found, use defaults");
     }
 
+    /* Link time optimization is part of optimizing unless disabled */
+    if (cfg_out->lto == BAKE_LTO_DEFAULT) {
+        cfg_out->lto = cfg_out->optimizations ? BAKE_LTO_ON : BAKE_LTO_OFF;
+    }
+
     /* Set BAKE_HOME to a default value if the config didn't specify it */
     if (!ut_getenv("BAKE_HOME")) {
         char *bake_home = ut_envparse("~/bake");
@@ -513,6 +681,25 @@ int16_t bake_config_load(
         ut_trace("set '%s' to '%s'", CFG_OPTIMIZATIONS, cfg_out->optimizations ? "true" : "false");
         ut_trace("set '%s' to '%s'", CFG_COVERAGE, cfg_out->coverage ? "true" : "false");
         ut_trace("set '%s' to '%s'", CFG_STRICT, cfg_out->strict ? "true" : "false");
+        ut_trace("set '%s' to '%s'", CFG_SPLIT_DEBUG, cfg_out->split_debug ? "true" : "false");
+        ut_trace("set '%s' to '%s'", CFG_LTO,
+            cfg_out->lto == BAKE_LTO_THIN ? "thin" :
+            cfg_out->lto == BAKE_LTO_ON ? "true" : "false");
+        ut_trace("set '%s' to '%u'", CFG_LTO_JOBS, cfg_out->lto_jobs);
+        ut_trace("set '%s' to '%s'", CFG_PGO,
+            cfg_out->pgo == BAKE_PGO_USE ? "true" : "false");
+        ut_trace("set '%s' to '%u'", CFG_JOBS, cfg_out->jobs);
+        ut_trace("set '%s' to '%.2f'", CFG_LOAD_AVERAGE, cfg_out->load_average);
+        ut_trace("set '%s' to '%lluKB'", CFG_MEM_BUDGET,
+            (unsigned long long)cfg_out->mem_budget);
+        ut_trace("set '%s' to '%s'", CFG_LINKER,
+            cfg_out->linker ? cfg_out->linker : "auto");
+        ut_trace("set '%s' to '%s'", CFG_ARCH,
+            cfg_out->arch ? cfg_out->arch : "default");
+        ut_trace("set '%s' to '%s'", CFG_TUNE,
+            cfg_out->tune ? cfg_out->tune : "default");
+        ut_trace("set '%s' to '%s'", CFG_TARGET_CLONES,
+            cfg_out->target_clones ? cfg_out->target_clones : "none");
         ut_log_pop();
     }
 
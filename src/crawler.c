@@ -21,6 +21,9 @@
 
 #include "bake.h"
 
+/* Estimated duration (in seconds) of projects without build history */
+#define BAKE_CRAWLER_DEFAULT_DURATION (1.0)
+
 struct bake_crawler {
     ut_rb nodes; /* tree optimizes looking up dependencies */
     ut_ll leafs; /* projects that cannot act as dependencies */
@@ -47,7 +50,7 @@ void bake_crawler_addDependency(
     if (!dep) {
         /* Create placeholder */
         dep = bake_project_new(NULL, NULL);
-        dep->id = ut_strdup(use);
+        dep->id = ut_arena_strdup(dep->arena, use);
         ut_rb_set(_this->nodes, dep->id, dep);
     }
 
@@ -94,8 +97,10 @@ int16_t bake_crawler_add(
                 /* This is a placeholder. Replace it with the actual project. */
                 p->dependents = found->dependents;
                 found->dependents = NULL;
-                bake_project_free(found);
+
+                /* Replace before freeing, as tree still refers to its id */
                 ut_rb_set(_this->nodes, p->id, p);
+                bake_project_free(found);
             }
         }
     } else {
@@ -138,13 +143,109 @@ error:
     return -1;
 }
 
+static
+int16_t bake_crawler_load(
+    bake_crawler *_this,
+    const char *path)
+{
+    bake_project *p = bake_project_new(path, _this->cfg);
+    if (!p) {
+        goto error;
+    }
+
+    if (bake_crawler_add(_this, p)) {
+        ut_warning("ignoring '%s' because of errors", path);
+    }
+
+    return 0;
+error:
+    return -1;
+}
+
+/* Returns true if directory in project has special meaning */
+static
+bool bake_crawler_ignore(
+    const char *file)
+{
+    return file[0] == '.' ||
+        !strcmp(file, "src") ||
+        !strcmp(file, "include") ||
+        !strcmp(file, "config") ||
+        !strcmp(file, "data") ||
+        !strcmp(file, "test") ||
+        !strcmp(file, "etc") ||
+        !strcmp(file, "lib") ||
+        !strcmp(file, "bin") ||
+        !strcmp(file, "install") ||
+        !strcmp(file, "examples") ||
+        !strcmp(file, ".bake_cache");
+}
+
+typedef struct bake_crawler_walk_t {
+    bake_crawler *crawler;
+    bool *is_project; /* For each depth, whether directory is a project */
+    int size;
+} bake_crawler_walk_t;
+
+static
+int bake_crawler_walk_cb(
+    ut_dir_entry *entry,
+    void *ctx)
+{
+    bake_crawler_walk_t *data = ctx;
+    int depth = entry->depth;
+
+    if (!entry->is_dir) {
+        return 0;
+    }
+
+    /* If this is a bake project, filter out directories that have special
+     * meaning. */
+    if (data->is_project[depth] && bake_crawler_ignore(entry->name)) {
+        ut_debug("ignoring directory '%s'", entry->name);
+        return UT_DIR_WALK_SKIP;
+    }
+
+    ut_debug("looking for projects in '%s'", entry->name);
+
+    if (depth + 2 > data->size) {
+        data->size = (depth + 2) * 2;
+        data->is_project = realloc(
+            data->is_project, data->size * sizeof(bool));
+    }
+
+    data->is_project[depth + 1] = false;
+
+    if (ut_dir_entry_test(entry, "project.json")) {
+        /* Only create a clean path for directories that contain a project */
+        char *path = ut_strdup(entry->path);
+        ut_path_clean(path, path);
+
+        data->is_project[depth + 1] = true;
+        if (ut_dir_entry_test(entry, "rakefile")) {
+            ut_warning("path '%s' contains redundant rakefile", path);
+        }
+
+        int16_t ret = bake_crawler_load(data->crawler, path);
+        free(path);
+        if (ret) {
+            return -1;
+        }
+    } else if (ut_dir_entry_test(entry, "rakefile")) {
+        ut_warning(
+            "path '%s' contains rake-based project, skipping", entry->path);
+        return UT_DIR_WALK_SKIP;
+    }
+
+    return 0;
+}
+
 static
 int16_t bake_crawler_crawl(
     bake_crawler *_this,
     const char *wd,
     const char *path)
 {
-    char *prev = strdup(ut_cwd());
     char *fullpath;
     if (path[0] != '/') {
         fullpath = ut_asprintf("%s/%s", wd, path);
@@ -153,28 +254,35 @@ int16_t bake_crawler_crawl(
         fullpath = ut_strdup(path);
     }
 
-    bool isProject = false;
-    bake_project *p = NULL;
+    bake_crawler_walk_t data = {
+        .crawler = _this,
+        .is_project = malloc(8 * sizeof(bool)),
+        .size = 8
+    };
 
-    if (ut_file_test(strarg("%s/project.json", fullpath))) {
-        isProject = true;
+    data.is_project[0] = false;
 
-        bake_project *p = bake_project_new(fullpath, _this->cfg);
-        if (!p) {
-            goto error;
+    ut_scratch_mark mark = ut_scratch_push();
+    char *project_json = ut_scratch_asprintf("%s/project.json", fullpath);
+    char *rakefile = ut_scratch_asprintf("%s/rakefile", fullpath);
+
+    if (ut_file_test(project_json)) {
+        data.is_project[0] = true;
+        if (ut_file_test(rakefile)) {
+            ut_warning("path '%s' contains redundant rakefile", fullpath);
         }
 
-        if (bake_crawler_add(_this, p)) {
-            ut_warning("ignoring '%s' because of errors", fullpath);
-        } else {
-            if (ut_file_test("rakefile")) {
-                ut_warning(
-                    "path '%s' contains redundant rakefile",
-                    fullpath);
-            }
+        ut_scratch_pop(mark);
+
+        if (bake_crawler_load(_this, fullpath)) {
+            goto error;
         }
     } else {
-        if (ut_file_test("rakefile")) {
+        bool is_rake = ut_file_test(rakefile);
+
+        ut_scratch_pop(mark);
+
+        if (is_rake) {
             ut_warning(
                 "path '%s' contains rake-based project, skipping",
                 fullpath);
@@ -182,55 +290,19 @@ int16_t bake_crawler_crawl(
         }
     }
 
-    ut_iter it;
-    if (ut_dir_iter(fullpath, NULL, &it)) {
-        ut_throw("failed to open directory '%s'", fullpath);
+    /* Walk directories relative to their parent, without a stat per entry */
+    if (ut_dir_walk(fullpath, 0, bake_crawler_walk_cb, &data)) {
+        ut_throw("failed to crawl directory '%s'", fullpath);
         goto error;
     }
 
-    while (ut_iter_hasNext(&it)) {
-        char *file = ut_iter_next(&it);
-
-        if (ut_isdir(strarg("%s/%s", fullpath, file))) {
-
-            /* If this is a corto project, filter out directories that have
-             * special meaning. */
-            if (isProject) {
-                if (file[0] == '.' ||
-                    !strcmp(file, "src") ||
-                    !strcmp(file, "include") ||
-                    !strcmp(file, "config") ||
-                    !strcmp(file, "data") ||
-                    !strcmp(file, "test") ||
-                    !strcmp(file, "etc") ||
-                    !strcmp(file, "lib") ||
-                    !strcmp(file, "bin") ||
-                    !strcmp(file, "install") ||
-                    !strcmp(file, "examples") ||
-                    !strcmp(file, ".bake_cache"))
-                {
-                    ut_debug("ignoring directory '%s'", file);
-                    continue;
-                }
-
-                ut_debug("looking for projects in '%s'", file);
-
-                /* TODO: ignore generated directories */
-            } else {
-                ut_debug("looking for projects in '%s'", file);
-            }
-
-            if (bake_crawler_crawl(_this, fullpath, file)) {
-                ut_iter_release(&it);
-                goto error;
-            }
-        }
-    }
-
 skip:
+    free(data.is_project);
+    free(fullpath);
     return 0;
 error:
-    if (prev) free(prev);
+    free(data.is_project);
+    free(fullpath);
     return -1;
 }
 
@@ -328,14 +400,29 @@ int16_t bake_crawler_build_project(
     bake_config *config,
     const char *action_name,
     bake_crawler_cb action,
-    bake_project *p,
-    ut_ll readyForBuild)
+    bake_project *p)
 {
     ut_ok(
         "#[grey]begin %s %s of '%s' in '%s'",
         action_name, bake_project_kind_str(p->type), p->id, p->path);
 
-    if (action(config, _this, p)) {
+    /* Collect output of the project, so it is not interleaved with output
+     * of other projects */
+    ut_log_job_begin();
+    ut_log_trace_begin("project", p->id, p->path);
+
+    struct timespec start, stop;
+    timespec_gettime(&start);
+
+    int16_t result = action(config, _this, p);
+
+    timespec_gettime(&stop);
+    bake_report_add_project(p, timespec_toDouble(timespec_sub(stop, start)));
+
+    if (result) {
+        ut_log_trace_end();
+        ut_log_job_end();
+        ut_log_status(NULL);
         ut_throw("bake interrupted by '%s' in '%s'", p->id, p->path);
         goto error;
     }
@@ -350,14 +437,54 @@ int16_t bake_crawler_build_project(
             p->id);
     }
 
-    /* Decrease unresolved_dependencies of dependents */
-    bake_crawler_decrease_dependents(p, readyForBuild);
+    ut_log_trace_end();
+    ut_log_job_end();
+    ut_log_status(NULL);
 
     return 0;
 error:
     return -1;
 }
 
+/* Compute the longest path from a project to the end of the build, using the
+ * durations of previous builds. Projects on the critical path are started
+ * first, so that independent projects fill up the remaining workers. */
+static
+double bake_crawler_priority(
+    bake_project *p)
+{
+    if (p->priority_set) {
+        return p->priority;
+    }
+
+    /* Mark project before visiting dependents, so cycles don't recurse */
+    p->priority_set = true;
+    p->priority = 0;
+
+    double duration = 0;
+    if (p->path) {
+        duration = bake_history_get_project(p->id);
+        if (duration < 0) {
+            duration = BAKE_CRAWLER_DEFAULT_DURATION;
+        }
+    }
+
+    double max = 0;
+    if (p->dependents) {
+        ut_iter it = ut_ll_iter(p->dependents);
+        while (ut_iter_hasNext(&it)) {
+            double d = bake_crawler_priority(ut_iter_next(&it));
+            if (d > max) {
+                max = d;
+            }
+        }
+    }
+
+    p->priority = duration + max;
+
+    return p->priority;
+}
+
 static
 void bake_crawler_collect_projects(
     bake_crawler *_this,
@@ -366,20 +493,182 @@ void bake_crawler_collect_projects(
 {
     while (ut_iter_hasNext(it)) {
         bake_project *p = ut_iter_next(it);
+        bake_crawler_priority(p);
         if (p->path && !p->unresolved_dependencies) {
             ut_ll_append(readyForBuild, p);
         }
     }
 }
 
+/* State shared between the workers of a walk */
+typedef struct bake_crawler_pool {
+    bake_crawler *crawler;
+    bake_config *config;
+    const char *action_name;
+    bake_crawler_cb action;
+
+    ut_mutex_s lock;
+    ut_cond_s cond;         /* Signalled when a project finished building */
+    ut_ll readyForBuild;    /* Projects with all dependencies built */
+    ut_ll building;         /* Projects being built */
+    uint32_t built;         /* Number of projects built */
+    bool error;             /* Set when a project failed, stops the walk */
+    ut_ll failed;           /* Projects that failed (keep-going) */
+    ut_ll skipped;          /* Projects that depend on a failed project */
+} bake_crawler_pool;
+
+/* Skip transitive dependents of a failed project. These never become ready
+ * since the failed dependency is never resolved. */
+static
+void bake_crawler_skip_dependents(
+    bake_crawler_pool *pool,
+    bake_project *p)
+{
+    if (p->dependents) {
+        ut_iter it = ut_ll_iter(p->dependents);
+        while (ut_iter_hasNext(&it)) {
+            bake_project *dependent = ut_iter_next(&it);
+            if (!dependent->skipped) {
+                dependent->skipped = true;
+                ut_ll_append(pool->skipped, dependent);
+                bake_crawler_skip_dependents(pool, dependent);
+            }
+        }
+    }
+}
+
+/* Projects with the same id install to the same location, and cannot be built
+ * at the same time */
+static
+bool bake_crawler_is_building(
+    bake_crawler_pool *pool,
+    bake_project *p)
+{
+    ut_iter it = ut_ll_iter(pool->building);
+    while (ut_iter_hasNext(&it)) {
+        bake_project *e = ut_iter_next(&it);
+        if (!strcmp(e->id, p->id)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Take the ready project with the longest remaining path */
+static
+bake_project* bake_crawler_take_critical(
+    bake_crawler_pool *pool)
+{
+    bake_project *result = NULL;
+    ut_iter it = ut_ll_iter(pool->readyForBuild);
+    while (ut_iter_hasNext(&it)) {
+        bake_project *p = ut_iter_next(&it);
+        if (!result || p->priority > result->priority) {
+            if (!bake_crawler_is_building(pool, p)) {
+                result = p;
+            }
+        }
+    }
+
+    if (result) {
+        ut_ll_remove(pool->readyForBuild, result);
+    }
+
+    return result;
+}
+
+/* Build projects until all are built or a project failed. Returns -1 if a
+ * project built by this worker failed. */
+static
+int16_t bake_crawler_work(
+    bake_crawler_pool *pool)
+{
+    int16_t own_result = 0;
+
+    ut_mutex_lock(&pool->lock);
+
+    while (true) {
+        /* Wait until a project is ready or all projects are finished */
+        bake_project *p = NULL;
+        while (!pool->error && !bake_jobs_cancelled() &&
+            !(p = bake_crawler_take_critical(pool)) &&
+            ut_ll_count(pool->building))
+        {
+            ut_cond_wait(&pool->cond, &pool->lock);
+        }
+
+        if (!p) {
+            break;
+        }
+
+        ut_ll_append(pool->building, p);
+        ut_mutex_unlock(&pool->lock);
+
+        int16_t result = bake_crawler_build_project(
+            pool->crawler, pool->config, pool->action_name, pool->action, p);
+
+        /* If the build was cancelled while this project was building, it failed
+         * because its jobs were killed */
+        bool cancelled = result && bake_jobs_cancelled();
+        if (cancelled) {
+            ut_catch();
+        } else if (result && pool->config->keep_going) {
+            /* Report the error now, the walk continues */
+            ut_raise();
+        }
+
+        ut_mutex_lock(&pool->lock);
+        ut_ll_remove(pool->building, p);
+        if (cancelled) {
+            pool->error = true;
+        } else if (result && pool->config->keep_going) {
+            ut_ll_append(pool->failed, p);
+            bake_crawler_skip_dependents(pool, p);
+        } else if (result) {
+            /* Stop jobs of other projects, the build failed anyway */
+            pool->error = true;
+            own_result = -1;
+            bake_jobs_cancel();
+        } else {
+            bake_crawler_decrease_dependents(p, pool->readyForBuild);
+            pool->built ++;
+        }
+
+        ut_cond_broadcast(&pool->cond);
+    }
+
+    ut_mutex_unlock(&pool->lock);
+
+    return own_result;
+}
+
+static
+void* bake_crawler_worker(
+    void *arg)
+{
+    /* Errors of workers are reported when the thread exits */
+    bake_crawler_work(arg);
+    return NULL;
+}
+
 int16_t bake_crawler_walk(
     bake_config *config,
     bake_crawler *_this,
     const char *action_name,
     bake_crawler_cb action)
 {
-    ut_ll readyForBuild = ut_ll_new();
-    uint32_t built = 0;
+    bake_crawler_pool pool = {
+        .crawler = _this,
+        .config = config,
+        .action_name = action_name,
+        .action = action,
+        .readyForBuild = ut_ll_new(),
+        .building = ut_ll_new(),
+        .failed = ut_ll_new(),
+        .skipped = ut_ll_new()
+    };
+    uint32_t i, jobs = config->jobs ? config->jobs : 1;
+    ut_thread *workers = NULL;
 
     /* Decrease unresolved dependencies for placeholder projects */
     if (_this->nodes) {
@@ -395,34 +684,93 @@ int16_t bake_crawler_walk(
     /* Collect initial projects */
     if (_this->nodes) {
         ut_iter it = ut_rb_iter(_this->nodes);
-        bake_crawler_collect_projects(_this, &it, readyForBuild);
+        bake_crawler_collect_projects(_this, &it, pool.readyForBuild);
     }
 
     if (_this->leafs) {
         ut_iter it = ut_ll_iter(_this->leafs);
-        bake_crawler_collect_projects(_this, &it, readyForBuild);
+        bake_crawler_collect_projects(_this, &it, pool.readyForBuild);
+    }
+
+    ut_try (ut_mutex_new(&pool.lock), NULL);
+    ut_try (ut_cond_new(&pool.cond), NULL);
+
+    /* Walk projects (when dependencies are resolved the list will populate).
+     * The calling thread is one of the workers, so with a single job no
+     * threads are created. */
+    if (jobs > 1 && jobs > _this->count) {
+        jobs = _this->count ? _this->count : 1;
     }
 
-    /* Walk projects (when dependencies are resolved the list will populate) */
-    bake_project *p;
-    while ((p = ut_ll_takeFirst(readyForBuild))) {
-        ut_try (
-            bake_crawler_build_project(
-                _this, config, action_name, action, p, readyForBuild), NULL);
-        built ++;
+    if (jobs > 1) {
+        workers = malloc((jobs - 1) * sizeof(ut_thread));
+        for (i = 0; i < jobs - 1; i ++) {
+            workers[i] = ut_thread_new(bake_crawler_worker, &pool);
+        }
+    }
+
+    int16_t own_result = bake_crawler_work(&pool);
+
+    if (workers) {
+        for (i = 0; i < jobs - 1; i ++) {
+            ut_thread_join(workers[i], NULL);
+        }
+        free(workers);
+    }
+
+    ut_cond_free(&pool.cond);
+    ut_mutex_free(&pool.lock);
+
+    if (pool.error || bake_jobs_cancelled()) {
+        /* Only throw if the project that failed was built by another thread,
+         * otherwise this thread already has the exception */
+        if (!own_result) {
+            ut_throw("build interrupted");
+        }
+        goto error;
+    }
+
+    if (ut_ll_count(pool.failed)) {
+        ut_iter it = ut_ll_iter(pool.failed);
+        ut_log("#[red]failed#[normal] %d project(s):\n", ut_ll_count(pool.failed));
+        while (ut_iter_hasNext(&it)) {
+            bake_project *p = ut_iter_next(&it);
+            ut_log("  '%s' in '%s'\n", p->id, p->path);
+        }
+
+        if (ut_ll_count(pool.skipped)) {
+            it = ut_ll_iter(pool.skipped);
+            ut_log("#[yellow]skipped#[normal] %d project(s) that depend on failed projects:\n",
+                ut_ll_count(pool.skipped));
+            while (ut_iter_hasNext(&it)) {
+                bake_project *p = ut_iter_next(&it);
+                ut_log("  '%s' in '%s'\n", p->id, p->path);
+            }
+        }
+
+        ut_throw("%d project(s) failed, %d skipped",
+            ut_ll_count(pool.failed), ut_ll_count(pool.skipped));
+        goto error;
     }
 
     /* If there are still unbuilt projects there must be a cycle in the graph */
-    if (built != _this->count) {
+    if (pool.built != _this->count) {
         ut_throw(
             "project dependency graph contains cycles (%d built vs %d total)",
-            built, _this->count);
+            pool.built, _this->count);
         goto error;
     }
 
-    ut_ll_free(readyForBuild);
+    ut_ll_free(pool.readyForBuild);
+    ut_ll_free(pool.building);
+    ut_ll_free(pool.failed);
+    ut_ll_free(pool.skipped);
 
     return 0;
 error:
+    ut_ll_free(pool.readyForBuild);
+    ut_ll_free(pool.building);
+    ut_ll_free(pool.failed);
+    ut_ll_free(pool.skipped);
     return -1;
 }
@@ -24,9 +24,11 @@
 typedef int (*buildmain_cb)(bake_driver_api *driver);
 
 static ut_ll drivers;
+static ut_mutex_s drivers_lock; /* Projects can load drivers in parallel */
 extern ut_tls BAKE_DRIVER_KEY;
 extern ut_tls BAKE_FILELIST_KEY;
 extern ut_tls BAKE_PROJECT_KEY;
+extern ut_tls BAKE_UNIT_KEY;
 
 static
 bake_driver* bake_driver_get_intern(
@@ -145,12 +147,16 @@ void bake_driver_rule(
     const char *name,
     const char *source,
     bake_rule_target target,
-    bake_rule_action_cb action)
+    bake_rule_action_cb action,
+    bake_rule_batch_cb batch)
 {
     bake_node *n;
     if (!source && target.kind == BAKE_RULE_TARGET_MAP) {
         driver->error = 1;
         ut_error("rule '%s' has mapped target but no source to map from", name);
+    } else if (batch && target.kind != BAKE_RULE_TARGET_MAP) {
+        driver->error = 1;
+        ut_error("batch rule '%s' must have a mapped target", name);
     } else if ((n = bake_node_find(driver, name))) {
         if (n->kind != BAKE_RULE_RULE) {
             driver->error = 1;
@@ -159,9 +165,11 @@ void bake_driver_rule(
             ((bake_rule*)n)->source = source;
             ((bake_rule*)n)->target = target;
             ((bake_rule*)n)->action = action;
+            ((bake_rule*)n)->batch = batch;
         }
     } else {
         bake_node *n = bake_node_add(driver, bake_rule_new(name, source, target, action));
+        ((bake_rule*)n)->batch = batch;
         if (bake_node_addDependencies(driver, n, source)) {
             ut_throw(NULL);
             driver->error = 1;
@@ -207,7 +215,18 @@ void bake_driver_rule_cb(
     bake_rule_action_cb action)
 {
     bake_driver *driver = ut_tls_get(BAKE_DRIVER_KEY);
-    bake_driver_rule(driver, name, source, target, action);
+    bake_driver_rule(driver, name, source, target, action, NULL);
+}
+
+static
+void bake_driver_batch_rule_cb(
+    const char *name,
+    const char *source,
+    bake_rule_target target,
+    bake_rule_batch_cb action)
+{
+    bake_driver *driver = ut_tls_get(BAKE_DRIVER_KEY);
+    bake_driver_rule(driver, name, source, target, NULL, action);
 }
 
 static
@@ -342,10 +361,20 @@ void bake_driver_exec_cb(
         ut_throw("invalid command '%s'", cmd);
         bake_project *p = ut_tls_get(BAKE_PROJECT_KEY);
         p->error = true;
+    } else if (bake_jobs_cancelled()) {
+        ut_throw("build cancelled");
+        bake_project *p = ut_tls_get(BAKE_PROJECT_KEY);
+        p->error = true;
+        free(envcmd);
     } else {
+        ut_proc_usage usage = {0};
         int8_t ret = 0;
-        int sig = 0;
-        if ((sig = ut_proc_cmd(envcmd, &ret)) || ret) {
+        int sig = ut_proc_cmd_usage(envcmd, &ret, &usage);
+
+        bake_report_add_proc(ut_tls_get(BAKE_PROJECT_KEY),
+            ut_tls_get(BAKE_UNIT_KEY), envcmd, &usage);
+
+        if (sig || ret) {
             if (!sig) {
                 ut_throw("command returned %d", ret);
                 ut_throw_detail("%s", envcmd);
@@ -361,12 +390,45 @@ void bake_driver_exec_cb(
     }
 }
 
+static
+bool bake_driver_try_exec_cb(
+    const char *dir,
+    const char *cmd)
+{
+    char *envcmd = ut_envparse("%s", cmd);
+    if (!envcmd) {
+        ut_catch();
+        return false;
+    } else if (bake_jobs_cancelled()) {
+        free(envcmd);
+        return false;
+    }
+
+    ut_proc_usage usage = {0};
+    int8_t ret = 0;
+    int sig = ut_proc_cmd_try(dir, envcmd, &ret, &usage);
+
+    bake_report_add_proc(ut_tls_get(BAKE_PROJECT_KEY),
+        ut_tls_get(BAKE_UNIT_KEY), envcmd, &usage);
+
+    free(envcmd);
+
+    if (sig || ret) {
+        /* The caller is responsible for reporting the failure */
+        ut_catch();
+        return false;
+    }
+
+    return true;
+}
+
 static
 void bake_driver_remove_cb(
     const char *file)
 {
     bake_project *project = ut_tls_get(BAKE_PROJECT_KEY);
-    ut_ll_append(project->files_to_clean, ut_strdup(file));
+    ut_ll_append(
+        project->files_to_clean, ut_arena_strdup(project->arena, file));
 }
 
 static
@@ -397,7 +459,9 @@ bake_driver_api bake_driver_api_impl = {
     .remove = bake_driver_remove_cb,
     .exec = bake_driver_exec_cb,
     .get_attr = bake_driver_get_attr_cb,
-    .get_attr_bool = bake_driver_get_bool_attr_cb
+    .get_attr_bool = bake_driver_get_bool_attr_cb,
+    .batch_rule = bake_driver_batch_rule_cb,
+    .try_exec = bake_driver_try_exec_cb
 };
 
 char* bake_driver__artefact(
@@ -489,6 +553,23 @@ int16_t bake_driver__generate(
     return 0;
 }
 
+int16_t bake_driver__init(
+    bake_driver *driver,
+    bake_config *config,
+    bake_project *project)
+{
+    if (driver->impl.init) {
+        ut_tls_set(BAKE_DRIVER_KEY, driver);
+        ut_tls_set(BAKE_PROJECT_KEY, project);
+        driver->impl.init(&bake_driver_api_impl, config, project);
+        if (project->error) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
 /** Load new driver, or import definitions from other driver */
 static
 bake_driver* bake_driver_get_intern(
@@ -560,8 +641,16 @@ error:
     return NULL;
 }
 
+int16_t bake_driver_init(void)
+{
+    return ut_mutex_new(&drivers_lock);
+}
+
 bake_driver* bake_driver_get(
     const char *id)
 {
-    return bake_driver_get_intern(id, NULL);
+    ut_mutex_lock(&drivers_lock);
+    bake_driver *result = bake_driver_get_intern(id, NULL);
+    ut_mutex_unlock(&drivers_lock);
+    return result;
 }
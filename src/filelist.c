@@ -37,6 +37,9 @@ bake_file* bake_file_copy(
 void bake_filelist_free(
     bake_filelist *fl)
 {
+    if (fl->path) {
+        free(fl->path);
+    }
     if (fl->pattern) {
         free(fl->pattern);
     }
@@ -90,31 +93,56 @@ error:
     return NULL;
 }
 
+typedef struct bake_filelist_walk_t {
+    bake_filelist *fl;
+    const char *path;
+    ut_expr_program program;
+    bool recursive;
+} bake_filelist_walk_t;
+
+static
+int bake_filelist_walk_cb(
+    ut_dir_entry *entry,
+    void *ctx)
+{
+    bake_filelist_walk_t *data = ctx;
+    const char *file = data->recursive ? entry->relative : entry->name;
+
+    if (ut_expr_run(data->program, file)) {
+        time_t lastmodified = ut_dir_entry_lastmodified(entry);
+        if (lastmodified == -1) {
+            return -1;
+        }
+
+        bake_filelist_add_intern(
+            data->fl, data->path, entry->relative, lastmodified);
+    }
+
+    return data->recursive ? 0 : UT_DIR_WALK_SKIP;
+}
+
 static
 int16_t bake_filelist_populate(
     bake_filelist *fl,
     const char *path,
     const char *pattern)
 {
-    ut_iter it;
-    ut_try (ut_dir_iter(path, pattern, &it), NULL);
+    bake_filelist_walk_t data = {
+        .fl = fl,
+        .path = path,
+        .program = ut_expr_compile(pattern, TRUE, TRUE)
+    };
 
-    char *clean_path = ut_strdup(path);
-    ut_path_clean(clean_path, clean_path);
-
-    while (ut_iter_hasNext(&it)) {
-        const char *file = ut_iter_next(&it);
-        const char *relative_file = file + strlen(clean_path);
+    ut_try (!data.program, "invalid pattern '%s'", pattern);
 
-        if (relative_file[0] == '/') {
-            relative_file ++;
-        }
-
-        bake_filelist_add_intern(
-            fl, path, relative_file, ut_lastmodified(file));
-    }
+    data.recursive = ut_expr_scope(data.program) == 2;
 
-    free (clean_path);
+    /* Match paths relative to the directory, so the walk doesn't need to
+     * construct and clean a full path for every file */
+    int16_t ret = ut_dir_walk(
+        path ? path : ".", 0, bake_filelist_walk_cb, &data);
+    ut_expr_free(data.program);
+    ut_try (ret, NULL);
 
     return 0;
 error:
@@ -133,7 +161,7 @@ int16_t bake_filelist_set(
 {
     fl->pattern = strdup(pattern);
 
-    if (bake_filelist_populate(fl, NULL, fl->pattern)) {
+    if (bake_filelist_populate(fl, fl->path, fl->pattern)) {
         free(fl->pattern);
         fl->pattern = NULL;
         return -1;
@@ -255,8 +255,8 @@ int16_t bake_publish(
         goto error;
     }
 
-    free(project->version);
-    project->version = new_version;
+    /* Previous version is owned by project arena */
+    project->version = ut_arena_own(project->arena, new_version, free);
 
     JSON_Value *project_json = json_parse_file("project.json");
     if (!project_json) {
@@ -0,0 +1,266 @@
+/* Copyright (c) 2010-2018 Sander Mertens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* The history file stores how long projects and their units (objects, links)
+ * took to build in previous builds, so the crawler can estimate the critical
+ * path of a build before it starts. The file has the following layout:
+ *
+ * {
+ *     "<project id>": {
+ *         "duration": <seconds>,
+ *         "units": { "<unit>": <seconds>, ... },
+ *         "memory": { "<unit>": <peak RSS in KB>, ... }
+ *     }
+ * }
+ */
+
+#include "bake.h"
+
+/* Weight of a new measurement. Lower values make estimates less sensitive to
+ * a single outlier build (like a cold cache). */
+#define BAKE_HISTORY_WEIGHT (0.5)
+
+static JSON_Value *bake_history;
+static bool bake_history_changed;
+
+static
+char* bake_history_file(
+    bake_config *config)
+{
+    return ut_asprintf("%s/.history", config->home);
+}
+
+int16_t bake_history_load(
+    bake_config *config)
+{
+    char *file = bake_history_file(config);
+
+    if (ut_file_test(file) == 1) {
+        bake_history = json_parse_file(file);
+    }
+
+    /* A missing or corrupt history is not an error, it only means that the
+     * scheduler has no estimates to work with */
+    if (!bake_history || json_value_get_type(bake_history) != JSONObject) {
+        if (bake_history) {
+            ut_warning("ignoring invalid build history '%s'", file);
+            json_value_free(bake_history);
+        }
+        bake_history = json_value_init_object();
+    }
+
+    free(file);
+    return 0;
+}
+
+int16_t bake_history_save(
+    bake_config *config)
+{
+    int16_t result = 0;
+
+    if (!bake_history) {
+        return 0;
+    }
+
+    if (bake_history_changed) {
+        char *file = bake_history_file(config);
+        if (json_serialize_to_file(bake_history, file) != JSONSuccess) {
+            ut_throw("failed to write build history to '%s'", file);
+            result = -1;
+        }
+        free(file);
+    }
+
+    json_value_free(bake_history);
+    bake_history = NULL;
+    bake_history_changed = false;
+
+    return result;
+}
+
+static
+JSON_Object* bake_history_project(
+    const char *id,
+    bool create)
+{
+    if (!bake_history) {
+        return NULL;
+    }
+
+    JSON_Object *root = json_value_get_object(bake_history);
+    JSON_Object *result = json_object_get_object(root, id);
+    if (!result && create) {
+        json_object_set_value(root, id, json_value_init_object());
+        result = json_object_get_object(root, id);
+    }
+
+    return result;
+}
+
+static
+void bake_history_set(
+    JSON_Object *obj,
+    const char *member,
+    double duration)
+{
+    JSON_Value *v = json_object_get_value(obj, member);
+    if (v && json_value_get_type(v) == JSONNumber) {
+        duration = BAKE_HISTORY_WEIGHT * duration +
+            (1 - BAKE_HISTORY_WEIGHT) * json_value_get_number(v);
+    }
+
+    json_object_set_number(obj, member, duration);
+    bake_history_changed = true;
+}
+
+/* Memory estimates are used to keep jobs within the memory budget, so rather
+ * than averaging, don't let an estimate drop below a new peak. */
+static
+void bake_history_set_peak(
+    JSON_Object *obj,
+    const char *member,
+    long memory)
+{
+    double peak = memory;
+    JSON_Value *v = json_object_get_value(obj, member);
+    if (v && json_value_get_type(v) == JSONNumber) {
+        double avg = BAKE_HISTORY_WEIGHT * memory +
+            (1 - BAKE_HISTORY_WEIGHT) * json_value_get_number(v);
+        if (avg > peak) {
+            peak = avg;
+        }
+    }
+
+    json_object_set_number(obj, member, (long)peak);
+    bake_history_changed = true;
+}
+
+double bake_history_get_project(
+    const char *id)
+{
+    JSON_Object *p = bake_history_project(id, false);
+    double result = -1;
+
+    if (!p) {
+        return -1;
+    }
+
+    JSON_Value *v = json_object_get_value(p, "duration");
+    if (v && json_value_get_type(v) == JSONNumber) {
+        result = json_value_get_number(v);
+    }
+
+    /* The last duration may have been measured in an incremental build. The
+     * sum of the units is what a full build of the project costs, so use the
+     * largest of the two. */
+    JSON_Object *units = json_object_get_object(p, "units");
+    if (units) {
+        double sum = 0;
+        size_t i, count = json_object_get_count(units);
+        for (i = 0; i < count; i ++) {
+            sum += json_value_get_number(json_object_get_value_at(units, i));
+        }
+        if (sum > result) {
+            result = sum;
+        }
+    }
+
+    return result;
+}
+
+void bake_history_set_project(
+    const char *id,
+    double duration)
+{
+    JSON_Object *p = bake_history_project(id, true);
+    if (p) {
+        bake_history_set(p, "duration", duration);
+    }
+}
+
+int16_t bake_history_get_unit(
+    const char *id,
+    const char *unit,
+    double *duration,
+    long *memory)
+{
+    JSON_Object *p = bake_history_project(id, false);
+    if (!p) {
+        return -1;
+    }
+
+    JSON_Object *units = json_object_get_object(p, "units");
+    JSON_Object *mem = json_object_get_object(p, "memory");
+    JSON_Value *d = units ? json_object_get_value(units, unit) : NULL;
+    JSON_Value *m = mem ? json_object_get_value(mem, unit) : NULL;
+
+    if (!d && !m) {
+        return -1;
+    }
+
+    if (duration) {
+        *duration = d ? json_value_get_number(d) : 0;
+    }
+    if (memory) {
+        *memory = m ? json_value_get_number(m) : 0;
+    }
+
+    return 0;
+}
+
+long bake_history_get_peak_memory(
+    const char *id)
+{
+    JSON_Object *p = bake_history_project(id, false);
+    JSON_Object *mem = p ? json_object_get_object(p, "memory") : NULL;
+    long result = 0;
+
+    if (mem) {
+        size_t i, count = json_object_get_count(mem);
+        for (i = 0; i < count; i ++) {
+            long m = json_value_get_number(json_object_get_value_at(mem, i));
+            if (m > result) {
+                result = m;
+            }
+        }
+    }
+
+    return result;
+}
+
+void bake_history_set_unit(
+    const char *id,
+    const char *unit,
+    double duration,
+    long memory)
+{
+    JSON_Object *p = bake_history_project(id, true);
+    if (p) {
+        JSON_Object *units = bake_json_find_or_create_object(p, "units");
+        if (units) {
+            bake_history_set(units, unit, duration);
+        }
+        JSON_Object *mem = bake_json_find_or_create_object(p, "memory");
+        if (mem) {
+            bake_history_set_peak(mem, unit, memory);
+        }
+    }
+}
@@ -142,23 +142,32 @@ int16_t bake_uninstall_from_env(
     bake_project *project,
     bool uninstall)
 {
+    ut_scratch_mark mark = ut_scratch_push();
+
     if (uninstall) {
-        ut_try( ut_rm(strarg("%s/meta/%s", env, project->id)), NULL);
+        ut_try( ut_rm(ut_scratch_asprintf("%s/meta/%s", env, project->id)), NULL);
 
         if (project->type == BAKE_PACKAGE) {
-            ut_try( ut_rm(strarg("%s/lib/%s", env, project->artefact)), NULL);
+            ut_try( ut_rm(ut_scratch_asprintf("%s/lib/%s", env, project->artefact)), NULL);
+            ut_try( ut_rm(ut_scratch_asprintf("%s/lib/%s.dwo", env, project->artefact)), NULL);
+            ut_try( ut_rm(ut_scratch_asprintf("%s/lib/%s.pgo", env, project->artefact)), NULL);
         } else if (project->type == BAKE_APPLICATION) {
-            ut_try( ut_rm(strarg("%s/bin/%s", env, project->artefact)), NULL);
+            ut_try( ut_rm(ut_scratch_asprintf("%s/bin/%s", env, project->artefact)), NULL);
+            ut_try( ut_rm(ut_scratch_asprintf("%s/bin/%s.dwo", env, project->artefact)), NULL);
+            ut_try( ut_rm(ut_scratch_asprintf("%s/bin/%s.pgo", env, project->artefact)), NULL);
         } else if (project->type == BAKE_TOOL) {
-            ut_try( ut_rm(strarg("%s/%s", env, project->artefact)), NULL);
+            ut_try( ut_rm(ut_scratch_asprintf("%s/%s", env, project->artefact)), NULL);
         }
     }
 
-    ut_try( ut_rm(strarg("%s/etc/%s", env, project->id)), NULL);
-    ut_try( ut_rm(strarg("%s/include/%s.dir", env, project->id)), NULL);
+    ut_try( ut_rm(ut_scratch_asprintf("%s/etc/%s", env, project->id)), NULL);
+    ut_try( ut_rm(ut_scratch_asprintf("%s/include/%s.dir", env, project->id)), NULL);
+    ut_try( ut_rm(ut_scratch_asprintf("%s/bmi/%s", env, project->id)), NULL);
 
+    ut_scratch_pop(mark);
     return 0;
 error:
+    ut_scratch_pop(mark);
     return -1;
 }
 
@@ -220,12 +229,15 @@ int16_t bake_install_metadata(
                 }
             }
 
+            ut_scratch_mark mark = ut_scratch_push();
+
             /* Write project source location to package repository */
-            FILE *src_location = fopen(strarg("%s/source.txt", projectDir), "w");
+            char *src_file = ut_scratch_asprintf("%s/source.txt", projectDir);
+            FILE *src_location = fopen(src_file, "w");
             if (!src_location) {
                 ut_throw("failed to write to '%s' for '%s'",
-                    strarg("%s/source.txt", projectDir),
-                    project->id);
+                    src_file, project->id);
+                ut_scratch_pop(mark);
                 goto error;
             }
             fprintf(src_location, "%s\n", project->path);
@@ -233,18 +245,21 @@ int16_t bake_install_metadata(
 
             /* If project contains dependee JSON, write to dependee.json */
             if (project->dependee_json && strlen(project->dependee_json)) {
-                FILE *dependee_config =
-                    fopen(strarg("%s/dependee.json", projectDir), "w");
+                char *dependee_file =
+                    ut_scratch_asprintf("%s/dependee.json", projectDir);
+                FILE *dependee_config = fopen(dependee_file, "w");
                 if (!dependee_config) {
                     ut_throw("failed to write to '%s' for '%s'",
-                        strarg("%s/dependee.json", projectDir),
-                        project->id);
+                        dependee_file, project->id);
+                    ut_scratch_pop(mark);
                     goto error;
                 }
                 fprintf(dependee_config, "%s\n", project->dependee_json);
                 fclose(dependee_config);
-                ut_trace("#[cyan]write %s/dependee.json", projectDir);
+                ut_trace("#[cyan]write %s", dependee_file);
             }
+
+            ut_scratch_pop(mark);
             free(projectDir);
         }
     }
@@ -363,6 +378,131 @@ error:
     return -1;
 }
 
+typedef struct bake_install_dwo_t {
+    const char *platform;   /* <platform>-<configuration> */
+    const char *target;     /* Directory to install split debug files to */
+} bake_install_dwo_t;
+
+static
+int bake_install_dwo_cb(
+    ut_dir_entry *entry,
+    void *ctx)
+{
+    bake_install_dwo_t *data = ctx;
+    const char *ext = strrchr(entry->name, '.');
+
+    if (entry->is_dir || !ext || strcmp(ext, ".dwo")) {
+        return 0;
+    }
+
+    /* Only install files of the current platform and configuration */
+    size_t len = strlen(data->platform);
+    const char *file = entry->relative;
+    while (file && (strncmp(file, data->platform, len) || file[len] != '/')) {
+        file = strchr(file, '/');
+        if (file) {
+            file ++;
+        }
+    }
+    if (!file) {
+        return 0;
+    }
+
+    ut_scratch_mark mark = ut_scratch_push();
+    char *dst = ut_scratch_asprintf("%s/%s", data->target, &file[len + 1]);
+    char *dir = ut_scratch_strdup(dst);
+    *strrchr(dir, '/') = '\0';
+    int16_t ret = ut_mkdir(dir);
+    if (!ret) {
+        ret = ut_cp(entry->path, dst);
+    }
+    ut_scratch_pop(mark);
+
+    return ret ? -1 : 0;
+}
+
+/* With split debug information, debug information is not linked into the
+ * artefact, but stored in .dwo files next to the objects in the project cache.
+ * The files are installed in a <artefact>.dwo directory next to the installed
+ * artefact, where they can be packaged (with dwp) for distribution. */
+static
+int16_t bake_install_dwo(
+    bake_config *config,
+    bake_project *project,
+    const char *targetDir)
+{
+    ut_scratch_mark mark = ut_scratch_push();
+    bake_install_dwo_t data = {
+        .platform = ut_scratch_asprintf(
+            "%s-%s", UT_PLATFORM_STRING, config->configuration),
+        .target = ut_scratch_asprintf("%s/%s.dwo", targetDir, project->artefact)
+    };
+
+    /* Remove files of sources that no longer exist */
+    ut_try (ut_rm(data.target), NULL);
+
+    if (ut_file_test(project->cache_path) == 1) {
+        ut_try (ut_dir_walk(
+            project->cache_path, 0, bake_install_dwo_cb, &data), NULL);
+    }
+
+    ut_scratch_pop(mark);
+    return 0;
+error:
+    ut_scratch_pop(mark);
+    return -1;
+}
+
+/* Profiles an artefact was optimized with are installed in a <artefact>.pgo
+ * directory next to the installed artefact, so that a build can be traced back
+ * to the training run it was optimized for. */
+static
+int16_t bake_install_pgo(
+    bake_config *config,
+    bake_project *project,
+    const char *targetDir)
+{
+    ut_scratch_mark mark = ut_scratch_push();
+    char *target = ut_scratch_asprintf("%s/%s.pgo", targetDir, project->artefact);
+
+    ut_try (ut_rm(target), NULL);
+
+    if (config->pgo == BAKE_PGO_USE && project->pgo_profile) {
+        ut_try (ut_cp(project->pgo_path, target), NULL);
+    }
+
+    ut_scratch_pop(mark);
+    return 0;
+error:
+    ut_scratch_pop(mark);
+    return -1;
+}
+
+/* Interfaces of C++ modules (BMIs) are installed in bmi/<project id>, so that
+ * dependents of the project can import its modules. */
+static
+int16_t bake_install_bmi(
+    bake_config *config,
+    bake_project *project)
+{
+    ut_scratch_mark mark = ut_scratch_push();
+    char *source = ut_scratch_asprintf("%s/bmi/%s-%s",
+        project->cache_path, UT_PLATFORM_STRING, config->configuration);
+    char *target = ut_scratch_asprintf("%s/bmi/%s", config->target, project->id);
+
+    ut_try (ut_rm(target), NULL);
+
+    if (ut_file_test(source) == 1 && !ut_dir_isEmpty(source)) {
+        ut_try (ut_cp(source, target), NULL);
+    }
+
+    ut_scratch_pop(mark);
+    return 0;
+error:
+    ut_scratch_pop(mark);
+    return -1;
+}
+
 int16_t bake_install_postbuild(
     bake_config *config,
     bake_project *project)
@@ -400,6 +540,18 @@ int16_t bake_install_postbuild(
             goto error;
         }
 
+        if (config->split_debug && bake_install_dwo(config, project, targetDir)) {
+            goto error;
+        }
+
+        if (bake_install_pgo(config, project, targetDir)) {
+            goto error;
+        }
+
+        if (bake_install_bmi(config, project)) {
+            goto error;
+        }
+
         /* Ensure that time on the local system has progressed past the point of the
          * file timestamp. If the build is running in a VM, the clock between the
          * client and host could be out of sync temporarily, which can result in
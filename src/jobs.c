@@ -0,0 +1,500 @@
+/* Copyright (c) 2010-2018 Sander Mertens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Admission of jobs (compiles, links) across all projects that are being
+ * built. A job is only started when there is a free job slot, and when its
+ * estimated memory usage fits in what is left of the memory budget.
+ *
+ * Job slots are shared with other build tools through the GNU make jobserver
+ * protocol. When bake runs under make, it is a jobserver client and takes a
+ * token from make for every job other than the first. Otherwise, when running
+ * more than one job, bake is the jobserver and exports its token pipe in
+ * MAKEFLAGS, so that make processes started by bake (or by drivers) take their
+ * tokens from the same pool.
+ *
+ * When a build is cancelled (a project failed, or bake was interrupted) no new
+ * jobs are started and processes of running jobs are killed. */
+
+/* Override feature macros for sysconf, sched_getaffinity & getloadavg */
+#ifndef _WIN32
+#undef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "bake.h"
+#include <poll.h>
+#include <fcntl.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+/* How often waiting jobs check whether tokens were returned by other
+ * processes, which does not signal the condition variable */
+#define BAKE_JOBS_TOKEN_POLL_NS (10 * 1000 * 1000)
+
+/* How often waiting jobs check whether the load average dropped */
+#define BAKE_JOBS_LOAD_POLL_NS (100 * 1000 * 1000)
+
+static ut_mutex_s bake_jobs_lock;
+static ut_cond_s bake_jobs_cond;
+static uint32_t bake_jobs_slots = 1;
+static uint64_t bake_jobs_budget;
+static uint32_t bake_jobs_running;
+static uint64_t bake_jobs_memory;
+static double bake_jobs_load_limit;
+
+/* Jobserver pipe (-1 if no jobserver is used) */
+static int bake_jobs_read_fd = -1;
+static int bake_jobs_write_fd = -1;
+static bool bake_jobs_implicit_used; /* Is the token of bake itself in use */
+
+static bool bake_jobs_is_cancelled;
+static volatile sig_atomic_t bake_jobs_interrupted; /* Set by signal handler */
+
+#ifdef __linux__
+/* Read number of CPUs allowed by a cgroup v2 cpu.max ("<quota> <period>") or
+ * cgroup v1 cpu.cfs_quota_us file. Returns 0 if there is no limit. */
+static
+uint32_t bake_jobs_cgroup_quota(
+    const char *quota_file,
+    const char *period_file)
+{
+    long long quota = -1, period = 0;
+    char buf[64];
+
+    FILE *f = fopen(quota_file, "r");
+    if (!f) {
+        return 0;
+    }
+
+    if (fgets(buf, sizeof(buf), f)) {
+        if (period_file) {
+            sscanf(buf, "%lld", &quota);
+        } else if (strncmp(buf, "max", 3)) {
+            sscanf(buf, "%lld %lld", &quota, &period);
+        }
+    }
+    fclose(f);
+
+    if (period_file && quota > 0) {
+        f = fopen(period_file, "r");
+        if (f) {
+            if (fscanf(f, "%lld", &period) != 1) {
+                period = 0;
+            }
+            fclose(f);
+        }
+    }
+
+    if (quota <= 0 || period <= 0) {
+        return 0;
+    }
+
+    /* Round up, a quota of 1.5 CPUs can keep 2 jobs busy most of the time */
+    return (quota + period - 1) / period;
+}
+
+/* Find CPU quota of the cgroup of bake. Every level of the hierarchy can set a
+ * quota, so use the smallest one. */
+static
+uint32_t bake_jobs_cgroup_cpus(void)
+{
+    uint32_t result = 0;
+    char line[512];
+
+    FILE *f = fopen("/proc/self/cgroup", "r");
+    if (!f) {
+        return 0;
+    }
+
+    /* cgroup v2 has a single hierarchy, listed as "0::<path>" */
+    while (fgets(line, sizeof(line), f)) {
+        if (!strncmp(line, "0::", 3)) {
+            char *path = &line[3];
+            path[strcspn(path, "\n")] = '\0';
+
+            char *elem;
+            do {
+                char *file = ut_asprintf("/sys/fs/cgroup%s/cpu.max",
+                    strcmp(path, "/") ? path : "");
+                uint32_t cpus = bake_jobs_cgroup_quota(file, NULL);
+                if (cpus && (!result || cpus < result)) {
+                    result = cpus;
+                }
+                free(file);
+
+                elem = strrchr(path, '/');
+                if (elem) {
+                    *elem = '\0';
+                }
+            } while (elem && path[0]);
+
+            break;
+        }
+    }
+
+    fclose(f);
+
+    /* Containers on hosts with cgroup v1 see their own cpu controller */
+    if (!result) {
+        result = bake_jobs_cgroup_quota(
+            "/sys/fs/cgroup/cpu/cpu.cfs_quota_us",
+            "/sys/fs/cgroup/cpu/cpu.cfs_period_us");
+    }
+
+    return result;
+}
+#endif
+
+/* Number of CPUs bake can use, which in a container can be less than the
+ * number of CPUs of the host */
+static
+uint32_t bake_jobs_cpus(void)
+{
+    long result = sysconf(_SC_NPROCESSORS_ONLN);
+
+#ifdef __linux__
+    cpu_set_t set;
+    if (!sched_getaffinity(0, sizeof(set), &set)) {
+        long count = CPU_COUNT(&set);
+        if (count > 0 && count < result) {
+            result = count;
+        }
+    }
+
+    uint32_t quota = bake_jobs_cgroup_cpus();
+    if (quota && quota < result) {
+        result = quota;
+    }
+#endif
+
+    return result > 0 ? result : 1;
+}
+
+static
+bool bake_jobs_fd_valid(
+    int fd)
+{
+    return fd >= 0 && fcntl(fd, F_GETFD) != -1;
+}
+
+/* Find jobserver of parent make in MAKEFLAGS. Supports both the pipe
+ * (--jobserver-auth=R,W or --jobserver-fds=R,W) and fifo (make 4.4,
+ * --jobserver-auth=fifo:PATH) styles. */
+static
+bool bake_jobs_client_init(void)
+{
+    const char *makeflags = ut_getenv("MAKEFLAGS");
+    const char *auth = NULL;
+    int read_fd = -1, write_fd = -1;
+
+    if (!makeflags) {
+        return false;
+    }
+
+    /* If multiple options are present, the last one is used */
+    const char *ptr = makeflags;
+    while ((ptr = strstr(ptr, "--jobserver-"))) {
+        if (!strncmp(ptr, "--jobserver-auth=", 17)) {
+            auth = ptr + 17;
+        } else if (!strncmp(ptr, "--jobserver-fds=", 16)) {
+            auth = ptr + 16;
+        }
+        ptr ++;
+    }
+
+    if (!auth) {
+        return false;
+    }
+
+    if (!strncmp(auth, "fifo:", 5)) {
+        const char *path = auth + 5;
+        size_t len = strcspn(path, " ");
+        char *fifo = ut_asprintf("%.*s", (int)len, path);
+        read_fd = write_fd = open(fifo, O_RDWR);
+        if (read_fd == -1) {
+            ut_warning("cannot open jobserver '%s', ignoring (%s)",
+                fifo, strerror(errno));
+        }
+        free(fifo);
+    } else if (sscanf(auth, "%d,%d", &read_fd, &write_fd) == 2) {
+        /* Make only passes the jobserver to commands it knows are recursive
+         * invocations. Otherwise the descriptors are closed. */
+        if (!bake_jobs_fd_valid(read_fd) || !bake_jobs_fd_valid(write_fd)) {
+            ut_warning(
+                "jobserver unavailable (prefix the make rule with '+'), "
+                "ignoring");
+            read_fd = write_fd = -1;
+        }
+    }
+
+    if (read_fd == -1) {
+        return false;
+    }
+
+    bake_jobs_read_fd = read_fd;
+    bake_jobs_write_fd = write_fd;
+
+    ut_trace("using jobserver of parent process (%s)", makeflags);
+
+    return true;
+}
+
+/* Create token pipe with a token for every job after the first */
+static
+int16_t bake_jobs_server_init(
+    uint32_t slots)
+{
+    int fds[2];
+    uint32_t i;
+
+    if (pipe(fds)) {
+        ut_throw("failed to create jobserver pipe: %s", strerror(errno));
+        goto error;
+    }
+
+    for (i = 0; i < slots - 1; i ++) {
+        if (write(fds[1], "+", 1) != 1) {
+            ut_throw("failed to fill jobserver pipe: %s", strerror(errno));
+            goto error;
+        }
+    }
+
+    bake_jobs_read_fd = fds[0];
+    bake_jobs_write_fd = fds[1];
+
+    /* Processes started by bake inherit the pipe & MAKEFLAGS. Both the new and
+     * old option names are exported, for make versions before 4.2. */
+    const char *makeflags = ut_getenv("MAKEFLAGS");
+    ut_try (ut_setenv("MAKEFLAGS", "%s%s-j%u --jobserver-auth=%d,%d "
+        "--jobserver-fds=%d,%d",
+        makeflags ? makeflags : "", makeflags ? " " : "", slots,
+        fds[0], fds[1], fds[0], fds[1]), NULL);
+
+    return 0;
+error:
+    return -1;
+}
+
+int16_t bake_jobs_init(
+    bake_config *config)
+{
+    ut_try (ut_mutex_new(&bake_jobs_lock), NULL);
+    ut_try (ut_cond_new(&bake_jobs_cond), NULL);
+
+    if (!config->jobs) {
+        config->jobs = bake_jobs_cpus();
+    }
+
+    /* When running under make, its tokens limit the number of jobs that run
+     * at the same time. Otherwise bake hands out the tokens. */
+    if (!bake_jobs_client_init() && config->jobs > 1) {
+        ut_try (bake_jobs_server_init(config->jobs), NULL);
+    }
+
+    bake_jobs_slots = config->jobs;
+    bake_jobs_budget = config->mem_budget;
+    bake_jobs_load_limit = config->load_average;
+
+    ut_trace("running up to %u jobs", config->jobs);
+
+    return 0;
+error:
+    return -1;
+}
+
+/* Get a token for job. The first job uses the token of bake itself, other jobs
+ * have to take a token from the jobserver. */
+static
+bool bake_jobs_token(
+    bake_job *job)
+{
+    job->token = 0;
+
+    if (bake_jobs_read_fd == -1) {
+        return true;
+    }
+
+    if (!bake_jobs_implicit_used) {
+        bake_jobs_implicit_used = true;
+        return true;
+    }
+
+    /* Another process can take the token between poll and read, in which case
+     * read blocks until a token is returned. */
+    struct pollfd pfd = {.fd = bake_jobs_read_fd, .events = POLLIN};
+    if (poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN)) {
+        char token;
+        if (read(bake_jobs_read_fd, &token, 1) == 1) {
+            job->token = token;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Wait until a job was released, or until it is time to poll for tokens */
+static
+void bake_jobs_wait(void)
+{
+    if (bake_jobs_read_fd != -1) {
+        ut_cond_timedwait(
+            &bake_jobs_cond, &bake_jobs_lock, BAKE_JOBS_TOKEN_POLL_NS);
+    } else if (bake_jobs_load_limit > 0) {
+        ut_cond_timedwait(
+            &bake_jobs_cond, &bake_jobs_lock, BAKE_JOBS_LOAD_POLL_NS);
+    } else {
+        ut_cond_wait(&bake_jobs_cond, &bake_jobs_lock);
+    }
+}
+
+static
+bool bake_jobs_fits(
+    bake_job *job)
+{
+    if (bake_jobs_running >= bake_jobs_slots) {
+        return false;
+    }
+
+    /* A job that exceeds the budget by itself still has to run at some point,
+     * so admit it when nothing else is running */
+    if (bake_jobs_budget && bake_jobs_running) {
+        if (bake_jobs_memory + job->memory > bake_jobs_budget) {
+            return false;
+        }
+    }
+
+    /* Like make -l, don't add jobs to a machine that is already busy */
+    if (bake_jobs_load_limit > 0 && bake_jobs_running) {
+        double load;
+        if (getloadavg(&load, 1) == 1 && load >= bake_jobs_load_limit) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bake_job* bake_jobs_take(
+    ut_ll jobs)
+{
+    bake_job *result = NULL;
+
+    ut_mutex_lock(&bake_jobs_lock);
+
+    while (ut_ll_count(jobs) && !bake_jobs_cancelled()) {
+        /* Jobs are ordered by priority. If the first job doesn't fit in the
+         * budget, a cheaper job can still use the free slot. */
+        ut_iter it = ut_ll_iter(jobs);
+        while (ut_iter_hasNext(&it)) {
+            bake_job *job = ut_iter_next(&it);
+            if (bake_jobs_fits(job)) {
+                result = job;
+                break;
+            }
+        }
+
+        if (result) {
+            if (bake_jobs_token(result)) {
+                ut_ll_remove(jobs, result);
+                bake_jobs_running ++;
+                bake_jobs_memory += result->memory;
+                break;
+            }
+
+            /* No token available, wait for other processes */
+            result = NULL;
+        }
+
+        bake_jobs_wait();
+    }
+
+    ut_mutex_unlock(&bake_jobs_lock);
+
+    return result;
+}
+
+int16_t bake_jobs_acquire(
+    bake_job *job)
+{
+    ut_mutex_lock(&bake_jobs_lock);
+
+    while (!bake_jobs_fits(job) || !bake_jobs_token(job)) {
+        if (bake_jobs_cancelled()) {
+            ut_mutex_unlock(&bake_jobs_lock);
+            return -1;
+        }
+        bake_jobs_wait();
+    }
+
+    bake_jobs_running ++;
+    bake_jobs_memory += job->memory;
+
+    ut_mutex_unlock(&bake_jobs_lock);
+
+    return 0;
+}
+
+void bake_jobs_release(
+    bake_job *job)
+{
+    /* Return token before taking the lock, in case another thread is blocked
+     * on reading a token while holding the lock */
+    if (job->token) {
+        if (write(bake_jobs_write_fd, &job->token, 1) != 1) {
+            ut_error("failed to return jobserver token: %s", strerror(errno));
+        }
+    }
+
+    ut_mutex_lock(&bake_jobs_lock);
+    if (!job->token) {
+        bake_jobs_implicit_used = false;
+    }
+    bake_jobs_running --;
+    bake_jobs_memory -= job->memory;
+    ut_cond_broadcast(&bake_jobs_cond);
+    ut_mutex_unlock(&bake_jobs_lock);
+}
+
+void bake_jobs_cancel(void)
+{
+    ut_mutex_lock(&bake_jobs_lock);
+    bake_jobs_is_cancelled = true;
+    ut_cond_broadcast(&bake_jobs_cond);
+    ut_mutex_unlock(&bake_jobs_lock);
+
+    ut_proc_kill_all(UT_SIGTERM);
+}
+
+void bake_jobs_interrupt(
+    int sig)
+{
+    bake_jobs_interrupted = sig;
+    ut_proc_kill_all(sig);
+}
+
+bool bake_jobs_cancelled(void)
+{
+    return bake_jobs_is_cancelled || bake_jobs_interrupted;
+}
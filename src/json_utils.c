@@ -37,6 +37,7 @@ int16_t bake_json_set_boolean(
 }
 
 int16_t bake_json_set_string(
+    ut_arena *arena,
     char **ptr,
     const char *member,
     JSON_Value *v)
@@ -47,19 +48,15 @@ int16_t bake_json_set_string(
         ut_throw("expected string for member '%s'", member);
         return -1;
     }
-    if (*ptr) {
-        free(*ptr);
-    }
-    const char *str = json_value_get_string(v);
-    if (str) {
-        *ptr = ut_strdup(str);
-    } else {
-        *ptr = NULL;
-    }
+
+    /* Previous value is owned by arena, so it does not need to be freed */
+    *ptr = ut_arena_strdup(arena, json_value_get_string(v));
+
     return 0;
 }
 
 int16_t bake_json_set_array(
+    ut_arena *arena,
     ut_ll *ptr,
     const char *member,
     JSON_Value *v)
@@ -70,7 +67,7 @@ int16_t bake_json_set_array(
     }
 
     if (!*ptr) {
-        *ptr = ut_ll_new();
+        *ptr = ut_arena_own(arena, ut_ll_new(), (ut_arena_free_cb)ut_ll_free);
     }
 
     JSON_Array *array = json_value_get_array(v);
@@ -84,7 +81,7 @@ int16_t bake_json_set_array(
         }
 
         const char *json_el = json_array_get_string(array, i);
-        ut_ll_append(*ptr, strdup(json_el));
+        ut_ll_append(*ptr, ut_arena_strdup(arena, json_el));
     }
 
     return 0;
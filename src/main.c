@@ -24,9 +24,10 @@
 ut_tls BAKE_DRIVER_KEY;
 ut_tls BAKE_FILELIST_KEY;
 ut_tls BAKE_PROJECT_KEY;
+ut_tls BAKE_UNIT_KEY;
 
 /* Bake configuration */
-const char *cfg = "debug";
+const char *cfg = NULL;
 const char *env = "default";
 const char *action = "build";
 const char *path = ".";
@@ -44,6 +45,12 @@ const char *language = NULL;
 /* Command specific parameters */
 const char *export_expr = NULL;
 const char *publish_cmd = NULL;
+const char *trace_out = NULL;
+const char *pgo_run = NULL;
+uint32_t jobs = 0;
+uint64_t mem_budget = 0;
+double load_average = 0;
+bool keep_going = false;
 
 #define ARG(short, long, action)\
     if (i < argc) {\
@@ -73,6 +80,11 @@ void bake_usage(void)
     printf("  --cfg <configuration>        Specify configuration id\n");
     printf("  --env <environment>          Specify environment id\n");
     printf("  --build-to-home              Build to BAKE_HOME instead of BAKE_TARGET\n");
+    printf("  -j,--jobs <n>                Run up to n jobs in parallel (default = available CPUs)\n");
+    printf("  -l,--load-average <load>     Don't start new jobs while the load average is at least load\n");
+    printf("  --mem-budget <size>          Only run jobs in parallel while their estimated memory fits in size (e.g. 16G)\n");
+    printf("  -k,--keep-going              Keep building projects that don't depend on a failed project\n");
+    printf("  --run <command>              Training command for the pgo command\n");
     printf("\n");
     printf("  --id <project id>            Manually specify a project id\n");
     printf("  --type <project type>        Manually specify a project type (default = \"package\")\n");
@@ -82,6 +94,7 @@ void bake_usage(void)
     printf("\n");
     printf("  --trace                      Set verbosity to TRACE\n");
     printf("  -v,--verbosity <kind>        Set verbosity level (DEBUG, TRACE, OK, INFO, WARNING, ERROR, CRITICAL)\n");
+    printf("  --trace-out <file>           Write build trace (chrome://tracing format) to file\n");
     printf("\n");
     printf("Commands:\n");
     printf("  init [path]                  Initialize new bake project\n");
@@ -93,6 +106,7 @@ void bake_usage(void)
     printf("  uninstall [project id]       Remove project from bake environment\n");
     printf("  clone <git url>              Clone and build git repository and dependencies\n");
     printf("  update [project id]          Update an installed package or application\n");
+    printf("  pgo [path] --run <command>   Rebuild a project with profile guided optimization\n");
     printf("\n");
     printf("  env                          Echo bake environment\n");
     printf("  upgrade                      Upgrade to new bake version\n");
@@ -154,7 +168,8 @@ bool bake_is_action(
         !strcmp(arg, "install") ||
         !strcmp(arg, "uninstall") ||
         !strcmp(arg, "update") ||
-        !strcmp(arg, "clone"))
+        !strcmp(arg, "clone") ||
+        !strcmp(arg, "pgo"))
     {
         return true;
     }
@@ -202,6 +217,12 @@ int bake_parse_args(
 
             ARG(0, "trace", ut_log_verbositySet(UT_TRACE));
             ARG('v', "verbosity", bake_set_verbosity(argv[i + 1]); i ++);
+            ARG(0, "trace-out", trace_out = argv[i + 1]; i ++);
+            ARG('j', "jobs", jobs = atoi(argv[i + 1]); i ++);
+            ARG('l', "load-average", load_average = atof(argv[i + 1]); i ++);
+            ARG(0, "mem-budget", ut_try(bake_config_parse_size(argv[i + 1], &mem_budget), NULL); i ++);
+            ARG('k', "keep-going", keep_going = true);
+            ARG(0, "run", pgo_run = argv[i + 1]; i ++);
 
             ARG(0, "local-setup", local_setup = true; i ++);
 
@@ -264,6 +285,22 @@ int bake_parse_args(
         publish_cmd = path;
     }
 
+    else if (!strcmp(action, "pgo")) {
+        if (!pgo_run) {
+            ut_throw("missing training command for pgo (specify with --run)");
+            goto error;
+        }
+
+        /* Profiles only pay off in optimized builds */
+        if (!cfg) {
+            cfg = "release";
+        }
+    }
+
+    if (!cfg) {
+        cfg = "debug";
+    }
+
     /* If artefact is manually specified, translate to platform specific name */
     if (artefact) {
         if (type == BAKE_PACKAGE) {
@@ -281,16 +318,18 @@ bake_project *bake_project_from_cmdline(
     bake_config *config)
 {
     bake_project *project = bake_project_new(NULL, NULL);
-    project->id = ut_strdup(id);
+    ut_arena *arena = project->arena;
+    project->id = ut_arena_strdup(arena, id);
     project->type = type;
-    project->artefact = ut_strdup(artefact);
-    project->path = ut_strdup(path);
+    project->artefact = ut_arena_strdup(arena, artefact);
+    project->path = ut_arena_strdup(arena, path);
     project->public = true;
     project->freshly_baked = true;
-    project->language = ut_strdup(language);
+    project->language = ut_arena_strdup(arena, language);
     if (includes) {
-        project->includes = ut_ll_new();
-        ut_ll_append(project->includes, ut_strdup(includes));
+        project->includes = ut_arena_own(
+            arena, ut_ll_new(), (ut_arena_free_cb)ut_ll_free);
+        ut_ll_append(project->includes, ut_arena_strdup(arena, includes));
     }
 
     ut_try( bake_project_init(config, project), NULL);
@@ -343,8 +382,61 @@ int bake_build(
         goto error;
     }
 
-    /* Walk projects in correct dependency order */
-    ut_try( bake_crawler_walk(config, crawler, action, cb), NULL);
+    /* Walk projects in correct dependency order. Durations of previous builds
+     * are used to start the projects on the critical path first. */
+    ut_try( bake_history_load(config), NULL);
+    bake_report_begin(config->jobs);
+    if (bake_crawler_walk(config, crawler, action, cb)) {
+        bake_report_end(path, action);
+        bake_history_save(config);
+        goto error;
+    }
+
+    ut_try( bake_report_end(path, action), NULL);
+    ut_try( bake_history_save(config), NULL);
+
+    return 0;
+error:
+    return -1;
+}
+
+/* Profile guided optimization: build instrumented binaries, run the training
+ * command to record profiles, then rebuild with the recorded profiles. */
+int bake_pgo_build(
+    bake_config *config,
+    bake_crawler *crawler)
+{
+    int8_t rc = 0;
+
+    if (!config->optimizations) {
+        ut_throw("configuration '%s' does not enable optimizations, "
+            "specify an optimized configuration with --cfg", config->configuration);
+        goto error;
+    }
+
+    ut_log("#[bold]build instrumented binaries\n");
+    config->pgo = BAKE_PGO_GENERATE;
+    ut_try (bake_build(config, crawler, "rebuild"), NULL);
+
+    ut_log("#[bold]train#[normal] %s\n", pgo_run);
+    char *argv[] = {"/bin/sh", "-c", (char*)pgo_run, NULL};
+    ut_proc pid = ut_proc_run(argv[0], argv);
+    if (pid <= 0 || ut_proc_wait(pid, &rc) || rc) {
+        ut_throw("training command '%s' failed", pgo_run);
+        goto error;
+    }
+
+    /* Projects can't be walked twice, so rediscover them for the rebuild */
+    ut_log("#[bold]build optimized binaries\n");
+    config->pgo = BAKE_PGO_USE;
+    crawler = bake_discovery(config);
+    if (!crawler) {
+        goto error;
+    }
+
+    int ret = bake_build(config, crawler, "rebuild");
+    bake_crawler_free(crawler);
+    ut_try (ret, NULL);
 
     return 0;
 error:
@@ -405,8 +497,7 @@ int bake_init_project(
     }
 
     if (!project->language) {
-        free(project->language);
-        project->language = ut_strdup("c");
+        project->language = ut_arena_strdup(project->arena, "c");
     }
 
     ut_try( bake_project_setup(config, project), NULL);
@@ -444,11 +535,34 @@ error:
     return -1;
 }
 
+static volatile sig_atomic_t bake_interrupted;
+
+/* Jobs run in their own process group and don't receive signals from the
+ * terminal, so forward the signal. A second signal terminates bake without
+ * waiting for jobs to be cleaned up. */
+static
+void bake_interrupt(
+    int sig)
+{
+    if (bake_interrupted) {
+        signal(sig, SIG_DFL);
+        raise(sig);
+        return;
+    }
+
+    bake_interrupted = sig;
+    bake_jobs_interrupt(sig);
+}
+
 int main(int argc, const char *argv[]) {
     bake_config config = {};
 
     srand (time(NULL));
 
+    signal(SIGINT, bake_interrupt);
+    signal(SIGTERM, bake_interrupt);
+    signal(SIGHUP, bake_interrupt);
+
     ut_init("bake");
 
     ut_log_fmt("%C %V %m");
@@ -457,9 +571,14 @@ int main(int argc, const char *argv[]) {
     ut_try (ut_tls_new(&BAKE_DRIVER_KEY, NULL), NULL);
     ut_try (ut_tls_new(&BAKE_FILELIST_KEY, NULL), NULL);
     ut_try (ut_tls_new(&BAKE_PROJECT_KEY, NULL), NULL);
+    ut_try (ut_tls_new(&BAKE_UNIT_KEY, NULL), NULL);
+    ut_try (bake_driver_init(), NULL);
 
     ut_log_push("init");
     ut_try (bake_parse_args(argc, argv), NULL);
+    if (trace_out) {
+        ut_log_trace_enable();
+    }
     ut_trace("configuration: %s", cfg);
     ut_trace("environment: %s", env);
     ut_trace("path: %s", path);
@@ -472,6 +591,12 @@ int main(int argc, const char *argv[]) {
 
     ut_log_push("config");
     ut_try (bake_config_load(&config, cfg, env, build_to_home), NULL);
+    /* Command line options override the configuration */
+    if (jobs) config.jobs = jobs;
+    if (mem_budget) config.mem_budget = mem_budget;
+    if (load_average) config.load_average = load_average;
+    if (keep_going) config.keep_going = true;
+    ut_try (bake_jobs_init(&config), NULL);
     ut_log_pop();
 
     /* Initialize package loader */
@@ -503,7 +628,11 @@ int main(int argc, const char *argv[]) {
         /* If projects have been discovered, build them */
         if (crawler) {
             ut_log_push("build");
-            ut_try(bake_build(&config, crawler, action), NULL);
+            if (!strcmp(action, "pgo")) {
+                ut_try(bake_pgo_build(&config, crawler), NULL);
+            } else {
+                ut_try(bake_build(&config, crawler, action), NULL);
+            }
             ut_log_pop();
 
             bake_crawler_free(crawler);
@@ -537,9 +666,23 @@ int main(int argc, const char *argv[]) {
         }
     }
 
+    if (trace_out) {
+        ut_try (ut_log_trace_write(trace_out), NULL);
+    }
+
     ut_deinit();
     return 0;
 error:
+    if (trace_out) {
+        ut_log_trace_write(trace_out);
+    }
     ut_deinit();
+
+    /* Exit with the signal, so the shell knows bake was interrupted */
+    if (bake_interrupted) {
+        signal(bake_interrupted, SIG_DFL);
+        raise(bake_interrupted);
+    }
+
     return -1;
 }
@@ -43,37 +43,37 @@ int16_t bake_project_parse_value(
            ut_try (bake_json_set_boolean(&p->public, member, v), NULL);
         } else
         if (!strcmp(member, "author")) {
-            ut_try (bake_json_set_string(&p->author, member, v), NULL);
+            ut_try (bake_json_set_string(p->arena, &p->author, member, v), NULL);
         } else
         if (!strcmp(member, "description")) {
-            ut_try (bake_json_set_string(&p->description, member, v), NULL);
+            ut_try (bake_json_set_string(p->arena, &p->description, member, v), NULL);
         } else
         if (!strcmp(member, "version")) {
-            ut_try (bake_json_set_string(&p->version, member, v), NULL);
+            ut_try (bake_json_set_string(p->arena, &p->version, member, v), NULL);
         } else
         if (!strcmp(member, "repository")) {
-            ut_try (bake_json_set_string(&p->repository, member, v), NULL);
+            ut_try (bake_json_set_string(p->arena, &p->repository, member, v), NULL);
         } else
         if (!strcmp(member, "license")) {
-            ut_try (bake_json_set_string(&p->license, member, v), NULL);
+            ut_try (bake_json_set_string(p->arena, &p->license, member, v), NULL);
         } else
         if (!strcmp(member, "language")) {
-            ut_try (bake_json_set_string(&p->language, member, v), NULL);
+            ut_try (bake_json_set_string(p->arena, &p->language, member, v), NULL);
         } else
         if (!strcmp(member, "use")) {
-            ut_try (bake_json_set_array(&p->use, member, v), NULL);
+            ut_try (bake_json_set_array(p->arena, &p->use, member, v), NULL);
         } else
         if (!strcmp(member, "use_private")) {
-            ut_try (bake_json_set_array(&p->use_private, member, v), NULL);
+            ut_try (bake_json_set_array(p->arena, &p->use_private, member, v), NULL);
         } else
         if (!strcmp(member, "link")) {
-            ut_try (bake_json_set_array(&p->link, member, v), NULL);
+            ut_try (bake_json_set_array(p->arena, &p->link, member, v), NULL);
         } else
         if (!strcmp(member, "sources")) {
-            ut_try (bake_json_set_array(&p->sources, member, v), NULL);
+            ut_try (bake_json_set_array(p->arena, &p->sources, member, v), NULL);
         } else
         if (!strcmp(member, "includes")) {
-            ut_try (bake_json_set_array(&p->includes, member, v), NULL);
+            ut_try (bake_json_set_array(p->arena, &p->includes, member, v), NULL);
         } else
         if (!strcmp(member, "keep_artefact")) {
             ut_try (bake_json_set_boolean(&p->keep_artefact, member, v), NULL);
@@ -93,7 +93,7 @@ int16_t bake_project_set(
     const char *id,
     const char *type)
 {
-    p->id = ut_strdup(id);
+    p->id = ut_arena_strdup(p->arena, id);
 
     if (!strcmp(type, "application")) {
         p->type = BAKE_APPLICATION;
@@ -134,6 +134,7 @@ int16_t bake_project_parse(
         JSON_Object *jo = json_value_get_object(j);
         if (!jo) {
             ut_throw("failed to parse '%s' (expected object)", file);
+            json_value_free(j);
             goto error;
         }
 
@@ -148,6 +149,8 @@ int16_t bake_project_parse(
             j_type = "package";
         }
 
+        ut_arena_own(project->arena, j, (ut_arena_free_cb)json_value_free);
+
         ut_try (bake_project_set(project, j_id, j_type), NULL);
 
         JSON_Object *j_value = json_object_get_object(jo, "value");
@@ -161,8 +164,10 @@ int16_t bake_project_parse(
         goto error;
     }
 
+    free(file);
     return 0;
 error:
+    free(file);
     return -1;
 }
 
@@ -197,7 +202,8 @@ int bake_project_load_driver(
             goto error;
         }
 
-        project_driver = malloc(sizeof(bake_project_driver));
+        project_driver = ut_arena_alloc(
+            project->arena, sizeof(bake_project_driver));
         project_driver->driver = driver;
         project_driver->json = NULL;
         project_driver->attributes = NULL;
@@ -226,6 +232,9 @@ int16_t bake_project_load_dependee_config(
         goto error;
     }
 
+    /* Drivers may refer to objects in the dependee configuration */
+    ut_arena_own(project->arena, j, (ut_arena_free_cb)json_value_free);
+
     JSON_Object *jo = json_value_get_object(j);
     if (!jo) {
         ut_throw("failed to parse '%s' (expected object)", file);
@@ -296,12 +305,22 @@ error:
 
 /* -- Public API -- */
 
+static
+ut_ll bake_project_list_new(
+    bake_project *project)
+{
+    return ut_arena_own(
+        project->arena, ut_ll_new(), (ut_arena_free_cb)ut_ll_free);
+}
+
 int16_t bake_project_init(
     bake_config *config,
     bake_project *project)
 {
-    project->id_underscore = ut_strdup(project->id);
-    project->id_dash = ut_strdup(project->id);
+    ut_arena *arena = project->arena;
+
+    project->id_underscore = ut_arena_strdup(arena, project->id);
+    project->id_dash = ut_arena_strdup(arena, project->id);
 
     const char *ptr;
     char ch;
@@ -320,53 +339,51 @@ int16_t bake_project_init(
     }
 
     if (!project->sources) {
-        project->sources = ut_ll_new();
+        project->sources = bake_project_list_new(project);
     }
     if (!project->includes) {
-        project->includes = ut_ll_new();
+        project->includes = bake_project_list_new(project);
     }
     if (!project->drivers) {
-        project->drivers = ut_ll_new();
+        project->drivers = bake_project_list_new(project);
     }
     if (!project->use) {
-        project->use = ut_ll_new();
+        project->use = bake_project_list_new(project);
     }
     if (!project->use_private) {
-        project->use_private = ut_ll_new();
+        project->use_private = bake_project_list_new(project);
     }
     if (!project->use_build) {
-        project->use_build = ut_ll_new();
+        project->use_build = bake_project_list_new(project);
     }
     if (!project->link) {
-        project->link = ut_ll_new();
+        project->link = bake_project_list_new(project);
     }
     if (!project->files_to_clean) {
-        project->files_to_clean = ut_ll_new();
+        project->files_to_clean = bake_project_list_new(project);
     }
 
     /* If 'src' and 'includes' weren't set, use defaults */
     if (!ut_ll_count(project->sources)) {
-        ut_ll_append(project->sources, ut_strdup("src"));
+        ut_ll_append(project->sources, ut_arena_strdup(arena, "src"));
     }
     if (!ut_ll_count(project->includes)) {
-        ut_ll_append(project->includes, ut_strdup("include"));
+        ut_ll_append(project->includes, ut_arena_strdup(arena, "include"));
     }
 
     if (!project->language) {
-        project->language = ut_strdup("c");
+        project->language = ut_arena_strdup(arena, "c");
     }
 
     if (!project->version) {
-        project->version = ut_strdup("0.0.0");
+        project->version = ut_arena_strdup(arena, "0.0.0");
     }
 
     if (project->language && !strcmp(project->language, "c++")) {
-        free(project->language);
-        project->language = ut_strdup("cpp");
+        project->language = ut_arena_strdup(arena, "cpp");
     }
 
     if (project->language && !strcmp(project->language, "none")) {
-        free(project->language);
         project->language = NULL;
     }
 
@@ -383,26 +400,32 @@ int16_t bake_project_init(
         project->language_driver = driver;
 
         if (!project->artefact) {
-            project->artefact = bake_driver__artefact(
-                driver->driver, config, project);
+            /* Artefact name is allocated by the driver */
+            project->artefact = ut_arena_own(arena, bake_driver__artefact(
+                driver->driver, config, project), free);
         }
     }
 
-    project->artefact_path = ut_asprintf(
+    project->artefact_path = ut_arena_asprintf(arena,
         "%s/bin/%s-%s", project->path, UT_PLATFORM_STRING,
         config->configuration);
 
     if (project->artefact) {
-        project->artefact_file = ut_asprintf(
+        project->artefact_file = ut_arena_asprintf(arena,
             "%s/%s", project->artefact_path, project->artefact);
     }
 
-    project->bin_path = ut_asprintf(
+    project->bin_path = ut_arena_asprintf(arena,
         "%s/bin", project->path);
 
-    project->cache_path = ut_asprintf(
+    project->cache_path = ut_arena_asprintf(arena,
         "%s/.bake_cache", project->path);
 
+    /* Profiles are not stored in the cache, as they must survive a rebuild */
+    project->pgo_path = ut_arena_asprintf(arena,
+        "%s/.bake_pgo/%s-%s", project->path, UT_PLATFORM_STRING,
+        config->configuration);
+
     return 0;
 error:
     return -1;
@@ -413,11 +436,12 @@ bake_project* bake_project_new(
     bake_config *config)
 {
     bake_project *result = ut_calloc(sizeof (bake_project));
+    result->arena = ut_arena_new(0);
     if (!path && !config) {
         return result;
     }
 
-    result->path = path ? strdup(path) : NULL;
+    result->path = ut_arena_strdup(result->arena, path);
     result->public = true;
 
     /* Parse project.json if available */
@@ -432,28 +456,22 @@ bake_project* bake_project_new(
 
     return result;
 error:
+    bake_project_free(result);
     return NULL;
 }
 
 void bake_project_free(
     bake_project *project)
 {
-    bake_attr_free_string_array(project->use);
-    bake_attr_free_string_array(project->use_private);
-    bake_attr_free_string_array(project->use_build);
-    bake_attr_free_string_array(project->sources);
-    bake_attr_free_string_array(project->includes);
-    bake_attr_free_string_array(project->link);
-
-    ut_iter it = ut_ll_iter(project->drivers);
-    while (ut_iter_hasNext(&it)) {
-        bake_project_driver *driver = ut_iter_next(&it);
-        bake_attr_free_attr_array(driver->attributes);
+    /* The list of dependents is owned by the crawler, and may be handed over
+     * from a placeholder to the actual project. */
+    if (project->dependents) {
+        ut_ll_free(project->dependents);
     }
 
-    free(project->id);
-    free(project->id_underscore);
-    free(project->id_dash);
+    /* Everything else the project allocated is released in one go */
+    ut_arena_free(project->arena);
+    free(project);
 }
 
 bake_attr* bake_project_get_attr(
@@ -491,7 +509,10 @@ int bake_project_load_drivers(
             if (strcmp(member, "dependee")) {
                 ut_try( bake_project_load_driver(project, member, obj), NULL);
             } else {
-                project->dependee_json = json_serialize_to_string(value);
+                project->dependee_json = ut_arena_own(
+                    project->arena,
+                    json_serialize_to_string(value),
+                    (ut_arena_free_cb)json_free_serialized_string);
             }
         }
     }
@@ -572,6 +593,7 @@ int16_t bake_check_dependency(
         if (dep) {
             if (dep->type != BAKE_PACKAGE) {
                 ut_throw("invalid dependency '%s', not a package", dependency);
+                bake_project_free(dep);
                 goto error;
             }
             if (dep->language) {
@@ -693,7 +715,7 @@ int16_t bake_project_resolve_links(
     bake_config *config,
     bake_project *project)
 {
-    ut_ll resolved = ut_ll_new();
+    ut_ll resolved = bake_project_list_new(project);
     ut_iter it = ut_ll_iter(project->link);
 
     while (ut_iter_hasNext(&it)) {
@@ -707,18 +729,21 @@ int16_t bake_project_resolve_links(
             project->language_driver->driver, config, project, parsed);
         if (!lib) {
             ut_throw("cannot find library '%s' in 'link' attribute", parsed);
+            free(parsed);
             goto error;
         }
 
-        ut_ll_append(resolved, lib);
+        free(parsed);
+
+        /* Library name is allocated by the driver */
+        ut_ll_append(resolved, ut_arena_own(project->arena, lib, free));
     }
 
-    bake_attr_free_string_array(project->link);
+    /* Old list is owned by the project arena */
     project->link = resolved;
 
     return 0;
 error:
-    bake_attr_free_string_array(resolved);
     return -1;
 }
 
@@ -850,6 +875,132 @@ error:
     return -1;
 }
 
+/* File in the profile directory of which the timestamp marks when the
+ * instrumented binaries were built */
+#define BAKE_PGO_STAMP "instrumented"
+
+typedef struct bake_pgo_stale_t {
+    time_t instrumented;
+    ut_ll generated;        /* Files generated by the build (files_to_clean) */
+    const char *dir;        /* Walked directory, relative to project */
+    bool stale;
+} bake_pgo_stale_t;
+
+static
+bool bake_project_pgo_generated(
+    bake_pgo_stale_t *data,
+    const char *relative)
+{
+    size_t len = strlen(data->dir);
+    ut_iter it = ut_ll_iter(data->generated);
+    while (ut_iter_hasNext(&it)) {
+        char *file = ut_iter_next(&it);
+        if (!strncmp(file, data->dir, len) && file[len] == '/' &&
+            !strcmp(&file[len + 1], relative))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static
+int bake_project_pgo_stale_cb(
+    ut_dir_entry *entry,
+    void *ctx)
+{
+    bake_pgo_stale_t *data = ctx;
+
+    /* Generated files are recreated by every rebuild, but only change when
+     * the project configuration changes. */
+    if (entry->is_dir || bake_project_pgo_generated(data, entry->relative)) {
+        return 0;
+    }
+
+    if (ut_lastmodified(entry->path) > data->instrumented) {
+        data->stale = true;
+        return -1;
+    }
+
+    return 0;
+}
+
+static
+int16_t bake_project_pgo_stale_dirs(
+    bake_project *project,
+    ut_ll dirs,
+    bake_pgo_stale_t *data)
+{
+    ut_iter it = ut_ll_iter(dirs);
+    while (!data->stale && ut_iter_hasNext(&it)) {
+        char *dir = ut_iter_next(&it);
+        ut_scratch_mark mark = ut_scratch_push();
+        char *path = ut_scratch_asprintf("%s/%s", project->path, dir);
+        int16_t ret = 0;
+
+        data->dir = dir;
+        if (ut_file_test(path) == 1) {
+            ret = ut_dir_walk(path, 0, bake_project_pgo_stale_cb, data);
+        }
+
+        ut_scratch_pop(mark);
+        if (ret && !data->stale) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* When building instrumented binaries, clear profiles of a previous training
+ * run. Otherwise, check whether the profiles are recorded for the current
+ * sources, as profiles of changed code can no longer be matched with it. */
+static
+int16_t bake_project_pgo_init(
+    bake_config *config,
+    bake_project *project)
+{
+    char *stamp = NULL;
+    project->pgo_profile = false;
+
+    if (config->pgo == BAKE_PGO_OFF) {
+        return 0;
+    }
+
+    stamp = ut_asprintf("%s/" BAKE_PGO_STAMP, project->pgo_path);
+
+    if (config->pgo == BAKE_PGO_GENERATE) {
+        ut_try (ut_rm(project->pgo_path), NULL);
+        ut_try (ut_mkdir(project->pgo_path), NULL);
+        ut_try (ut_touch(stamp), NULL);
+    } else if (ut_file_test(stamp) == 1) {
+        bake_pgo_stale_t data = {
+            .instrumented = ut_lastmodified(stamp),
+            .generated = project->files_to_clean
+        };
+
+        ut_try (bake_project_pgo_stale_dirs(project, project->sources, &data), NULL);
+        ut_try (bake_project_pgo_stale_dirs(project, project->includes, &data), NULL);
+
+        if (data.stale) {
+            ut_warning(
+              "profiles of '%s' are out of date, use 'bake pgo' to update them",
+              project->id);
+        } else {
+            project->pgo_profile = true;
+        }
+    } else {
+        ut_trace("no profiles found for '%s'", project->id);
+    }
+
+    free(stamp);
+    return 0;
+error:
+    free(stamp);
+    return -1;
+}
+
 static
 int16_t bake_project_build_artefact(
     bake_config *config,
@@ -867,6 +1018,8 @@ int16_t bake_project_build_artefact(
 
     ut_try (ut_mkdir(artefact_path), NULL);
 
+    ut_try (bake_driver__init(driver, config, project), NULL);
+
     ut_tls_set(BAKE_PROJECT_KEY, project);
 
     /* Evaluate root node */
@@ -876,6 +1029,7 @@ int16_t bake_project_build_artefact(
     bake_filelist_add_file(artefact_fl, project->artefact_file);
     if (bake_node_eval(driver, root, project, config, artefact_fl, NULL)) {
         ut_throw("failed to build rule '%s'", rule_name);
+        bake_filelist_free(artefact_fl);
         goto error;
     }
     bake_filelist_free(artefact_fl);
@@ -893,6 +1047,11 @@ int16_t bake_project_build(
         return 0;
     }
 
+    /* Prepare profiles for profile guided optimization */
+    if (bake_project_pgo_init(config, project)) {
+        goto error;
+    }
+
     /* Resolve libraries in project link attribute */
     if (bake_project_resolve_links(config, project)) {
         goto error;
@@ -948,6 +1107,7 @@ int16_t bake_project_clean_intern(
         }
     }
 
+    /* Cache contains objects and split debug information (.dwo files) */
     ut_try( ut_rm(project->cache_path), NULL);
 
     if (!project->keep_artefact) {
@@ -962,7 +1122,10 @@ int16_t bake_project_clean_intern(
         ut_iter it = ut_ll_iter(project->files_to_clean);
         while (ut_iter_hasNext(&it)) {
             char *file = ut_iter_next(&it);
-            ut_try(ut_rm(strarg("%s/%s", project->path, file)), NULL);
+            ut_scratch_mark mark = ut_scratch_push();
+            int16_t ret = ut_rm(ut_scratch_asprintf("%s/%s", project->path, file));
+            ut_scratch_pop(mark);
+            ut_try(ret, NULL);
         }
     }
 
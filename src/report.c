@@ -0,0 +1,369 @@
+/* Copyright (c) 2010-2018 Sander Mertens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "bake.h"
+
+/* Number of entries listed in the slowest & peak memory sections */
+#define BAKE_REPORT_TOP_SLOWEST (20)
+#define BAKE_REPORT_TOP_MEMORY (10)
+
+/* Process spawned by a driver */
+typedef struct bake_report_proc {
+    const char *project;
+    char *unit;
+    char *cmd;
+    ut_proc_usage usage;
+} bake_report_proc;
+
+/* Totals of a single project */
+typedef struct bake_report_project {
+    const char *id;
+    double wall;            /* Time spent in the build action of project */
+    double proc_wall;       /* Sum of wall time of processes of project */
+    double user;
+    double sys;
+    long max_rss;
+    uint32_t count;         /* Number of processes */
+} bake_report_project;
+
+static ut_mutex_s bake_report_lock;
+static bake_report_proc *bake_report_procs;
+static uint32_t bake_report_proc_count, bake_report_proc_size;
+static bake_report_project *bake_report_projects;
+static uint32_t bake_report_project_count, bake_report_project_size;
+static uint32_t bake_report_slots;
+static struct timespec bake_report_start;
+
+/* Find or add project totals. Must be called with the lock held. */
+static
+bake_report_project* bake_report_get_project(
+    const char *id)
+{
+    uint32_t i;
+    for (i = 0; i < bake_report_project_count; i ++) {
+        if (!strcmp(bake_report_projects[i].id, id)) {
+            return &bake_report_projects[i];
+        }
+    }
+
+    if (bake_report_project_count == bake_report_project_size) {
+        bake_report_project_size = bake_report_project_size
+            ? bake_report_project_size * 2
+            : 16;
+        bake_report_projects = realloc(bake_report_projects,
+            bake_report_project_size * sizeof(bake_report_project));
+    }
+
+    bake_report_project *result =
+        &bake_report_projects[bake_report_project_count ++];
+    memset(result, 0, sizeof(bake_report_project));
+    result->id = id;
+
+    return result;
+}
+
+void bake_report_begin(
+    uint32_t slots)
+{
+    ut_mutex_new(&bake_report_lock);
+    bake_report_slots = slots ? slots : 1;
+    timespec_gettime(&bake_report_start);
+}
+
+void bake_report_add_proc(
+    bake_project *project,
+    const char *unit,
+    const char *cmd,
+    ut_proc_usage *usage)
+{
+    ut_mutex_lock(&bake_report_lock);
+
+    if (bake_report_proc_count == bake_report_proc_size) {
+        bake_report_proc_size = bake_report_proc_size
+            ? bake_report_proc_size * 2
+            : 64;
+        bake_report_procs = realloc(bake_report_procs,
+            bake_report_proc_size * sizeof(bake_report_proc));
+    }
+
+    bake_report_proc *proc = &bake_report_procs[bake_report_proc_count ++];
+    proc->project = project ? project->id : "";
+    proc->unit = unit ? ut_strdup(unit) : NULL;
+    proc->cmd = ut_strdup(cmd);
+    proc->usage = *usage;
+
+    bake_report_project *totals = bake_report_get_project(proc->project);
+    totals->proc_wall += usage->wall;
+    totals->user += usage->user;
+    totals->sys += usage->sys;
+    if (usage->max_rss > totals->max_rss) {
+        totals->max_rss = usage->max_rss;
+    }
+    totals->count ++;
+
+    ut_mutex_unlock(&bake_report_lock);
+}
+
+void bake_report_add_project(
+    bake_project *project,
+    double wall)
+{
+    ut_mutex_lock(&bake_report_lock);
+    bake_report_get_project(project->id)->wall += wall;
+    ut_mutex_unlock(&bake_report_lock);
+}
+
+static
+int bake_report_compare_wall(
+    const void *p1,
+    const void *p2)
+{
+    const bake_report_proc *a = p1, *b = p2;
+    return (a->usage.wall < b->usage.wall) - (a->usage.wall > b->usage.wall);
+}
+
+static
+int bake_report_compare_rss(
+    const void *p1,
+    const void *p2)
+{
+    const bake_report_proc *a = p1, *b = p2;
+    return (a->usage.max_rss < b->usage.max_rss) -
+        (a->usage.max_rss > b->usage.max_rss);
+}
+
+/* Returns a name for a process that can be shown in the report */
+static
+const char* bake_report_proc_name(
+    bake_report_proc *proc)
+{
+    if (proc->unit) {
+        return proc->unit;
+    }
+    return proc->cmd;
+}
+
+static
+JSON_Value* bake_report_proc_json(
+    bake_report_proc *proc)
+{
+    JSON_Value *value = json_value_init_object();
+    JSON_Object *obj = json_value_get_object(value);
+    json_object_set_string(obj, "project", proc->project);
+    if (proc->unit) {
+        json_object_set_string(obj, "unit", proc->unit);
+    }
+    json_object_set_string(obj, "command", proc->cmd);
+    json_object_set_number(obj, "wall", proc->usage.wall);
+    json_object_set_number(obj, "user", proc->usage.user);
+    json_object_set_number(obj, "sys", proc->usage.sys);
+    json_object_set_number(obj, "max_rss_kb", proc->usage.max_rss);
+    return value;
+}
+
+static
+int16_t bake_report_write(
+    const char *path,
+    const char *action,
+    double wall,
+    double efficiency)
+{
+    JSON_Value *value = json_value_init_object();
+    JSON_Object *obj = json_value_get_object(value);
+    uint32_t i;
+
+    json_object_set_string(obj, "action", action);
+    json_object_set_number(obj, "wall", wall);
+    json_object_set_number(obj, "slots", bake_report_slots);
+    json_object_set_number(obj, "efficiency", efficiency);
+
+    JSON_Value *projects = json_value_init_array();
+    for (i = 0; i < bake_report_project_count; i ++) {
+        bake_report_project *p = &bake_report_projects[i];
+        JSON_Value *p_value = json_value_init_object();
+        JSON_Object *p_obj = json_value_get_object(p_value);
+        json_object_set_string(p_obj, "id", p->id);
+        json_object_set_number(p_obj, "wall", p->wall);
+        json_object_set_number(p_obj, "process_wall", p->proc_wall);
+        json_object_set_number(p_obj, "user", p->user);
+        json_object_set_number(p_obj, "sys", p->sys);
+        json_object_set_number(p_obj, "max_rss_kb", p->max_rss);
+        json_object_set_number(p_obj, "processes", p->count);
+        json_array_append_value(json_value_get_array(projects), p_value);
+    }
+    json_object_set_value(obj, "projects", projects);
+
+    /* Processes are sorted by wall time, slowest first */
+    JSON_Value *procs = json_value_init_array();
+    for (i = 0; i < bake_report_proc_count; i ++) {
+        json_array_append_value(json_value_get_array(procs),
+            bake_report_proc_json(&bake_report_procs[i]));
+    }
+    json_object_set_value(obj, "processes", procs);
+
+    char *cache_path = ut_asprintf("%s/.bake_cache", path);
+    char *file = ut_asprintf("%s/last_build.json", cache_path);
+
+    json_set_escape_slashes(0);
+
+    if (ut_mkdir(cache_path)) {
+        goto error;
+    }
+
+    if (json_serialize_to_file_pretty(value, file) != JSONSuccess) {
+        ut_throw("failed to write build report to '%s'", file);
+        goto error;
+    }
+
+    ut_trace("build report written to '%s'", file);
+
+    free(cache_path);
+    free(file);
+    json_value_free(value);
+    return 0;
+error:
+    free(cache_path);
+    free(file);
+    json_value_free(value);
+    return -1;
+}
+
+static
+void bake_report_print(
+    double wall,
+    double efficiency)
+{
+    uint32_t i;
+    double user = 0, sys = 0;
+    long max_rss = 0;
+
+    for (i = 0; i < bake_report_proc_count; i ++) {
+        user += bake_report_procs[i].usage.user;
+        sys += bake_report_procs[i].usage.sys;
+        if (bake_report_procs[i].usage.max_rss > max_rss) {
+            max_rss = bake_report_procs[i].usage.max_rss;
+        }
+    }
+
+    ut_log("#[grey]%u processes in %.2fs (user %.2fs, sys %.2fs, "
+        "peak %ldMB, %.0f%% parallel efficiency)#[normal]\n",
+        bake_report_proc_count, wall, user, sys, max_rss / 1024,
+        efficiency * 100);
+
+    /* The detailed report is only shown in verbose mode */
+    if (!ut_log_enabled(UT_OK)) {
+        return;
+    }
+
+    ut_ok("#[bold]slowest");
+    for (i = 0; i < bake_report_proc_count && i < BAKE_REPORT_TOP_SLOWEST; i++){
+        bake_report_proc *proc = &bake_report_procs[i];
+        ut_ok("  %7.2fs  %s #[grey]%s",
+            proc->usage.wall, bake_report_proc_name(proc), proc->project);
+    }
+
+    /* Sort a copy by memory usage, so procs remain sorted by wall time */
+    size_t size = bake_report_proc_count * sizeof(bake_report_proc);
+    bake_report_proc *by_rss = malloc(size);
+    memcpy(by_rss, bake_report_procs, size);
+    qsort(by_rss, bake_report_proc_count, sizeof(bake_report_proc),
+        bake_report_compare_rss);
+
+    ut_ok("#[bold]peak memory");
+    for (i = 0; i < bake_report_proc_count && i < BAKE_REPORT_TOP_MEMORY; i++){
+        bake_report_proc *proc = &by_rss[i];
+        ut_ok("  %6ldKB  %s #[grey]%s",
+            proc->usage.max_rss, bake_report_proc_name(proc), proc->project);
+    }
+
+    free(by_rss);
+
+    ut_ok("#[bold]per project");
+    for (i = 0; i < bake_report_project_count; i ++) {
+        bake_report_project *p = &bake_report_projects[i];
+        ut_ok("  %7.2fs  %s #[grey](%u processes, user %.2fs, sys %.2fs)",
+            p->wall, p->id, p->count, p->user, p->sys);
+    }
+}
+
+int16_t bake_report_end(
+    const char *path,
+    const char *action)
+{
+    struct timespec now;
+    uint32_t i;
+    int16_t result = 0;
+
+    timespec_gettime(&now);
+    double wall = timespec_toDouble(timespec_sub(now, bake_report_start));
+
+    /* Nothing interesting to report if no processes were spawned */
+    if (bake_report_proc_count) {
+        double proc_wall = 0;
+        for (i = 0; i < bake_report_proc_count; i ++) {
+            proc_wall += bake_report_procs[i].usage.wall;
+        }
+
+        double efficiency = 0;
+        if (wall > 0) {
+            efficiency = proc_wall / (wall * bake_report_slots);
+        }
+
+        qsort(bake_report_procs, bake_report_proc_count,
+            sizeof(bake_report_proc), bake_report_compare_wall);
+
+        bake_report_print(wall, efficiency);
+
+        /* Store durations, so the next build can better estimate the
+         * critical path */
+        for (i = 0; i < bake_report_proc_count; i ++) {
+            bake_report_proc *proc = &bake_report_procs[i];
+            if (proc->unit) {
+                bake_history_set_unit(proc->project, proc->unit,
+                    proc->usage.wall, proc->usage.max_rss);
+            }
+        }
+
+        for (i = 0; i < bake_report_project_count; i ++) {
+            bake_report_project *p = &bake_report_projects[i];
+            if (p->count) {
+                bake_history_set_project(p->id, p->wall);
+            }
+        }
+
+        result = bake_report_write(path, action, wall, efficiency);
+    }
+
+    for (i = 0; i < bake_report_proc_count; i ++) {
+        free(bake_report_procs[i].unit);
+        free(bake_report_procs[i].cmd);
+    }
+
+    free(bake_report_procs);
+    free(bake_report_projects);
+    bake_report_procs = NULL;
+    bake_report_projects = NULL;
+    bake_report_proc_count = bake_report_proc_size = 0;
+    bake_report_project_count = bake_report_project_size = 0;
+    ut_mutex_free(&bake_report_lock);
+
+    return result;
+}
@@ -21,6 +21,10 @@
 
 #include "bake.h"
 
+extern ut_tls BAKE_DRIVER_KEY;
+extern ut_tls BAKE_PROJECT_KEY;
+extern ut_tls BAKE_UNIT_KEY;
+
 bake_node* bake_node_find(
     bake_driver *driver,
     const char *name)
@@ -105,6 +109,38 @@ error:
     return -1;
 }
 
+/* Return directory a pattern starts with (like "dir" for a pattern that
+ * matches the .c files in dir), or NULL if the pattern applies to the project
+ * directory */
+static
+char* bake_pattern_dir(
+    const char *pattern)
+{
+    const char *sep = strrchr(pattern, '/');
+    if (!sep || sep == pattern || pattern[0] == '/') {
+        return NULL;
+    }
+
+    /* Only a directory without wildcards or operators is a prefix */
+    if (strcspn(pattern, "*?|^(,") < (size_t)(sep - pattern)) {
+        return NULL;
+    }
+
+    return ut_asprintf("%.*s", (int)(sep - pattern), pattern);
+}
+
+/* Filelists created while evaluating rules are released with the project */
+static
+bake_filelist* bake_node_filelist_new(
+    bake_project *p,
+    const char *pattern)
+{
+    return ut_arena_own(
+        p->arena,
+        bake_filelist_new(p->path, pattern),
+        (ut_arena_free_cb)bake_filelist_free);
+}
+
 static
 bake_filelist* bake_node_eval_pattern(
     bake_node *n,
@@ -114,7 +150,7 @@ bake_filelist* bake_node_eval_pattern(
     bake_filelist *targets = NULL;
 
     if (n->name && !stricmp(n->name, "SOURCES")) {
-        targets = bake_filelist_new(p->path, NULL); /* Create empty list */
+        targets = bake_node_filelist_new(p, NULL); /* Create empty list */
         isSources = true;
 
         /* If this is the special SOURCES rule, apply the pattern to
@@ -130,8 +166,28 @@ bake_filelist* bake_node_eval_pattern(
 
         }
     } else if (((bake_pattern*)n)->pattern) {
-        /* If this is a regular pattern, match against project directory */
-        targets = bake_filelist_new(p->path, ((bake_pattern*)n)->pattern);
+        const char *pattern = ((bake_pattern*)n)->pattern;
+        char *dir = bake_pattern_dir(pattern);
+
+        if (dir) {
+            /* If pattern starts with a directory, only match files in that
+             * directory. The directory may not exist yet (for example when it
+             * is generated by the driver), which means no files match. */
+            targets = bake_node_filelist_new(p, NULL);
+            char *path = ut_asprintf("%s/%s", p->path, dir);
+            if (targets && ut_file_test(path) == 1) {
+                if (bake_filelist_add_pattern(
+                    targets, dir, &pattern[strlen(dir) + 1]))
+                {
+                    targets = NULL;
+                }
+            }
+            free(path);
+            free(dir);
+        } else {
+            /* If this is a regular pattern, match against project directory */
+            targets = bake_node_filelist_new(p, pattern);
+        }
     }
 
     if (!targets) {
@@ -143,6 +199,331 @@ error:
     return NULL;
 }
 
+/* Strip a leading "./" from a path */
+static
+const char* bake_node_skip_dot(
+    const char *path)
+{
+    while (path[0] == '.' && path[1] == '/') {
+        path += 2;
+    }
+    return path;
+}
+
+/* Name of a unit (object, link) relative to the project, so that it does not
+ * depend on the directory from which bake was invoked. */
+static
+const char* bake_node_unit(
+    bake_project *p,
+    const char *file)
+{
+    const char *unit = bake_node_skip_dot(file);
+    if (p->path) {
+        const char *path = bake_node_skip_dot(p->path);
+        size_t len = strlen(path);
+        if (len && !strncmp(unit, path, len) && unit[len] == '/') {
+            unit += len + 1;
+        }
+    }
+    return unit;
+}
+
+/* Estimate the peak memory usage of a unit. A project can specify how much
+ * memory (in MB) its jobs use with the memory_per_job attribute, otherwise
+ * the estimate is taken from previous builds. */
+static
+void bake_node_estimate(
+    bake_driver *driver,
+    bake_project *p,
+    const char *unit,
+    double *duration,
+    long *memory)
+{
+    *duration = 0;
+    *memory = 0;
+
+    if (bake_history_get_unit(p->id, unit, duration, memory)) {
+        /* Unknown units are assumed to be as large as the largest known unit
+         * of the project, which is safer than assuming they are cheap */
+        *memory = bake_history_get_peak_memory(p->id);
+    }
+
+    bake_attr *attr = bake_project_get_attr(p, driver->id, "memory_per_job");
+    if (attr && attr->kind == BAKE_NUMBER) {
+        *memory = attr->is.number * 1024;
+    }
+}
+
+/* A command that failed or was killed can leave a partially written target,
+ * with a timestamp that makes it look up to date in the next build. This uses
+ * remove instead of ut_rm, as logging would report the pending error early. */
+static
+void bake_node_remove_target(
+    const char *target)
+{
+    if (target) {
+        remove(target);
+    }
+}
+
+/* Run the action of a rule for a single unit, admitted by the job slots and
+ * memory budget shared by all projects. */
+static
+void bake_node_run_action(
+    bake_project *p,
+    bake_config *c,
+    bake_rule *r,
+    bake_job *job,
+    const char *unit,
+    char *source,
+    char *target)
+{
+    if (bake_jobs_acquire(job)) {
+        ut_throw("build cancelled");
+        p->error = true;
+        return;
+    }
+
+    ut_tls_set(BAKE_UNIT_KEY, (void*)unit);
+    r->action(&bake_driver_api_impl, c, p, source, target);
+    ut_tls_set(BAKE_UNIT_KEY, NULL);
+
+    bake_jobs_release(job);
+
+    if (p->error) {
+        bake_node_remove_target(target);
+    }
+}
+
+/* Outdated file of a map rule */
+typedef struct bake_rule_job {
+    bake_job job;           /* Must be first member */
+    bake_file *src;
+    bake_file *dst;
+    char *srcPath;
+    const char *unit;
+    double duration;        /* Estimated duration, longest jobs start first */
+    struct bake_rule_job *next; /* Next job in batch (batch rules only) */
+    int batch_size;         /* Number of jobs in batch, starting from this */
+} bake_rule_job;
+
+/* Map rule that is being run by one or more threads */
+typedef struct bake_rule_run {
+    bake_driver *driver;
+    bake_project *p;
+    bake_config *c;
+    bake_rule *r;
+    ut_ll jobs;             /* Jobs that have not been started yet */
+    int started;            /* Number of inputs up to date or started */
+    int total;              /* Total number of inputs */
+    const char *failed;     /* Name of first file that failed */
+} bake_rule_run;
+
+/* Run the action of a batch rule for all jobs in a batch. The unit of a
+ * process that builds multiple files is unknown, so it is not recorded. */
+static
+void bake_node_run_batch_action(
+    bake_rule_run *run,
+    bake_rule_job *job)
+{
+    char **sources = malloc(job->batch_size * sizeof(char*));
+    char **targets = malloc(job->batch_size * sizeof(char*));
+    bake_rule_job *j;
+    int i = 0;
+
+    for (j = job; j; j = j->next) {
+        sources[i] = j->srcPath;
+        targets[i] = j->dst->file_path;
+        i ++;
+    }
+
+    ut_tls_set(BAKE_UNIT_KEY, job->batch_size == 1 ? (void*)job->unit : NULL);
+    run->r->batch(
+        &bake_driver_api_impl, run->c, run->p, job->batch_size,
+        sources, targets);
+    ut_tls_set(BAKE_UNIT_KEY, NULL);
+
+    free(sources);
+    free(targets);
+}
+
+static
+void bake_node_run_map_jobs(
+    bake_rule_run *run)
+{
+    bake_project *p = run->p;
+    bake_rule_job *job, *j;
+
+    while (!p->error && (job = (bake_rule_job*)bake_jobs_take(run->jobs))) {
+        for (j = job; j; j = j->next) {
+            int count = ut_ainc(&run->started);
+            ut_ok("#[green][#[white]%3lld%%#[green]]#[white] %s",
+                100 * count / run->total,
+                j->src->name);
+            ut_log_status(
+                "#[green][#[white]%3lld%%#[green]]#[white] %s #[grey]%s",
+                100 * count / run->total,
+                j->src->name, p->id);
+        }
+
+        if (run->r->batch) {
+            bake_node_run_batch_action(run, job);
+        } else {
+            ut_tls_set(BAKE_UNIT_KEY, (void*)job->unit);
+            run->r->action(
+                &bake_driver_api_impl, run->c, p, job->srcPath,
+                job->dst->file_path);
+            ut_tls_set(BAKE_UNIT_KEY, NULL);
+        }
+
+        bake_jobs_release(&job->job);
+
+        if (p->error) {
+            /* The file of a batch that failed is reported by the action */
+            if (!run->failed && job->batch_size <= 1) {
+                run->failed = job->src->name;
+            }
+            /* The job of this thread failed if it raised an exception */
+            if (ut_raised()) {
+                for (j = job; j; j = j->next) {
+                    bake_node_remove_target(j->dst->file_path);
+                }
+            }
+        } else {
+            /* Update targets with latest timestamp */
+            for (j = job; j; j = j->next) {
+                if (ut_file_test(j->dst->name) == 1) {
+                    j->dst->timestamp = ut_lastmodified(j->dst->name);
+                } else {
+                    j->dst->timestamp = 0;
+                }
+            }
+        }
+    }
+}
+
+static
+void* bake_node_map_worker(
+    void *arg)
+{
+    bake_rule_run *run = arg;
+
+    /* Driver callbacks find their context in thread specific storage */
+    ut_tls_set(BAKE_DRIVER_KEY, run->driver);
+    ut_tls_set(BAKE_PROJECT_KEY, run->p);
+
+    /* Keep output of compiler together with its errors */
+    ut_log_job_begin();
+    bake_node_run_map_jobs(run);
+    if (run->p->error) {
+        /* Don't report jobs that failed because the build was cancelled */
+        if (bake_jobs_cancelled()) {
+            ut_catch();
+        } else {
+            ut_raise();
+        }
+    }
+    ut_log_job_end();
+
+    return NULL;
+}
+
+static
+int compare_job_duration(
+    const void *o1,
+    const void *o2)
+{
+    const bake_rule_job *j1 = *(bake_rule_job**)o1, *j2 = *(bake_rule_job**)o2;
+    return (j1->duration < j2->duration) - (j1->duration > j2->duration);
+}
+
+static
+void bake_node_free_jobs(
+    ut_ll jobs)
+{
+    ut_iter it = ut_ll_iter(jobs);
+    while (ut_iter_hasNext(&it)) {
+        bake_rule_job *job = ut_iter_next(&it);
+        if (job->srcPath != job->src->name) {
+            free(job->srcPath);
+        }
+        free(job);
+    }
+    ut_ll_free(jobs);
+}
+
+/* Compare batches by estimated duration. Files without build history have no
+ * estimate, in which case batches are compared by number of files. */
+static
+int bake_node_compare_batch(
+    bake_rule_job *b1,
+    bake_rule_job *b2)
+{
+    if (b1->duration != b2->duration) {
+        return b1->duration < b2->duration ? -1 : 1;
+    }
+    return b1->batch_size - b2->batch_size;
+}
+
+/* Divide the outdated files of a batch rule over one batch per thread. Jobs
+ * are sorted by duration, and each job is added to the batch with the lowest
+ * estimated duration, so batches take about as long. */
+static
+void bake_node_batch_jobs(
+    ut_ll jobs,
+    bake_rule_job **sorted,
+    uint32_t count,
+    uint32_t batch_count)
+{
+    bake_rule_job **batches, **last;
+    uint32_t i, b;
+
+    if (batch_count > count) {
+        batch_count = count;
+    }
+
+    batches = calloc(batch_count, sizeof(bake_rule_job*));
+    last = calloc(batch_count, sizeof(bake_rule_job*));
+
+    for (i = 0; i < count; i ++) {
+        bake_rule_job *job = sorted[i];
+        uint32_t shortest = 0;
+        for (b = 0; b < batch_count; b ++) {
+            if (!batches[b]) {
+                shortest = b;
+                break;
+            }
+            if (bake_node_compare_batch(batches[b], batches[shortest]) < 0) {
+                shortest = b;
+            }
+        }
+
+        if (!batches[shortest]) {
+            batches[shortest] = job;
+            job->batch_size = 1;
+        } else {
+            /* First job of batch holds estimates for the whole batch. A batch
+             * runs a single process at a time, so its memory usage is the
+             * largest of its jobs. */
+            bake_rule_job *first = batches[shortest];
+            first->duration += job->duration;
+            if (job->job.memory > first->job.memory) {
+                first->job.memory = job->job.memory;
+            }
+            first->batch_size ++;
+            last[shortest]->next = job;
+        }
+        last[shortest] = job;
+    }
+
+    for (b = 0; b < batch_count; b ++) {
+        ut_ll_append(jobs, batches[b]);
+    }
+
+    free(batches);
+    free(last);
+}
+
 static
 int16_t bake_node_run_rule_map(
     bake_driver *driver,
@@ -152,64 +533,123 @@ int16_t bake_node_run_rule_map(
     bake_filelist *inputs,
     bake_filelist *targets)
 {
+    bake_rule_run run = {
+        .driver = driver,
+        .p = p,
+        .c = c,
+        .r = r,
+        .jobs = ut_ll_new(),
+        .total = bake_filelist_count(inputs)
+    };
+    ut_ll all_jobs = ut_ll_new();
+
+    /* Find outdated files */
     ut_iter it = bake_filelist_iter(inputs);
     int count = 0;
     while (ut_iter_hasNext(&it)) {
         bake_file *src = ut_iter_next(&it);
         bake_file *dst = NULL;
-        const char *map = r->target.is.map(&bake_driver_api_impl, c, p, src->name);
+        char *map = r->target.is.map(&bake_driver_api_impl, c, p, src->name);
         if (!map) {
             ut_throw("failed to map file '%s'", src->name);
             goto error;
         }
-        if (!(dst = bake_filelist_add_file(targets, map))) {
+        dst = bake_filelist_add_file(targets, map);
+        free(map);
+        if (!dst) {
             ut_throw(NULL);
             goto error;
         }
 
         count ++;
         if (src->timestamp > dst->timestamp) {
-            ut_log_overwrite(UT_OK, "#[green][#[white]%lld%%#[green]]#[white] %s",
-                100 * count / bake_filelist_count(inputs),
-                src->name);
-
             /* Make sure target directory exists */
             ut_try (bake_assertPathForFile(dst->path), NULL);
 
-            /* Invoke action */
-            char *srcPath = src->name;
+            bake_rule_job *job = ut_calloc(sizeof(bake_rule_job));
+            job->src = src;
+            job->dst = dst;
+            job->srcPath = src->name;
             if (src->path) {
-                srcPath = ut_asprintf("%s/%s", src->path, src->name);
+                job->srcPath = ut_asprintf("%s/%s", src->path, src->name);
             }
-            r->action(&bake_driver_api_impl, c, p, srcPath, dst->file_path);
-            if (srcPath != src->name) {
-                free(srcPath);
+            job->unit = bake_node_unit(p, job->srcPath);
+            bake_node_estimate(
+                driver, p, job->unit, &job->duration, &job->job.memory);
+            ut_ll_append(all_jobs, job);
+        } else {
+            ut_trace("#[grey][%3lld%%] %s",
+                100 * count / bake_filelist_count(inputs),
+                src->name);
+            run.started ++;
+        }
+    }
+
+    if (ut_ll_count(all_jobs)) {
+        uint32_t i, threads = c->jobs ? c->jobs : 1;
+        ut_thread *workers = NULL;
+
+        /* Start the longest jobs first, so they don't end up at the tail */
+        uint32_t job_count = ut_ll_count(all_jobs);
+        bake_rule_job **sorted = malloc(job_count * sizeof(bake_rule_job*));
+        for (i = 0; i < job_count; i ++) {
+            sorted[i] = ut_ll_get(all_jobs, i);
+        }
+        qsort(sorted, job_count, sizeof(bake_rule_job*), compare_job_duration);
+        if (r->batch) {
+            bake_node_batch_jobs(run.jobs, sorted, job_count, threads);
+        } else {
+            for (i = 0; i < job_count; i ++) {
+                ut_ll_append(run.jobs, sorted[i]);
             }
+        }
+        free(sorted);
 
-            /* Check if error flag was set */
-            if (p->error) {
-                ut_throw("command for task '%s' failed", src->name);
-                goto error;
-            } else {
-                p->freshly_baked = true;
-                p->changed = true;
+        /* The calling thread runs jobs as well */
+        if (threads > ut_ll_count(run.jobs)) {
+            threads = ut_ll_count(run.jobs);
+        }
+        if (threads > 1) {
+            workers = malloc((threads - 1) * sizeof(ut_thread));
+            for (i = 0; i < threads - 1; i ++) {
+                workers[i] = ut_thread_new(bake_node_map_worker, &run);
+            }
+        }
+
+        bake_node_run_map_jobs(&run);
+
+        if (workers) {
+            for (i = 0; i < threads - 1; i ++) {
+                ut_thread_join(workers[i], NULL);
             }
+            free(workers);
+        }
 
-            /* Update target with latest timestamp */
-            if (ut_file_test(dst->name) == 1) {
-                dst->timestamp = ut_lastmodified(dst->name);
+        /* Check if error flag was set */
+        if (p->error) {
+            if (run.failed) {
+                ut_throw("command for task '%s' failed", run.failed);
             } else {
-                dst->timestamp = 0;
+                ut_throw("command for rule '%s' failed", r->super.name);
             }
+            goto error;
+        } else if (bake_jobs_cancelled()) {
+            p->error = true;
+            ut_throw("build cancelled");
+            goto error;
         } else {
-            ut_trace("#[grey][%3lld%%] %s",
-                100 * count / bake_filelist_count(inputs),
-                src->name);
+            p->freshly_baked = true;
+            p->changed = true;
         }
     }
 
+    bake_node_free_jobs(all_jobs);
+    ut_ll_free(run.jobs);
+
     return 0;
 error:
+    bake_node_free_jobs(all_jobs);
+    ut_ll_free(run.jobs);
     return -1;
 }
 
@@ -283,7 +723,16 @@ int16_t bake_node_run_rule_pattern(
             ut_ok("from #[bold]%s#[normal]", source_list_str);
         }
 
-        r->action(&bake_driver_api_impl, c, p, source_list_str, dst);
+        bake_job job = {0};
+        const char *unit = NULL;
+        if (dst) {
+            double duration;
+            unit = bake_node_unit(p, dst);
+            bake_node_estimate(driver, p, unit, &duration, &job.memory);
+        }
+
+        bake_node_run_action(p, c, r, &job, unit, source_list_str, dst);
+
         if (p->error) {
             if (dst) {
                 ut_throw("command for task '%s' failed", dst);
@@ -335,7 +784,7 @@ int16_t bake_node_eval(
 
     /* Collect input files for node */
     if (n->deps) {
-        bake_filelist *inputs = bake_filelist_new(p->path, NULL);
+        bake_filelist *inputs = bake_node_filelist_new(p, NULL);
         ut_try (!inputs, NULL);
 
         /* Evaluate dependencies of node & collect its inputs */
@@ -354,7 +803,7 @@ int16_t bake_node_eval(
 
             /* When rule specifies a map, generate targets from inputs */
             if (r->target.kind == BAKE_RULE_TARGET_MAP) {
-                targets = bake_filelist_new(p->path, NULL);
+                targets = bake_node_filelist_new(p, NULL);
                 ut_try (!targets, NULL);
                 ut_try (
                     bake_node_run_rule_map(driver, p, c, r, inputs, targets),
@@ -368,9 +817,10 @@ int16_t bake_node_eval(
                     targets = inherits;
                 } else {
                     char *pattern = ut_strdup(r->target.is.pattern);
-                    targets = bake_filelist_new(p->path, NULL);
+                    targets = bake_node_filelist_new(p, NULL);
 
-                    char *tok = strtok(pattern, ",");
+                    char *save = NULL;
+                    char *tok = strtok_r(pattern, ",", &save);
                     while (tok) {
                         bake_node *targetNode = bake_node_find(driver, &tok[1]);
                         if (!targetNode->cond || targetNode->cond(&bake_driver_api_impl, c, p)) {
@@ -382,12 +832,15 @@ int16_t bake_node_eval(
                                     tok,
                                     n->name);
                                 shouldBuild = true;
+                                if (list) {
+                                    bake_filelist_free(list);
+                                }
                             } else {
                                 bake_filelist_merge(targets, list);
                                 bake_filelist_free(list);
                             }
                         }
-                        tok = strtok(NULL, ",");
+                        tok = strtok_r(NULL, ",", &save);
                     }
                     free(pattern);
                 }
@@ -398,7 +851,7 @@ int16_t bake_node_eval(
                 }
 
                 if (!targets) {
-                    targets = bake_filelist_new(p->path, NULL);
+                    targets = bake_node_filelist_new(p, NULL);
                 }
 
                 ut_try (bake_node_run_rule_pattern(
@@ -118,7 +118,11 @@ int16_t bake_build_make_project(
 
     ut_log("...  build '%s'", id);
     fflush(stdout);
-    ut_try(cmd(strarg("make -C %s/build-%s clean all", path, UT_OS_STRING)),
+    /* Clean in a separate invocation, as make can run jobs from the jobserver
+     * of bake, and clean must not run in parallel with the build */
+    ut_try(cmd(strarg("make -C %s/build-%s clean", path, UT_OS_STRING)),
+      "failed to clean '%s'", id);
+    ut_try(cmd(strarg("make -C %s/build-%s all", path, UT_OS_STRING)),
       "failed to build '%s'", id);
     ut_log("#[green]OK#[reset]   build '%s'\n", id);
 
@@ -0,0 +1,155 @@
+/* Copyright (c) 2010-2018 Sander Mertens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Micro-benchmark that compares the compiled suffix matcher of ut_expr_compile
+ * with the default expression evaluator, on a set of synthetic paths.
+ *
+ * Build & run from the util directory (after building libbake_util):
+ *   cc -std=c99 -D_XOPEN_SOURCE=600 -O2 -I. bench/expr.c -L. -lbake_util -lm \
+ *      -o bench_expr && LD_LIBRARY_PATH=. ./bench_expr
+ */
+
+#include "include/util.h"
+
+#define PATH_COUNT (100000)
+#define ITERATIONS (10)
+
+static const char *dirs[] = {
+    "src", "include", "lib", "core", "io", "net", "test", ".git", "gen", "utils"
+};
+
+static const char *exts[] = {
+    ".c", ".cpp", ".cxx", ".h", ".hpp", ".o", ".txt", ".C", ".json", ".c.orig"
+};
+
+static
+char* bench_path(void)
+{
+    ut_strbuf buf = UT_STRBUF_INIT;
+    int i, depth = 1 + rand() % 6;
+
+    ut_strbuf_appendstr(&buf, "/home/user/project");
+    for (i = 0; i < depth; i ++) {
+        ut_strbuf_append(&buf, "/%s", dirs[rand() % 10]);
+    }
+
+    ut_strbuf_append(&buf, "/file_%d%s", rand() % 1000, exts[rand() % 10]);
+
+    return ut_strbuf_get(&buf);
+}
+
+static
+double bench_run(
+    ut_expr_program program,
+    char **paths,
+    bool *results)
+{
+    struct timespec start, stop;
+    int i, j;
+
+    timespec_gettime(&start);
+    for (j = 0; j < ITERATIONS; j ++) {
+        for (i = 0; i < PATH_COUNT; i ++) {
+            results[i] = ut_expr_run(program, paths[i]);
+        }
+    }
+    timespec_gettime(&stop);
+
+    return timespec_toDouble(timespec_sub(stop, start));
+}
+
+static
+int bench_pattern(
+    const char *pattern,
+    char **paths)
+{
+    struct ut_expr_program_s baseline;
+    bool *expected = malloc(PATH_COUNT * sizeof(bool));
+    bool *actual = malloc(PATH_COUNT * sizeof(bool));
+    int i, matched = 0, result = 0;
+
+    /* ut_exprParseIntern does not apply optimizations, like ut_expr */
+    if (ut_exprParseIntern(&baseline, pattern, true, true)) {
+        goto error;
+    }
+
+    ut_expr_program compiled = ut_expr_compile(pattern, true, true);
+    if (!compiled) {
+        goto error;
+    }
+
+    double t_baseline = bench_run(&baseline, paths, expected);
+    double t_compiled = bench_run(compiled, paths, actual);
+
+    for (i = 0; i < PATH_COUNT; i ++) {
+        if (expected[i] != actual[i]) {
+            printf("mismatch for '%s' on '%s' (expected %d)\n",
+                pattern, paths[i], expected[i]);
+            result = -1;
+        }
+        matched += actual[i];
+    }
+
+    printf("%-22s kind=%d matched=%6d  ut_expr %.3fs  compiled %.3fs  (%.1fx)\n",
+        pattern, compiled->kind, matched, t_baseline, t_compiled,
+        t_baseline / t_compiled);
+
+    free(baseline.tokens);
+    ut_expr_free(compiled);
+    free(expected);
+    free(actual);
+    return result;
+error:
+    ut_raise();
+    free(expected);
+    free(actual);
+    return -1;
+}
+
+int main(int argc, char *argv[]) {
+    char **paths = malloc(PATH_COUNT * sizeof(char*));
+    char **names = malloc(PATH_COUNT * sizeof(char*));
+    int i, result = 0;
+
+    ut_init(argv[0]);
+    srand(1);
+
+    for (i = 0; i < PATH_COUNT; i ++) {
+        paths[i] = bench_path();
+        names[i] = strrchr(paths[i], '/') + 1;
+    }
+
+    printf("matching %d paths, %d iterations\n", PATH_COUNT, ITERATIONS);
+
+    result |= bench_pattern("//*.c|*.cpp|*.cxx", paths);
+    result |= bench_pattern("*.c|*.cpp|*.cxx", names);
+    result |= bench_pattern("//*.h", paths);
+
+    for (i = 0; i < PATH_COUNT; i ++) {
+        free(paths[i]);
+    }
+    free(paths);
+    free(names);
+
+    ut_deinit();
+
+    return result;
+}
@@ -0,0 +1,69 @@
+/* Copyright (c) 2010-2018 Sander Mertens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Micro-benchmark for the cost of log statements at disabled levels, at the
+ * default verbosity (INFO). Arguments are built with strarg, like the trace
+ * statements in per-file loops of the build.
+ *
+ * Build & run from the util directory (after building libbake_util):
+ *   cc -std=c99 -D_XOPEN_SOURCE=600 -O2 -I. bench/log.c -L. -lbake_util -lm \
+ *      -o bench_log && LD_LIBRARY_PATH=. ./bench_log
+ *
+ * Add -DUT_LOG_MIN_LEVEL=UT_OK to compile the disabled statements out.
+ */
+
+#include "include/util.h"
+
+#define ITERATIONS (10000000)
+
+static int evaluated;
+
+static
+const char* bench_arg(
+    int i)
+{
+    evaluated ++;
+    return strarg("file_%d.c", i);
+}
+
+int main(int argc, char *argv[]) {
+    struct timespec start, stop;
+    int i;
+
+    ut_init(argv[0]);
+
+    timespec_gettime(&start);
+    for (i = 0; i < ITERATIONS; i ++) {
+        ut_trace("#[cyan]cp %s %s", bench_arg(i), "dst");
+        ut_debug("#[grey]%s (modified=%d)", bench_arg(i), i);
+    }
+    timespec_gettime(&stop);
+
+    double t = timespec_toDouble(timespec_sub(stop, start));
+
+    printf("%d disabled log statements: %.3fs (%.2f ns/call), "
+        "%d arguments evaluated\n",
+        2 * ITERATIONS, t, t * 1000000000.0 / (2 * ITERATIONS), evaluated);
+
+    ut_deinit();
+
+    return 0;
+}
@@ -0,0 +1,239 @@
+/* Copyright (c) 2010-2018 Sander Mertens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/** @file
+ * @section arena Region allocator.
+ * @brief Allocate objects with the same lifespan and release them at once.
+ *
+ * An arena hands out memory from large chunks by bumping a pointer. Memory is
+ * never released per object, instead all memory of an arena is released when
+ * the arena is freed. This makes allocations cheap, keeps objects that belong
+ * together close in memory, and makes it impossible to leak individual objects.
+ *
+ * Objects that are not allocated from the arena (like a parsed JSON document)
+ * can be tied to the lifespan of an arena with ut_arena_own.
+ */
+
+#ifndef UT_ARENA_H_
+#define UT_ARENA_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Default size of an arena chunk */
+#define UT_ARENA_CHUNK_SIZE (8192)
+
+typedef struct ut_arena ut_arena;
+
+/* Callback that releases an object owned by an arena */
+typedef void (*ut_arena_free_cb)(void *ptr);
+
+/** Create a new arena.
+ *
+ * @param chunk_size Size of chunks allocated by arena, 0 for default.
+ * @return New arena.
+ */
+UT_EXPORT
+ut_arena* ut_arena_new(
+    size_t chunk_size);
+
+/** Free arena.
+ * Releases objects owned by the arena in reverse order of registration, and
+ * then releases all memory allocated from the arena.
+ *
+ * @param arena The arena to free.
+ */
+UT_EXPORT
+void ut_arena_free(
+    ut_arena *arena);
+
+/** Allocate memory from arena.
+ * The returned memory is suitably aligned for any type.
+ *
+ * @param arena The arena.
+ * @param size Number of bytes to allocate.
+ * @return Pointer to allocated memory.
+ */
+UT_EXPORT
+void* ut_arena_alloc(
+    ut_arena *arena,
+    size_t size);
+
+/** Allocate zero-initialized memory from arena.
+ *
+ * @param arena The arena.
+ * @param size Number of bytes to allocate.
+ * @return Pointer to allocated memory.
+ */
+UT_EXPORT
+void* ut_arena_calloc(
+    ut_arena *arena,
+    size_t size);
+
+/** Duplicate string in arena.
+ *
+ * @param arena The arena.
+ * @param str The string to duplicate (may be NULL).
+ * @return Copy of string, or NULL if str is NULL.
+ */
+UT_EXPORT
+char* ut_arena_strdup(
+    ut_arena *arena,
+    const char *str);
+
+/** Create formatted string in arena.
+ *
+ * @param arena The arena.
+ * @param fmt Format string.
+ * @return Formatted string.
+ */
+UT_EXPORT
+char* ut_arena_asprintf(
+    ut_arena *arena,
+    const char *fmt,
+    ...);
+
+/** Same as ut_arena_asprintf, with argument list.
+ *
+ * @param arena The arena.
+ * @param fmt Format string.
+ * @param args Argument list.
+ * @return Formatted string.
+ */
+UT_EXPORT
+char* ut_arena_vasprintf(
+    ut_arena *arena,
+    const char *fmt,
+    va_list args);
+
+/** Release object when arena is freed.
+ *
+ * @param arena The arena.
+ * @param ptr The object (may be NULL).
+ * @param free_cb Function that releases the object.
+ * @return The object.
+ */
+UT_EXPORT
+void* ut_arena_own(
+    ut_arena *arena,
+    void *ptr,
+    ut_arena_free_cb free_cb);
+
+/** Return total number of bytes allocated by arena.
+ *
+ * @param arena The arena.
+ * @return Number of bytes in chunks allocated by arena.
+ */
+UT_EXPORT
+size_t ut_arena_size(
+    ut_arena *arena);
+
+
+/* -- Scratch arena -- */
+
+/* Default size of a scratch block */
+#define UT_SCRATCH_BLOCK_SIZE (16384)
+
+/* Position in the scratch arena of a thread, returned by ut_scratch_push */
+typedef struct ut_scratch_mark {
+    void *block;
+    size_t used;
+} ut_scratch_mark;
+
+/** Mark current position in the scratch arena of the calling thread.
+ * Every thread has a scratch arena for temporary values that only live until
+ * the end of a scope. Unlike strarg, values allocated from the scratch arena
+ * never alias each other. Memory is reused after ut_scratch_pop, so once the
+ * arena has grown to its working size, allocating does not call malloc.
+ *
+ *   ut_scratch_mark mark = ut_scratch_push();
+ *   ut_rm(ut_scratch_asprintf("%s/%s", path, file));
+ *   ut_scratch_pop(mark);
+ *
+ * @return Mark to pass to ut_scratch_pop.
+ */
+UT_EXPORT
+ut_scratch_mark ut_scratch_push(void);
+
+/** Free the scratch arena of a thread.
+ * Destructor of the thread-local key of the scratch arena, called when a
+ * thread exits. Not to be called by applications.
+ *
+ * @param data The scratch arena of the thread.
+ */
+UT_EXPORT
+void ut_scratch_free(
+    void *data);
+
+/** Release everything allocated from the scratch arena after a mark.
+ * Marks must be popped in reverse order in which they were pushed.
+ *
+ * @param mark Mark returned by ut_scratch_push.
+ */
+UT_EXPORT
+void ut_scratch_pop(
+    ut_scratch_mark mark);
+
+/** Allocate memory from the scratch arena.
+ *
+ * @param size Number of bytes to allocate.
+ * @return Pointer to allocated memory, valid until the mark is popped.
+ */
+UT_EXPORT
+void* ut_scratch_alloc(
+    size_t size);
+
+/** Duplicate string in the scratch arena.
+ *
+ * @param str The string to duplicate (may be NULL).
+ * @return Copy of string, or NULL if str is NULL.
+ */
+UT_EXPORT
+char* ut_scratch_strdup(
+    const char *str);
+
+/** Create formatted string in the scratch arena.
+ *
+ * @param fmt Format string.
+ * @return Formatted string, valid until the mark is popped.
+ */
+UT_EXPORT
+char* ut_scratch_asprintf(
+    const char *fmt,
+    ...);
+
+/** Same as ut_scratch_asprintf, with argument list.
+ *
+ * @param fmt Format string.
+ * @param args Argument list.
+ * @return Formatted string, valid until the mark is popped.
+ */
+UT_EXPORT
+char* ut_scratch_vasprintf(
+    const char *fmt,
+    va_list args);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
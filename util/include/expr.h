@@ -50,7 +50,8 @@ typedef struct ut_exprOp {
 } ut_exprOp;
 
 struct ut_expr_program_s {
-    int kind; /* 0 = default, 1 = identifier, 2 = this, 3 = /, 4 = // */
+    int kind; /* 0 = default, 1 = identifier, 2 = this, 3 = /, 4 = //,
+               * 5 = suffix list (*.c|*.h), 6 = suffix list preceded by // */
     ut_exprOp ops[UT_EXPR_MAX_OP];
     uint8_t size;
     char *tokens;
@@ -86,6 +86,78 @@ UT_EXPORT
 bool ut_dir_isEmpty(
     const char *name);
 
+/** Entry visited by ut_dir_walk.
+ * Members point to a buffer that is reused for every entry, and are only valid
+ * for the duration of the callback. */
+typedef struct ut_dir_entry {
+    const char *path;       /* Path of entry, prefixed with walked directory */
+    const char *relative;   /* Path of entry, relative to walked directory */
+    const char *name;       /* Name of entry */
+    int dirfd;              /* File descriptor of directory containing entry */
+    int depth;              /* Depth of entry (0 for entries in walked dir) */
+    bool is_dir;            /* Is entry a directory */
+} ut_dir_entry;
+
+/* Also visit files and directories that start with a '.' */
+#define UT_DIR_WALK_HIDDEN (1)
+
+/* Visit directories after their contents instead of before */
+#define UT_DIR_WALK_POST (2)
+
+/* Do not follow symbolic links to directories */
+#define UT_DIR_WALK_PHYS (4)
+
+/* Return from ut_dir_walk_cb to not walk into a directory */
+#define UT_DIR_WALK_SKIP (1)
+
+/** Callback for ut_dir_walk.
+ *
+ * @param entry The visited entry.
+ * @param ctx Context passed to ut_dir_walk.
+ * @return 0 to continue, UT_DIR_WALK_SKIP to skip directory, -1 to abort.
+ */
+typedef int (*ut_dir_walk_cb)(
+    ut_dir_entry *entry,
+    void *ctx);
+
+/** Recursively walk the contents of a directory.
+ * Directories are opened relative to their parent directory, and the type of
+ * an entry is obtained from the directory itself where the filesystem supports
+ * it, so walking a tree does not require a stat or allocation per file.
+ *
+ * @param name The name of the directory to walk.
+ * @param flags Combination of UT_DIR_WALK_* flags.
+ * @param action Callback invoked for every entry.
+ * @param ctx Context passed to callback.
+ * @return 0 if success, non-zero if failed or aborted by callback.
+ */
+UT_EXPORT
+int16_t ut_dir_walk(
+    const char *name,
+    int flags,
+    ut_dir_walk_cb action,
+    void *ctx);
+
+/** Get last modified date for entry visited by ut_dir_walk.
+ *
+ * @param entry The entry.
+ * @return The last modified time, or -1 if failed.
+ */
+UT_EXPORT
+time_t ut_dir_entry_lastmodified(
+    ut_dir_entry *entry);
+
+/** Test if a file exists in a directory entry visited by ut_dir_walk.
+ *
+ * @param entry A directory entry.
+ * @param file The file to test for.
+ * @return true if file exists, false if it does not.
+ */
+UT_EXPORT
+bool ut_dir_entry_test(
+    ut_dir_entry *entry,
+    const char *file);
+
 /** Type holding a stack for usage with ut_dir_push / ut_dir_pop */
 typedef void* ut_dirstack;
 
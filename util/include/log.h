@@ -570,6 +570,90 @@ void ut_log(char *str, ...);
 UT_EXPORT
 void ut_log_tail(char *str, ...);
 
+/* -- Job output & status line -- */
+
+/** Start buffering log output of the current thread.
+ * Messages logged by the thread and the output of processes it starts with
+ * ut_proc_cmd are collected in a per-thread buffer, which is written to the
+ * console in one piece by ut_log_job_end. This keeps output of jobs that run
+ * in parallel from interleaving.
+ */
+UT_EXPORT
+void ut_log_job_begin(void);
+
+/** Flush output buffered since ut_log_job_begin and stop buffering. */
+UT_EXPORT
+void ut_log_job_end(void);
+
+/** Test whether the current thread is buffering output.
+ * @return true if ut_log_job_begin was called without ut_log_job_end.
+ */
+UT_EXPORT
+bool ut_log_job_active(void);
+
+/** Add output to the buffer of the current job.
+ * If no job is active, output is written to the console directly.
+ *
+ * @param str Output to add.
+ * @param len Number of characters to add.
+ */
+UT_EXPORT
+void ut_log_job_write(
+    const char *str,
+    size_t len);
+
+/* -- Trace events -- */
+
+/** Start recording trace events.
+ * When enabled, every ut_log_push/ut_log_pop pair and every span started with
+ * ut_log_trace_begin is recorded as a complete event, tagged with the thread
+ * that recorded it. Events are written by ut_log_trace_write in the trace
+ * event format, which can be loaded in chrome://tracing or Perfetto.
+ */
+UT_EXPORT
+void ut_log_trace_enable(void);
+
+/** Begin a trace span in the current thread.
+ * Does nothing when tracing is not enabled.
+ *
+ * @param category Category of the span (not copied, must be a literal).
+ * @param name Name of the span.
+ * @param detail Optional detail, shown in the arguments of the event.
+ */
+UT_EXPORT
+void ut_log_trace_begin(
+    const char *category,
+    const char *name,
+    const char *detail);
+
+/** End the last span started with ut_log_trace_begin in the current thread. */
+UT_EXPORT
+void ut_log_trace_end(void);
+
+/** Write recorded trace events to a file.
+ * Categories and spans of the calling thread that are still open are closed
+ * at the current time.
+ *
+ * @param file Path of the file to write.
+ * @return 0 if success, non-zero if failed.
+ */
+UT_EXPORT
+int16_t ut_log_trace_write(
+    const char *file);
+
+/** Set text of the status line.
+ * The status line is shown below regular log output when the verbosity is
+ * INFO or lower and stderr is a terminal. Setting the status is cheap: a
+ * renderer thread redraws it at most 10 times per second. Pass NULL to remove
+ * the status line.
+ *
+ * @param fmt printf-style format string, or NULL.
+ */
+UT_EXPORT
+void ut_log_status(
+    const char *fmt,
+    ...);
+
 int16_t ut_log_init(void);
 
 void ut_log_deinit();
@@ -579,9 +663,38 @@ void ut_log_deinit();
 #define ut_critical(...) _ut_critical(__FILE__, __LINE__, UT_FUNCTION, __VA_ARGS__)
 #define ut_critical_fl(file, line, ...) _ut_critical(file, line, UT_FUNCTION, __VA_ARGS__)
 
-#define _SHOULD_PRINT(lvl)\
-    ut_log_handlersRegistered() ||\
-    ut_log_verbosityGet() <= lvl
+/* Compile-time minimum log level. Calls to ut_debug, ut_trace, ut_ok and
+ * ut_info below this level are compiled out, including their arguments. Set
+ * with -DUT_LOG_MIN_LEVEL=<level> to strip tracing from release builds. */
+#ifndef UT_LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define UT_LOG_MIN_LEVEL UT_WARNING
+#else
+#define UT_LOG_MIN_LEVEL UT_DEBUG
+#endif
+#endif
+
+/* Lowest level that is printed or forwarded to a log handler. Cached by
+ * ut_log_verbositySet and when handlers are (un)registered (internal usage). */
+UT_EXPORT extern int8_t UT_LOG_THRESHOLD;
+
+/* Number of threads with exceptions that have not been caught (internal
+ * usage). */
+UT_EXPORT extern int UT_LOG_PENDING;
+
+/* Test whether a log level is enabled. When it is not, the message arguments
+ * are not evaluated. */
+#define ut_log_enabled(lvl)\
+    ((lvl) >= UT_LOG_MIN_LEVEL && (lvl) >= UT_LOG_THRESHOLD)
+
+#define _ut_log_gated(lvl, call)\
+    do {\
+        if (ut_log_enabled(lvl)) {\
+            call;\
+        } else if (UT_LOG_PENDING) {\
+            __ut_raise_check();\
+        }\
+    } while (0)
 
 #define ut_throw(...) _ut_throw(__FILE__, __LINE__, UT_FUNCTION, __VA_ARGS__)
 #define ut_throw_fallback(...) _ut_throw_fallback(__FILE__, __LINE__, UT_FUNCTION, __VA_ARGS__)
@@ -595,23 +708,16 @@ void ut_log_deinit();
 #define ut_warning_fl(f, l, ...) _ut_warning(f, l, UT_FUNCTION, __VA_ARGS__)
 #ifndef NDEBUG
 #define ut_assert(condition, ...) if (!(condition)) {_ut_assert(__FILE__, __LINE__, UT_FUNCTION, "(" #condition ") " __VA_ARGS__);}
-#define ut_debug(...) if(_SHOULD_PRINT(UT_DEBUG)) { _ut_debug(__FILE__, __LINE__, UT_FUNCTION, __VA_ARGS__);} else { __ut_raise_check(); }
-#define ut_trace(...) if(_SHOULD_PRINT(UT_TRACE)) { _ut_trace(__FILE__, __LINE__, UT_FUNCTION, __VA_ARGS__);} else { __ut_raise_check(); }
-#define ut_info(...) if(_SHOULD_PRINT(UT_INFO)) { _ut_info(__FILE__, __LINE__, UT_FUNCTION, __VA_ARGS__);} else { __ut_raise_check(); }
-#define ut_ok(...) if(_SHOULD_PRINT(UT_OK)) { _ut_ok(__FILE__, __LINE__, UT_FUNCTION, __VA_ARGS__);} else { __ut_raise_check(); }
-#define ut_log_overwrite(...) _ut_log_overwrite(__FILE__, __LINE__, UT_FUNCTION, __VA_ARGS__);
-#define ut_log_push_dbg(category) if(_SHOULD_PRINT(UT_TRACE)) {_ut_log_push(__FILE__, __LINE__, UT_FUNCTION, category);}
-#define ut_log_pop_dbg() if(_SHOULD_PRINT(UT_TRACE)) {_ut_log_pop(__FILE__, __LINE__, UT_FUNCTION);}
 #else
 #define ut_assert(condition, ...) (void)(condition)
-#define ut_debug(...)
-#define ut_trace(...)
-#define ut_info(...)
-#define ut_ok(...)
-#define ut_log_push_dbg(...)
-#define ut_log_pop_dbg(...)
-
 #endif
+#define ut_debug(...) _ut_log_gated(UT_DEBUG, _ut_debug(__FILE__, __LINE__, UT_FUNCTION, __VA_ARGS__))
+#define ut_trace(...) _ut_log_gated(UT_TRACE, _ut_trace(__FILE__, __LINE__, UT_FUNCTION, __VA_ARGS__))
+#define ut_info(...) _ut_log_gated(UT_INFO, _ut_info(__FILE__, __LINE__, UT_FUNCTION, __VA_ARGS__))
+#define ut_ok(...) _ut_log_gated(UT_OK, _ut_ok(__FILE__, __LINE__, UT_FUNCTION, __VA_ARGS__))
+#define ut_log_overwrite(...) _ut_log_overwrite(__FILE__, __LINE__, UT_FUNCTION, __VA_ARGS__);
+#define ut_log_push_dbg(category) if (ut_log_enabled(UT_TRACE)) {_ut_log_push(__FILE__, __LINE__, UT_FUNCTION, category);}
+#define ut_log_pop_dbg() if (ut_log_enabled(UT_TRACE)) {_ut_log_pop(__FILE__, __LINE__, UT_FUNCTION);}
 
 #ifdef __cplusplus
 }
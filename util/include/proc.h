@@ -46,6 +46,14 @@ typedef enum ut_procsignal {
     UT_SIGTERM = 15
 } ut_procsignal;
 
+/** Resources used by a process */
+typedef struct ut_proc_usage {
+    double wall;            /* Wall clock time (seconds) */
+    double user;            /* User CPU time (seconds) */
+    double sys;             /* System CPU time (seconds) */
+    long max_rss;           /* Peak resident set size (KB) */
+} ut_proc_usage;
+
 /** Run a process.
  * Use ut_proc_wait/ut_prochcheck with the returned handle to check if the
  * child process has exited.
@@ -89,6 +97,18 @@ int ut_proc_kill(
     ut_proc pid,
     ut_procsignal sig);
 
+/** Send signal to all processes that have been started and not waited for.
+ * Processes that run as part of a job are started in their own process group,
+ * in which case the signal is sent to the whole group so that processes
+ * started by the child (like the compilers started by make) are signalled too.
+ * This function is safe to call from a signal handler.
+ *
+ * @param sig Signal to send to processes.
+ */
+UT_EXPORT
+void ut_proc_kill_all(
+    ut_procsignal sig);
+
 /** Wait for process to exit (blocking).
  *
  * @param pid Process handle.
@@ -100,6 +120,20 @@ int ut_proc_wait(
     ut_proc pid,
     int8_t *rc);
 
+/** Wait for process to exit (blocking) and collect its resource usage.
+ * Sets the CPU time and peak memory usage of usage, but not the wall time.
+ *
+ * @param pid Process handle.
+ * @param rc Value returned by process.
+ * @param usage Resource usage of process (may be NULL).
+ * @return 0 if success, -1 if function failed, otherwise the signal raised by the process during exit.
+ */
+UT_EXPORT
+int ut_proc_wait_usage(
+    ut_proc pid,
+    int8_t *rc,
+    ut_proc_usage *usage);
+
 /** Check if process is still alive.
  *
  * @param pid Process handle.
@@ -123,6 +157,36 @@ int ut_proc_cmd(
     char *cmd,
     int8_t *rc);
 
+/** Run a process (blocking) and collect its resource usage.
+ *
+ * @param cmd Command to run.
+ * @param rc Value returned by process.
+ * @param usage Resource usage of process, including wall time.
+ * @return 0 if success, -1 if function failed, otherwise the signal raised by the process during exit.
+ */
+UT_EXPORT
+int ut_proc_cmd_usage(
+    char *cmd,
+    int8_t *rc,
+    ut_proc_usage *usage);
+
+/** Run a process (blocking) in a directory and collect its resource usage.
+ * The output of the process is only reported when it succeeds, so that a
+ * failed command can be retried without duplicating its diagnostics.
+ *
+ * @param dir Working directory of the process (NULL for current directory).
+ * @param cmd Command to run.
+ * @param rc Value returned by process.
+ * @param usage Resource usage of process, including wall time.
+ * @return 0 if success, -1 if function failed, otherwise the signal raised by the process during exit.
+ */
+UT_EXPORT
+int ut_proc_cmd_try(
+    const char *dir,
+    char *cmd,
+    int8_t *rc,
+    ut_proc_usage *usage);
+
 UT_EXPORT
 int ut_proc_cmd_stderr_only(char* cmd, int8_t *rc);
 
@@ -11,56 +11,28 @@
 extern "C" {
 #endif
 
-#define UT_STRBUF_INIT (ut_strbuf){NULL, 0, 0}
-#define UT_STRBUF_ELEMENT_SIZE (511)
+#define UT_STRBUF_INIT (ut_strbuf){NULL, 0, 0, 0}
 
-/* A buffer builds up a list of elements which individually can be up to N bytes
- * large. While appending, data is added to these elements. More elements are
- * added on the fly when needed. When an application calls ut_strbuf_get, all
- * elements are combined in one string and the element administration is freed.
+/* A buffer is a single block of memory that grows geometrically as data is
+ * appended, so that appending is amortized constant time and the result can
+ * be handed to the application without copying.
  *
- * This approach prevents reallocs of large blocks of memory, and therefore
- * copying large blocks of memory when appending to a large buffer. A buffer
- * preallocates some memory for the element overhead so that for small strings
- * there is hardly any overhead, while for large strings the overhead is offset
- * by the reduced time spent on copying memory.
+ * Strings, characters and integers are appended without going through
+ * vsnprintf. Use format strings only where actual formatting is needed.
  */
 
-typedef struct ut_strbuf_element {
-    bool buffer_embedded;
-    uint32_t pos;
-    char *buf;
-    struct ut_strbuf_element *next;
-} ut_strbuf_element;
-
-typedef struct ut_strbuf_element_embedded {
-    ut_strbuf_element super;
-    char buf[UT_STRBUF_ELEMENT_SIZE + 1];
-} ut_strbuf_element_embedded;
-
-typedef struct ut_strbuf_element_str {
-    ut_strbuf_element super;
-    char *alloc_str;
-} ut_strbuf_element_str;
-
 typedef struct ut_strbuf {
-    /* When set by an application, append will write to this buffer */
+    /* Contents of buffer, null-terminated after the first append */
     char *buf;
 
-    /* The maximum number of characters that may be printed */
-    uint32_t max;
+    /* Number of characters in buffer */
+    uint32_t length;
 
-    /* Size of elements minus current element */
+    /* Number of bytes allocated for buffer */
     uint32_t size;
 
-    /* The number of elements in use */
-    uint32_t elementCount;
-
-    /* Always allocate at least one element */
-    ut_strbuf_element_embedded firstElement;
-
-    /* The current element being appended to */
-    ut_strbuf_element *current;
+    /* The maximum number of characters that may be appended (0 = no max) */
+    uint32_t max;
 } ut_strbuf;
 
 /* Append format string to a buffer.
@@ -93,14 +65,14 @@ bool ut_strbuf_mergebuff(
     ut_strbuf *dst_buffer,
     ut_strbuf *src_buffer);
 
-/* Append string to buffer, transfer ownership to buffer.
+/* Append string to buffer, string is freed by buffer.
  * Returns false when max is reached, true when there is still space */
 UT_EXPORT
 bool ut_strbuf_appendstr_zerocpy(
     ut_strbuf *buffer,
     char *str);
 
-/* Append string to buffer, do not free/modify string.
+/* Append string to buffer, do not free/modify string (same as appendstr).
  * Returns false when max is reached, true when there is still space */
 UT_EXPORT
 bool ut_strbuf_appendstr_zerocpy_const(
@@ -115,7 +87,22 @@ bool ut_strbuf_appendstrn(
     const char *str,
     uint32_t n);
 
-/* Return result string (also resets buffer) */
+/* Append a single character to buffer.
+ * Returns false when max is reached, true when there is still space */
+UT_EXPORT
+bool ut_strbuf_appendch(
+    ut_strbuf *buffer,
+    char ch);
+
+/* Append decimal representation of integer to buffer.
+ * Returns false when max is reached, true when there is still space */
+UT_EXPORT
+bool ut_strbuf_appendint(
+    ut_strbuf *buffer,
+    int64_t value);
+
+/* Return result string and reset buffer. The application takes ownership of
+ * the buffer memory, no copy is made. Returns NULL if nothing was appended. */
 UT_EXPORT
 char *ut_strbuf_get(
     ut_strbuf *buffer);
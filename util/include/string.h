@@ -155,7 +155,8 @@ void strset(
  * This function utilizes internal buffers to build a string according to printf
  * style formatting. The output of this function does not need to be deallocated
  * and the function can therefore be used in a function argument. Up to
- * UT_MAX_TLS_STRINGS strings can be used per thread.
+ * UT_MAX_TLS_STRINGS strings can be used per thread. Use ut_scratch_asprintf
+ * for temporaries that must stay valid for the duration of a scope.
  *
  * @param fmt printf-style format string.
  * @return String formatted according to input. Does not need to be deallocated. The value will be
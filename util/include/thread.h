@@ -315,6 +315,15 @@ UT_EXPORT
 int ut_cond_signal(
     ut_cond cond);
 
+/** Signal all threads waiting for condition variable.
+ *
+ * @param cond Pointer to initialized condition variable.
+ * @return 0 if success, non-zero if failed.
+ */
+UT_EXPORT
+int ut_cond_broadcast(
+    ut_cond cond);
+
 /** Wait for condition variable.
  *
  * @param cond Pointer to initialized condition variable.
@@ -325,6 +334,21 @@ int ut_cond_wait(
     ut_cond cond,
     ut_mutex mutex);
 
+/** Wait for condition variable, with a timeout.
+ * Returns when the condition variable is signalled or when the timeout has
+ * expired, whichever comes first. Callers should test their predicate again.
+ *
+ * @param cond Pointer to initialized condition variable.
+ * @param mutex Locked mutex.
+ * @param timeout_ns Maximum time to wait in nanoseconds.
+ * @return 0 if signalled or timed out, non-zero if failed.
+ */
+UT_EXPORT
+int ut_cond_timedwait(
+    ut_cond cond,
+    ut_mutex mutex,
+    int64_t timeout_ns);
+
 /** Create new read-write mutex.
  *
  * @param mutex Pointer to initialized ut_cond_s structure.
@@ -307,6 +307,7 @@ const char* ut_appname();
 #include "file.h"
 #include "env.h"
 #include "memory.h"
+#include "arena.h"
 #include "log.h"
 #include "proc.h"
 #include "expr.h"
@@ -0,0 +1,375 @@
+/* Copyright (c) 2010-2018 Sander Mertens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "../include/util.h"
+
+/* Memory returned by the arena is aligned to this boundary */
+#define UT_ARENA_ALIGN (16)
+
+typedef struct ut_arena_chunk {
+    struct ut_arena_chunk *next;
+    size_t size;
+} ut_arena_chunk;
+
+/* Offset of the first object in a chunk */
+#define UT_ARENA_CHUNK_HDR UT_ALIGN(sizeof(ut_arena_chunk), UT_ARENA_ALIGN)
+
+typedef struct ut_arena_owned {
+    struct ut_arena_owned *next;
+    void *ptr;
+    ut_arena_free_cb free_cb;
+} ut_arena_owned;
+
+struct ut_arena {
+    ut_arena_chunk *chunks;   /* Current chunk is the first in the list */
+    char *ptr;                /* Next free byte in current chunk */
+    char *end;                /* End of current chunk */
+    size_t chunk_size;
+    size_t size;
+    ut_arena_owned *owned;    /* Objects released when arena is freed */
+};
+
+static
+ut_arena_chunk* ut_arena_chunk_new(
+    ut_arena *arena,
+    size_t size)
+{
+    ut_arena_chunk *chunk = malloc(UT_ARENA_CHUNK_HDR + size);
+    if (!chunk) {
+        ut_critical("out of memory");
+    }
+
+    chunk->size = size;
+    arena->size += size;
+    return chunk;
+}
+
+ut_arena* ut_arena_new(
+    size_t chunk_size)
+{
+    ut_arena *result = ut_calloc(sizeof(ut_arena));
+    result->chunk_size = chunk_size ? chunk_size : UT_ARENA_CHUNK_SIZE;
+    return result;
+}
+
+void ut_arena_free(
+    ut_arena *arena)
+{
+    if (!arena) {
+        return;
+    }
+
+    /* Release owned objects in reverse order, so objects registered later can
+     * still refer to objects that were registered earlier */
+    ut_arena_owned *owned = arena->owned;
+    while (owned) {
+        owned->free_cb(owned->ptr);
+        owned = owned->next;
+    }
+
+    ut_arena_chunk *chunk = arena->chunks;
+    while (chunk) {
+        ut_arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    free(arena);
+}
+
+void* ut_arena_alloc(
+    ut_arena *arena,
+    size_t size)
+{
+    size = UT_ALIGN(size ? size : 1, UT_ARENA_ALIGN);
+
+    if (size > (size_t)(arena->end - arena->ptr)) {
+        ut_arena_chunk *chunk;
+
+        if (size > arena->chunk_size / 4) {
+            /* Large objects get a dedicated chunk, which is inserted after the
+             * current chunk so the remainder of the current one is not lost */
+            chunk = ut_arena_chunk_new(arena, size);
+            if (arena->chunks) {
+                chunk->next = arena->chunks->next;
+                arena->chunks->next = chunk;
+            } else {
+                chunk->next = NULL;
+                arena->chunks = chunk;
+                arena->ptr = arena->end = (char*)chunk + UT_ARENA_CHUNK_HDR + size;
+            }
+            return (char*)chunk + UT_ARENA_CHUNK_HDR;
+        }
+
+        chunk = ut_arena_chunk_new(arena, arena->chunk_size);
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->ptr = (char*)chunk + UT_ARENA_CHUNK_HDR;
+        arena->end = arena->ptr + arena->chunk_size;
+    }
+
+    void *result = arena->ptr;
+    arena->ptr += size;
+    return result;
+}
+
+void* ut_arena_calloc(
+    ut_arena *arena,
+    size_t size)
+{
+    void *result = ut_arena_alloc(arena, size);
+    memset(result, 0, size);
+    return result;
+}
+
+char* ut_arena_strdup(
+    ut_arena *arena,
+    const char *str)
+{
+    if (!str) {
+        return NULL;
+    }
+
+    size_t len = strlen(str);
+    char *result = ut_arena_alloc(arena, len + 1);
+    memcpy(result, str, len + 1);
+    return result;
+}
+
+char* ut_arena_vasprintf(
+    ut_arena *arena,
+    const char *fmt,
+    va_list args)
+{
+    va_list tmpa;
+
+    va_copy(tmpa, args);
+    int size = vsnprintf(NULL, 0, fmt, tmpa);
+    va_end(tmpa);
+
+    if (size < 0) {
+        return NULL;
+    }
+
+    char *result = ut_arena_alloc(arena, size + 1);
+    vsnprintf(result, size + 1, fmt, args);
+    return result;
+}
+
+char* ut_arena_asprintf(
+    ut_arena *arena,
+    const char *fmt,
+    ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    char *result = ut_arena_vasprintf(arena, fmt, args);
+    va_end(args);
+
+    return result;
+}
+
+void* ut_arena_own(
+    ut_arena *arena,
+    void *ptr,
+    ut_arena_free_cb free_cb)
+{
+    if (ptr) {
+        ut_arena_owned *owned = ut_arena_alloc(arena, sizeof(ut_arena_owned));
+        owned->ptr = ptr;
+        owned->free_cb = free_cb;
+        owned->next = arena->owned;
+        arena->owned = owned;
+    }
+
+    return ptr;
+}
+
+size_t ut_arena_size(
+    ut_arena *arena)
+{
+    return arena->size;
+}
+
+/* -- Scratch arena -- */
+
+extern ut_tls UT_KEY_SCRATCH;
+
+/* Blocks are never released while the thread is alive. After a pop, blocks
+ * following the current one are reused by later allocations. */
+typedef struct ut_scratch_block {
+    struct ut_scratch_block *next;
+    size_t size;
+    size_t used;
+} ut_scratch_block;
+
+#define UT_SCRATCH_BLOCK_HDR UT_ALIGN(sizeof(ut_scratch_block), UT_ARENA_ALIGN)
+
+typedef struct ut_scratch {
+    ut_scratch_block *first;
+    ut_scratch_block *current;
+} ut_scratch;
+
+static
+ut_scratch* ut_scratch_get(void)
+{
+    ut_scratch *result = ut_tls_get(UT_KEY_SCRATCH);
+    if (!result) {
+        result = ut_calloc(sizeof(ut_scratch));
+        ut_tls_set(UT_KEY_SCRATCH, result);
+    }
+    return result;
+}
+
+static
+ut_scratch_block* ut_scratch_block_new(
+    size_t size)
+{
+    ut_scratch_block *block = malloc(UT_SCRATCH_BLOCK_HDR + size);
+    if (!block) {
+        ut_critical("out of memory");
+    }
+
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+void ut_scratch_free(
+    void *data)
+{
+    ut_scratch *scratch = data;
+    if (scratch) {
+        ut_scratch_block *block = scratch->first;
+        while (block) {
+            ut_scratch_block *next = block->next;
+            free(block);
+            block = next;
+        }
+        free(scratch);
+    }
+}
+
+ut_scratch_mark ut_scratch_push(void)
+{
+    ut_scratch *scratch = ut_scratch_get();
+    ut_scratch_block *block = scratch->current;
+    return (ut_scratch_mark){block, block ? block->used : 0};
+}
+
+void ut_scratch_pop(
+    ut_scratch_mark mark)
+{
+    ut_scratch *scratch = ut_scratch_get();
+    ut_scratch_block *block = mark.block;
+
+    if (!block) {
+        /* Mark was pushed before the first allocation */
+        block = scratch->first;
+    }
+
+    if (block) {
+        block->used = mark.used;
+    }
+
+    scratch->current = block;
+}
+
+void* ut_scratch_alloc(
+    size_t size)
+{
+    ut_scratch *scratch = ut_scratch_get();
+    ut_scratch_block *block = scratch->current;
+
+    size = UT_ALIGN(size ? size : 1, UT_ARENA_ALIGN);
+
+    if (!block || (block->size - block->used) < size) {
+        ut_scratch_block *next = block ? block->next : scratch->first;
+
+        /* Reuse next block if it is large enough, otherwise insert new one */
+        if (!next || next->size < size) {
+            ut_scratch_block *new_block = ut_scratch_block_new(
+                size > UT_SCRATCH_BLOCK_SIZE ? size : UT_SCRATCH_BLOCK_SIZE);
+            new_block->next = next;
+            if (block) {
+                block->next = new_block;
+            } else {
+                scratch->first = new_block;
+            }
+            next = new_block;
+        }
+
+        next->used = 0;
+        scratch->current = block = next;
+    }
+
+    void *result = (char*)block + UT_SCRATCH_BLOCK_HDR + block->used;
+    block->used += size;
+    return result;
+}
+
+char* ut_scratch_strdup(
+    const char *str)
+{
+    if (!str) {
+        return NULL;
+    }
+
+    size_t len = strlen(str);
+    char *result = ut_scratch_alloc(len + 1);
+    memcpy(result, str, len + 1);
+    return result;
+}
+
+char* ut_scratch_vasprintf(
+    const char *fmt,
+    va_list args)
+{
+    va_list tmpa;
+
+    va_copy(tmpa, args);
+    int size = vsnprintf(NULL, 0, fmt, tmpa);
+    va_end(tmpa);
+
+    if (size < 0) {
+        return NULL;
+    }
+
+    char *result = ut_scratch_alloc(size + 1);
+    vsnprintf(result, size + 1, fmt, args);
+    return result;
+}
+
+char* ut_scratch_asprintf(
+    const char *fmt,
+    ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    char *result = ut_scratch_vasprintf(fmt, args);
+    va_end(args);
+
+    return result;
+}
@@ -105,7 +105,7 @@ int16_t ut_expand_path(
         while (ut_iter_hasNext(&it)) {
             char *file = ut_iter_next(&it);
             if (count) {
-                ut_strbuf_appendstrn(output, " ", 1);
+                ut_strbuf_appendch(output, ' ');
             }
             if (strcmp(dir, ".")) {
                 ut_strbuf_append(output, "%s/%s", dir, file);
@@ -153,6 +153,11 @@ char* ut_venvparse(
 
     str = ut_vasprintf(input, arglist);
 
+    /* If there are no variables or wildcards, string doesn't change */
+    if (!strpbrk(str, "$~*")) {
+        return str;
+    }
+
     ptr = str;
 
     bool separator = false;
@@ -202,16 +207,18 @@ char* ut_venvparse(
                         free(path_str);
                     }
 
-                    ut_strbuf_appendstrn(&output, &ch, 1);
+                    if (ch) {
+                        ut_strbuf_appendch(&output, ch);
+                    }
                 } else {
-                    ut_strbuf_appendstrn(&path, &ch, 1);
+                    ut_strbuf_appendch(&path, ch);
                 }
 
                 ptr++;
             } else {
                 char ch_out;
                 ptr = chrparse(ptr, &ch_out);
-                ut_strbuf_appendstrn(&token, &ch_out, 1);
+                ut_strbuf_appendch(&token, ch_out);
             }
         } else {
             ptr ++;
@@ -221,6 +228,10 @@ char* ut_venvparse(
     free(str);
 
     result = ut_strbuf_get(&output);
+    if (!result) {
+        /* Input only contained variables that were empty */
+        result = ut_strdup("");
+    }
 
     return result;
 error:
@@ -338,6 +338,132 @@ error:
     return -1;
 }
 
+/* Test if program only matches elements against a list of suffixes. Such
+ * programs have the form *.a|*.b|*.c, optionally preceded by a //. */
+static
+bool ut_expr_isSuffixList(
+    ut_expr_program program)
+{
+    int op = 0;
+
+    if (program->ops[0].token == UT_EXPR_TOKEN_TREE) {
+        op ++;
+    }
+
+    if (op == program->size) {
+        return false;
+    }
+
+    for (; op < program->size; op ++) {
+        ut_exprOp *cur = &program->ops[op];
+        if (cur->token == UT_EXPR_TOKEN_OR) {
+            if (op == program->size - 1) {
+                return false;
+            }
+            continue;
+        }
+
+        if (cur->token != UT_EXPR_TOKEN_FILTER) {
+            return false;
+        }
+
+        if (cur->start[0] != '*' || !cur->start[1]) {
+            return false;
+        }
+
+        if (strchr(&cur->start[1], '*') || strchr(&cur->start[1], '?')) {
+            return false;
+        }
+
+        /* Filters must be separated by an OR */
+        if (op + 1 < program->size &&
+            program->ops[op + 1].token != UT_EXPR_TOKEN_OR)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Match a single element against the suffixes of a suffix list program. Like
+ * the default matcher, elements that start with a '.' never match. */
+static
+bool ut_expr_matchSuffix(
+    ut_expr_program program,
+    const char *elem,
+    size_t len)
+{
+    int op;
+
+    if (!len || elem[0] == '.') {
+        return false;
+    }
+
+    for (op = 0; op < program->size; op ++) {
+        ut_exprOp *cur = &program->ops[op];
+        if (cur->token != UT_EXPR_TOKEN_FILTER) {
+            continue;
+        }
+
+        const char *suffix = &cur->start[1];
+        size_t suffix_len = strlen(suffix);
+        if (suffix_len <= len) {
+            const char *ptr = &elem[len - suffix_len];
+            size_t i;
+            for (i = 0; i < suffix_len; i ++) {
+                if (tolower(ptr[i]) != suffix[i]) {
+                    break;
+                }
+            }
+            if (i == suffix_len) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+/* Match a path against a tree suffix list program. This gives the same result
+ * as evaluating the program with ut_expr_runExpr: the first element matching a
+ * suffix starts the match, and all elements after it must match as well. */
+static
+bool ut_expr_runSuffixTree(
+    ut_expr_program program,
+    const char *str)
+{
+    const char *ptr = str, *sep;
+    bool found = false;
+
+    if (ptr[0] == '/') {
+        ptr ++;
+    }
+
+    /* Most paths are rejected by their last element */
+    const char *last = strrchr(ptr, '/');
+    last = last ? last + 1 : ptr;
+    if (!ut_expr_matchSuffix(program, last, strlen(last))) {
+        return false;
+    }
+
+    do {
+        sep = strchr(ptr, '/');
+        size_t len = sep ? (size_t)(sep - ptr) : strlen(ptr);
+        bool match = ut_expr_matchSuffix(program, ptr, len);
+
+        if (!found) {
+            found = match;
+        } else if (!match) {
+            return false;
+        }
+
+        ptr = sep + 1;
+    } while (sep);
+
+    return found;
+}
+
 ut_expr_program ut_expr_compile(
     const char *expr,
     bool allowScopes,
@@ -389,6 +515,16 @@ ut_expr_program ut_expr_compile(
         }
     }
 
+    /* Optimize for lists of file extensions (like *.c|*.cpp), which may be
+     * preceded by // to also match files in subdirectories */
+    if (!result->kind && ut_expr_isSuffixList(result)) {
+        if (result->ops[0].token == UT_EXPR_TOKEN_TREE) {
+            result->kind = 6;
+        } else {
+            result->kind = 5;
+        }
+    }
+
     return result;
 error:
     return NULL;
@@ -407,6 +543,10 @@ int ut_expr_scope(
         result = 1;
     } else if (program->kind == 4) {
         result = 2;
+    } else if (program->kind == 5) {
+        result = 0;
+    } else if (program->kind == 6) {
+        result = 2;
     } else {
         int i;
         for (i = 0; i < program->size; i++) {
@@ -601,6 +741,16 @@ bool ut_expr_run(
         if (strcmp(str, ".")) {
             result = true;
         }
+    } else if (program->kind == 5) {
+        /* Match single identifier against list of suffixes */
+        const char *ptr = str;
+        if (ptr[0] == '/') ptr ++;
+        if (!strchr(ptr, '/')) {
+            result = ut_expr_matchSuffix(program, ptr, strlen(ptr));
+        }
+    } else if (program->kind == 6) {
+        /* Match identifiers in tree against list of suffixes */
+        result = ut_expr_runSuffixTree(program, str);
     }
 
     return result;
@@ -19,6 +19,13 @@
  * THE SOFTWARE.
  */
 
+/* openat, fdopendir and friends are POSIX 2008, d_type is a BSD extension */
+#ifndef _WIN32
+#undef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+#endif
+
 #include "../include/util.h"
 
 int ut_touch(const char *file) {
@@ -229,50 +236,64 @@ error:
     return -1;
 }
 
+typedef struct ut_cp_dir_t {
+    char *dst;
+    size_t size;
+    size_t dst_len;
+} ut_cp_dir_t;
+
 static
-int16_t ut_cp_dir(
-    const char *src,
-    const char *dst)
+int ut_cp_dirCallback(
+    ut_dir_entry *entry,
+    void *ctx)
 {
-    ut_dirstack stack = NULL;
-    if (ut_mkdir(dst)) {
-        goto error;
-    }
+    ut_cp_dir_t *data = ctx;
+    size_t len = data->dst_len + 1 + strlen(entry->relative);
 
-    stack = ut_dirstack_push(NULL, src);
-    if (!stack) {
-        goto error;
+    if (len + 1 > data->size) {
+        data->size = (len + 1) * 2;
+        data->dst = realloc(data->dst, data->size);
     }
 
-    ut_iter it;
+    data->dst[data->dst_len] = '/';
+    strcpy(&data->dst[data->dst_len + 1], entry->relative);
 
-    if (ut_dir_iter(ut_dirstack_wd(stack), NULL, &it)) {
-        goto error;
+    if (entry->is_dir) {
+        if (mkdir(data->dst, 0755) && errno != EEXIST) {
+            ut_throw("%s: %s", data->dst, strerror(errno));
+            goto error;
+        }
+    } else {
+        if (ut_cp_file(entry->path, data->dst)) {
+            goto error;
+        }
     }
 
-    while (ut_iter_hasNext(&it)) {
-        char *file = ut_iter_next(&it);
+    return 0;
+error:
+    return -1;
+}
 
-        if (ut_isdir(file)) {
-            char *dstdir = ut_asprintf("%s/%s", dst, file);
-            if (ut_cp_dir(file, dstdir)) {
-                goto error;
-            }
-            free(dstdir);
-        } else {
-            if (ut_cp_file(file, dst)) {
-                goto error;
-            }
-        }
+static
+int16_t ut_cp_dir(
+    const char *src,
+    const char *dst)
+{
+    if (ut_mkdir(dst)) {
+        goto error;
     }
 
-    ut_dirstack_pop(stack);
+    ut_cp_dir_t data = {
+        .dst = ut_strdup(dst),
+        .dst_len = strlen(dst)
+    };
+    data.size = data.dst_len + 1;
 
-    return 0;
+    int16_t result = ut_dir_walk(src, 0, ut_cp_dirCallback, &data);
+    free(data.dst);
+
+    return result;
 error:
-    if (stack) {
-        ut_dirstack_pop(stack);
-    }
     return -1;
 }
 
@@ -482,17 +503,14 @@ int ut_rm(const char *name) {
     return result;
 }
 
-static int ut_rmtreeCallback(
-  const char *path,
-  const struct stat *sb,
-  int typeflag,
-  struct FTW *ftwbuf)
+static
+int ut_rmtreeCallback(
+    ut_dir_entry *entry,
+    void *ctx)
 {
-    UT_UNUSED(sb);
-    UT_UNUSED(typeflag);
-    UT_UNUSED(ftwbuf);
-    if (remove(path)) {
-        ut_throw(strerror(errno));
+    UT_UNUSED(ctx);
+    if (unlinkat(entry->dirfd, entry->name, entry->is_dir ? AT_REMOVEDIR : 0)) {
+        ut_throw("%s: %s", entry->path, strerror(errno));
         goto error;
     }
     return 0;
@@ -502,7 +520,20 @@ error:
 
 /* Recursively remove a directory */
 int ut_rmtree(const char *name) {
-    return nftw(name, ut_rmtreeCallback, 20, FTW_DEPTH | FTW_PHYS);
+    int flags = UT_DIR_WALK_HIDDEN | UT_DIR_WALK_POST | UT_DIR_WALK_PHYS;
+
+    if (ut_dir_walk(name, flags, ut_rmtreeCallback, NULL)) {
+        goto error;
+    }
+
+    if (rmdir(name)) {
+        ut_throw("%s: %s", name, strerror(errno));
+        goto error;
+    }
+
+    return 0;
+error:
+    return -1;
 }
 
 /* Read the contents of a directory */
@@ -614,57 +645,47 @@ void ut_dir_releaseRecursiveFilter(
     ut_ll_iterRelease(it);
 }
 
+typedef struct ut_dir_collect_t {
+    ut_expr_program filter;
+    ut_ll files;
+} ut_dir_collect_t;
+
 static
-int16_t ut_dir_collectRecursive(
-    const char *name,
-    ut_dirstack stack,
-    ut_expr_program filter,
-    ut_ll files)
+int ut_dir_collectCallback(
+    ut_dir_entry *entry,
+    void *ctx)
 {
-    ut_iter it;
-
-    /* Move to current directory */
-    if (name && name[0]) {
-        if (!(stack = ut_dirstack_push(stack, name))) {
-            goto stack_error;
-        }
-    }
+    ut_dir_collect_t *data = ctx;
 
-    /* Obtain iterator to current directory */
-    if (ut_dir_iter(ut_dirstack_wd(stack), NULL, &it)) {
-        goto error;
+    /* Add file to results if it matches filter */
+    if (ut_expr_run(data->filter, entry->path)) {
+        ut_ll_append(data->files, ut_strdup(entry->path));
     }
 
-    while (ut_iter_hasNext(&it)) {
-        char *file = ut_iter_next(&it);
+    return 0;
+}
 
-        /* Add file to results if it matches filter */
-        char *path = ut_asprintf("%s/%s", ut_dirstack_wd(stack), file);
-        ut_path_clean(path, path);
-        if (ut_expr_run(filter, path)) {
-            ut_ll_append(files, path);
-        }
+static
+int16_t ut_dir_collectRecursive(
+    const char *name,
+    ut_expr_program filter,
+    ut_ll files)
+{
+    ut_dir_collect_t data = {
+        .filter = filter,
+        .files = files
+    };
 
-        /* If directory, crawl */
-        if (ut_isdir(path)) {
-            if (ut_dir_collectRecursive(file, stack, filter, files)) {
-                goto error;
-            }
-        }
-    }
+    /* Clean root once, so paths of entries are clean as well */
+    char *root = ut_strdup(name);
+    ut_path_clean(root, root);
 
-    if (name && name[0]) {
-        ut_dirstack_pop(stack);
-    }
+    int16_t result = ut_dir_walk(root, 0, ut_dir_collectCallback, &data);
+    free(root);
 
-    return 0;
-error:
-    ut_dirstack_pop(stack);
-stack_error:
-    return -1;
+    return result;
 }
 
-
 int16_t ut_dir_iter(
     const char *name,
     const char *filter,
@@ -697,7 +718,10 @@ int16_t ut_dir_iter(
         if (ut_expr_scope(program) == 2) {
 
             ut_ll files = ut_ll_new();
-            if (ut_dir_collectRecursive(name, NULL, program, files)) {
+            int16_t ret = ut_dir_collectRecursive(name, program, files);
+            ut_expr_free(program);
+            if (ret) {
+                ut_closedir(files);
                 ut_throw("dir_iter failed");
                 goto error;
             }
@@ -745,6 +769,218 @@ bool ut_dir_isEmpty(
     return isEmpty;
 }
 
+typedef struct ut_dir_walker {
+    char *path;
+    size_t size;
+    size_t root_len;
+    int flags;
+    ut_dir_walk_cb action;
+    void *ctx;
+} ut_dir_walker;
+
+static
+bool ut_dir_walkIsDir(
+    ut_dir_walker *walker,
+    int fd,
+    struct dirent *ep)
+{
+#ifdef DT_DIR
+    if (ep->d_type == DT_DIR) {
+        return true;
+    } else if (ep->d_type == DT_LNK) {
+        if (walker->flags & UT_DIR_WALK_PHYS) {
+            return false;
+        }
+    } else if (ep->d_type != DT_UNKNOWN) {
+        return false;
+    }
+#endif
+
+    /* Filesystem doesn't report type, or entry is a link that is followed */
+    struct stat attr;
+    int flags = walker->flags & UT_DIR_WALK_PHYS ? AT_SYMLINK_NOFOLLOW : 0;
+    if (fstatat(fd, ep->d_name, &attr, flags)) {
+        return false;
+    }
+
+    return S_ISDIR(attr.st_mode);
+}
+
+/* Walk directory opened as 'fd', of which the path is stored in walker->path
+ * up to 'len'. The function takes ownership of 'fd'. */
+static
+int16_t ut_dir_walkDir(
+    ut_dir_walker *walker,
+    int fd,
+    size_t len,
+    int depth)
+{
+    DIR *dp = fdopendir(fd);
+    struct dirent *ep;
+
+    if (!dp) {
+        walker->path[len] = '\0';
+        ut_throw("%s: %s", walker->path, strerror(errno));
+        close(fd);
+        goto error;
+    }
+
+    while ((ep = readdir(dp))) {
+        const char *name = ep->d_name;
+
+        if (name[0] == '.') {
+            if (!name[1] || (name[1] == '.' && !name[2])) {
+                continue;
+            }
+            if (!(walker->flags & UT_DIR_WALK_HIDDEN)) {
+                continue;
+            }
+        }
+
+        /* Append name of entry to path of directory */
+        size_t name_len = strlen(name);
+        size_t entry_len = len + 1 + name_len;
+        if (entry_len + 1 > walker->size) {
+            walker->size = (entry_len + 1) * 2;
+            walker->path = realloc(walker->path, walker->size);
+        }
+        walker->path[len] = '/';
+        memcpy(&walker->path[len + 1], name, name_len + 1);
+
+        ut_dir_entry entry = {
+            .path = walker->path,
+            .relative = &walker->path[walker->root_len + 1],
+            .name = &walker->path[len + 1],
+            .dirfd = dirfd(dp),
+            .depth = depth,
+            .is_dir = ut_dir_walkIsDir(walker, dirfd(dp), ep)
+        };
+
+        int ret = 0;
+        if (!entry.is_dir || !(walker->flags & UT_DIR_WALK_POST)) {
+            if ((ret = walker->action(&entry, walker->ctx)) < 0) {
+                goto error_close;
+            }
+        }
+
+        if (entry.is_dir && ret != UT_DIR_WALK_SKIP) {
+            int flags = O_RDONLY | O_DIRECTORY;
+            if (walker->flags & UT_DIR_WALK_PHYS) {
+                flags |= O_NOFOLLOW;
+            }
+
+            int sub = openat(dirfd(dp), name, flags);
+            if (sub == -1) {
+                ut_throw("%s: %s", walker->path, strerror(errno));
+                goto error_close;
+            }
+
+            if (ut_dir_walkDir(walker, sub, entry_len, depth + 1)) {
+                goto error_close;
+            }
+
+            if (walker->flags & UT_DIR_WALK_POST) {
+                /* Path may have been reallocated or overwritten by contents */
+                walker->path[entry_len] = '\0';
+                entry.path = walker->path;
+                entry.relative = &walker->path[walker->root_len + 1];
+                entry.name = &walker->path[len + 1];
+                if (walker->action(&entry, walker->ctx) < 0) {
+                    goto error_close;
+                }
+            }
+        }
+    }
+
+    closedir(dp);
+    return 0;
+error_close:
+    closedir(dp);
+error:
+    return -1;
+}
+
+int16_t ut_dir_walk(
+    const char *name,
+    int flags,
+    ut_dir_walk_cb action,
+    void *ctx)
+{
+    if (!name) {
+        ut_throw("invalid 'null' provided as directory name");
+        goto error;
+    }
+
+    int fd = open(name, O_RDONLY | O_DIRECTORY);
+    if (fd == -1) {
+        ut_throw("%s: %s", name, strerror(errno));
+        goto error;
+    }
+
+    /* Strip trailing '/' so relative paths can be derived from full paths */
+    size_t len = strlen(name);
+    while (len && name[len - 1] == '/') {
+        len --;
+    }
+
+    ut_dir_walker walker = {
+        .path = malloc(len + UT_MAX_PATH_LENGTH),
+        .size = len + UT_MAX_PATH_LENGTH,
+        .root_len = len,
+        .flags = flags,
+        .action = action,
+        .ctx = ctx
+    };
+
+    memcpy(walker.path, name, len);
+    walker.path[len] = '\0';
+
+    int16_t result = ut_dir_walkDir(&walker, fd, len, 0);
+    free(walker.path);
+
+    return result;
+error:
+    return -1;
+}
+
+time_t ut_dir_entry_lastmodified(
+    ut_dir_entry *entry)
+{
+    struct stat attr;
+
+    if (fstatat(entry->dirfd, entry->name, &attr, 0) < 0) {
+        ut_throw("failed to stat '%s' (%s)", entry->path, strerror(errno));
+        goto error;
+    }
+
+    return attr.st_mtime;
+error:
+    return -1;
+}
+
+bool ut_dir_entry_test(
+    ut_dir_entry *entry,
+    const char *file)
+{
+    char buffer[UT_MAX_PATH_LENGTH];
+    char *path = buffer;
+    bool result;
+
+    if ((size_t)snprintf(buffer, sizeof(buffer), "%s/%s", entry->name, file)
+        >= sizeof(buffer))
+    {
+        path = ut_asprintf("%s/%s", entry->name, file);
+    }
+
+    result = !faccessat(entry->dirfd, path, F_OK, 0);
+
+    if (path != buffer) {
+        free(path);
+    }
+
+    return result;
+}
+
 ut_dirstack ut_dirstack_push(
     ut_dirstack stack,
     const char *dir)
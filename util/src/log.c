@@ -20,6 +20,7 @@
  */
 
 #include "../include/util.h"
+#include <sys/ioctl.h>
 
 #define UT_LOG_FILE_LEN (20)
 #define UT_MAX_LOG (1024)
@@ -57,6 +58,31 @@ static char *UT_LOG_FMT_CURRENT = UT_LOG_FORMAT_DEFAULT;
 static bool ut_log_shouldEmbedCategories = true;
 static bool UT_LOG_USE_COLORS = true;
 
+/* Cached lowest enabled level & pending exception count, tested by the log
+ * macro's before evaluating any arguments */
+int8_t UT_LOG_THRESHOLD = UT_INFO;
+int UT_LOG_PENDING = 0;
+
+/* Serializes writes to the console & protects the status line */
+static ut_mutex_s ut_log_output_lock;
+static ut_cond_s ut_log_status_cond;
+static ut_thread ut_log_status_thread;
+static char *ut_log_status_msg;
+static bool ut_log_status_drawn;
+static bool ut_log_status_dirty;
+static bool ut_log_status_stop;
+static bool ut_log_status_tty;
+
+/* Trace events (protected by ut_log_lock) */
+static bool ut_log_tracing;
+static struct timespec ut_log_trace_start;
+static struct ut_log_trace_event *ut_log_trace_events;
+static uint32_t ut_log_trace_count, ut_log_trace_size;
+static int ut_log_trace_threads;
+
+/* Minimum time between two redraws of the status line (10Hz) */
+#define UT_LOG_STATUS_INTERVAL (100000000)
+
 /* Maximum stacktrace */
 #define BACKTRACE_DEPTH 60
 
@@ -86,8 +112,29 @@ typedef struct ut_log_frame {
     ut_log_codeframe frames[UT_MAX_LOG_CODEFRAMES];
     uint32_t sp;
     struct timespec lastTime;
+
+    /* Start of category, for trace events */
+    struct timespec start;
 } ut_log_frame;
 
+/* Span started with ut_log_trace_begin */
+typedef struct ut_log_trace_span {
+    const char *category;
+    char *name;
+    char *detail;
+    struct timespec start;
+} ut_log_trace_span;
+
+/* Complete trace event, in microseconds since the trace was enabled */
+typedef struct ut_log_trace_event {
+    const char *category;
+    char *name;
+    char *detail;
+    int tid;
+    double ts;
+    double dur;
+} ut_log_trace_event;
+
 /* Main thread-specific log administration type */
 typedef struct ut_log_tlsData {
     /* Last reported error data */
@@ -96,9 +143,20 @@ typedef struct ut_log_tlsData {
     ut_log_frame exceptionFrames[UT_MAX_LOG_CATEGORIES + 1];
     uint32_t exceptionCount;
     bool viewed;
+    bool pending; /* Counted in UT_LOG_PENDING */
     char *backtrace;
     uint16_t last_printed_len;
 
+    /* Output buffered between ut_log_job_begin and ut_log_job_end */
+    ut_strbuf job;
+    bool job_active;
+    pid_t job_pid; /* Forked children write to the console directly */
+
+    /* Spans started with ut_log_trace_begin */
+    ut_log_trace_span spans[UT_MAX_LOG_CATEGORIES];
+    uint32_t span_sp;
+    int trace_tid;
+
     /* Current category */
     char* categories[UT_MAX_LOG_CATEGORIES + 1];
     ut_log_frame frames[UT_MAX_LOG_CATEGORIES + 1];
@@ -138,6 +196,42 @@ ut_log_tlsData* ut_getThreadData(void){
     return result;
 }
 
+/* Recompute lowest level that is printed or forwarded to a handler. Must be
+ * called when verbosity changes or handlers are (un)registered. */
+static
+void ut_log_updateThreshold(void) {
+    ut_log_verbosity threshold = UT_LOG_LEVEL;
+
+    if (ut_log_handlers) {
+        ut_iter it = ut_ll_iter(ut_log_handlers);
+        while (ut_iter_hasNext(&it)) {
+            struct ut_log_handler *h = ut_iter_next(&it);
+            if (h->min_level < threshold) {
+                threshold = h->min_level;
+            }
+        }
+    }
+
+    UT_LOG_THRESHOLD = threshold;
+}
+
+/* Keep UT_LOG_PENDING in sync with whether this thread has exceptions that
+ * have not been caught yet */
+static
+void ut_log_updatePending(
+    ut_log_tlsData *data)
+{
+    bool pending = data->exceptionCount != 0;
+    if (pending != data->pending) {
+        data->pending = pending;
+        if (pending) {
+            ut_ainc(&UT_LOG_PENDING);
+        } else {
+            ut_adec(&UT_LOG_PENDING);
+        }
+    }
+}
+
 ut_log_handler ut_log_handlerRegister(
     ut_log_verbosity min_level,
     ut_log_verbosity max_level,
@@ -174,6 +268,7 @@ ut_log_handler ut_log_handlerRegister(
         ut_log_handlers = ut_ll_new();
     }
     ut_ll_append(ut_log_handlers, result);
+    ut_log_updateThreshold();
     if (ut_mutex_unlock(&ut_log_lock)) {
         ut_throw(NULL);
         goto error;
@@ -199,6 +294,7 @@ void ut_log_handlerUnregister(
             ut_ll_free(ut_log_handlers);
             ut_log_handlers = NULL;
         }
+        ut_log_updateThreshold();
         if (ut_mutex_unlock(&ut_log_lock)) {
             ut_throw(NULL);
             ut_raise();
@@ -726,13 +822,114 @@ int ut_logprint_proc(
     return 1;
 }
 
+/* Remove status line from the console. Must be called with output lock */
+static
+void ut_log_statusErase(void)
+{
+    if (ut_log_status_drawn) {
+        fputs("\r\033[K", stderr);
+        ut_log_status_drawn = false;
+    }
+}
+
+/* Draw status line, clipped to the width of the terminal so that it can be
+ * erased with a carriage return. Must be called with output lock */
+static
+void ut_log_statusDraw(void)
+{
+    struct winsize ws;
+    const char *ptr;
+    int width = 80, len = 0;
+
+    if (!ioctl(STDERR_FILENO, TIOCGWINSZ, &ws) && ws.ws_col) {
+        width = ws.ws_col;
+    }
+
+    for (ptr = ut_log_status_msg; *ptr; ptr ++) {
+        if (*ptr == '\033') {
+            /* Skip escape sequence */
+            while (ptr[1] && *ptr != 'm') {
+                ptr ++;
+            }
+        } else if ((*ptr & 0xC0) != 0x80) {
+            /* Count start of (multibyte) characters */
+            if (len == width - 1) {
+                break;
+            }
+            len ++;
+        }
+    }
+
+    fwrite(ut_log_status_msg, 1, ptr - ut_log_status_msg, stderr);
+    if (UT_LOG_USE_COLORS) {
+        fputs("\033[0m", stderr);
+    }
+
+    ut_log_status_drawn = true;
+}
+
+/* Write to the console in one piece, after erasing the status line */
+static
+void ut_log_console(
+    FILE *f,
+    const char *str,
+    size_t len,
+    bool newline)
+{
+    ut_mutex_lock(&ut_log_output_lock);
+    ut_log_statusErase();
+    fwrite(str, 1, len, f);
+    if (newline) {
+        fputc('\n', f);
+    }
+    if (ut_log_status_msg) {
+        fflush(f);
+        ut_log_status_dirty = true;
+    }
+    ut_mutex_unlock(&ut_log_output_lock);
+}
+
+/* Test if output should be added to the job buffer */
+static
+bool ut_log_job_buffering(
+    ut_log_tlsData *data)
+{
+    return data->job_active && data->job_pid == getpid();
+}
+
+/* Write log output to job buffer if the thread is running a job, or to the
+ * console otherwise */
+static
+void ut_log_write(
+    ut_log_tlsData *data,
+    FILE *f,
+    const char *str,
+    bool newline)
+{
+    if (ut_log_job_buffering(data)) {
+        ut_strbuf_appendstr(&data->job, str);
+        if (newline) {
+            ut_strbuf_appendch(&data->job, '\n');
+        }
+    } else {
+        ut_log_console(f, str, strlen(str), newline);
+    }
+}
+
 static
 void ut_log_resetCursor(
     ut_log_tlsData *data)
 {
+    ut_strbuf buf = UT_STRBUF_INIT;
     int i;
     for (i = 0; i < data->last_printed_len; i ++) {
-        fprintf(stderr, "\b");
+        ut_strbuf_appendch(&buf, '\b');
+    }
+
+    char *str = ut_strbuf_get(&buf);
+    if (str) {
+        ut_log_write(data, stderr, str, false);
+        free(str);
     }
 }
 
@@ -740,18 +937,23 @@ static
 void ut_log_clearLine(
     ut_log_tlsData *data)
 {
+    ut_strbuf buf = UT_STRBUF_INIT;
     int i;
     if (data->last_printed_len) {
         for (i = 0; i < data->last_printed_len - 1; i ++) {
-            fprintf(stderr, " ");
-            //ut_sleep(0, 10000000);
+            ut_strbuf_appendch(&buf, ' ');
         }
         for (i = 0; i < data->last_printed_len - 1; i ++) {
-            //ut_sleep(0, 50000000);
-            fprintf(stderr, "\b");
+            ut_strbuf_appendch(&buf, '\b');
         }
     }
-    //printf("len = %d\n", data->last_printed_len);
+
+    char *str = ut_strbuf_get(&buf);
+    if (str) {
+        ut_log_write(data, stderr, str, false);
+        free(str);
+    }
+
     data->last_printed_len = 0;
 }
 
@@ -936,15 +1138,15 @@ void ut_logprint(
     if (str) {
         char *colorized = ut_log_colorize(str);
         if (breakAtCategory) {
-            fprintf(f, "%s", colorized);
+            ut_log_write(data, f, colorized, false);
         } else {
             if (isTail) {
-                fprintf(f, "%s", colorized);
+                ut_log_write(data, f, colorized, false);
                 data->last_printed_len = printlen(colorized);
                 ut_log_resetCursor(data);
             } else {
                 if (msg) {
-                    fprintf(f, "%s\n", colorized);
+                    ut_log_write(data, f, colorized, true);
                 }
             }
         }
@@ -1045,6 +1247,7 @@ bool ut_raise_intern(
         }
 
         data->viewed = true;
+        ut_log_updatePending(data);
 
         if (UT_LOG_BACKTRACE) {
             ut_backtrace(stderr);
@@ -1061,6 +1264,7 @@ bool ut_raise_intern(
         if (clearCategory) {
             data->exceptionCount = 0;
             data->exceptionFrames[0].sp = 0;
+            ut_log_updatePending(data);
         }
         return false;
     }
@@ -1100,6 +1304,12 @@ void ut_lasterrorFree(
         if (data->backtrace) {
             free(data->backtrace);
         }
+        data->exceptionCount = 0;
+        ut_log_updatePending(data);
+        if (data->job_active) {
+            ut_log_console(stderr, data->job.buf, data->job.length, false);
+        }
+        ut_strbuf_reset(&data->job);
         free(data);
     }
 }
@@ -1182,6 +1392,8 @@ void ut_log_setError(
         frame->frames[frame->sp].thrown = true;
         frame->sp ++;
     }
+
+    ut_log_updatePending(data);
 }
 
 static
@@ -1273,6 +1485,13 @@ ut_log_verbosity ut_logv(
     FILE* f,
     bool overwrite)
 {
+    if (kind < UT_LOG_THRESHOLD && !UT_LOG_PENDING &&
+        !(overwrite && (UT_LOG_LEVEL - kind == 1)))
+    {
+        /* Nothing to print, forward or report */
+        return kind;
+    }
+
     ut_log_tlsData *data = ut_getThreadData();
     ut_raise_intern(data, false, UT_LOG_FMT_CURRENT, NULL);
 
@@ -1355,6 +1574,44 @@ ut_log_verbosity ut_logv(
     return kind;
 }
 
+/* Add complete event that started at 'start' and ends now */
+static
+void ut_log_traceAdd(
+    ut_log_tlsData *data,
+    const char *category,
+    const char *name,
+    const char *detail,
+    struct timespec start)
+{
+    struct timespec now;
+    timespec_gettime(&now);
+
+    /* Categories pushed before tracing was enabled start at the beginning */
+    if (timespec_compare(start, ut_log_trace_start) < 0) {
+        start = ut_log_trace_start;
+    }
+
+    ut_mutex_lock(&ut_log_lock);
+    if (!data->trace_tid) {
+        data->trace_tid = ++ ut_log_trace_threads;
+    }
+
+    if (ut_log_trace_count == ut_log_trace_size) {
+        ut_log_trace_size = ut_log_trace_size ? ut_log_trace_size * 2 : 256;
+        ut_log_trace_events = realloc(ut_log_trace_events,
+            ut_log_trace_size * sizeof(ut_log_trace_event));
+    }
+
+    ut_log_trace_event *e = &ut_log_trace_events[ut_log_trace_count ++];
+    e->category = category;
+    e->name = ut_strdup(name ? name : "");
+    e->detail = detail ? ut_strdup(detail) : NULL;
+    e->tid = data->trace_tid;
+    e->ts = timespec_toDouble(timespec_sub(start, ut_log_trace_start)) * 1000000;
+    e->dur = timespec_toDouble(timespec_sub(now, start)) * 1000000;
+    ut_mutex_unlock(&ut_log_lock);
+}
+
 int _ut_log_push(
     char const *file,
     unsigned int line,
@@ -1383,6 +1640,7 @@ int _ut_log_push(
     frame->initial.thrown = false;
     frame->sp = 0;
     timespec_gettime(&frame->lastTime);
+    frame->start = frame->lastTime;
 
     if (data->sp) {
         data->frames[data->sp - 1].count ++;
@@ -1424,6 +1682,10 @@ void _ut_log_pop(
                 false);
         }
 
+        if (ut_log_tracing) {
+            ut_log_traceAdd(data, "category", frame->category, NULL, frame->start);
+        }
+
         if (frame->initial.file) free(frame->initial.file);
         if (frame->initial.function) free(frame->initial.function);
         if (frame->category) free(frame->category);
@@ -1823,6 +2085,7 @@ bool ut_catch(void)
             ut_frame_free(frame);
         }
         data->exceptionCount = 0;
+        ut_log_updatePending(data);
         return true;
     } else {
         return false;
@@ -1894,6 +2157,7 @@ ut_log_verbosity ut_log_verbositySet(
     ut_log_verbosity old = UT_LOG_LEVEL;
     ut_setenv("UT_VERBOSITY", ut_log_levelToStr(level));
     UT_LOG_LEVEL = level;
+    ut_log_updateThreshold();
     return old;
 }
 
@@ -1916,6 +2180,16 @@ void ut_log_embedCategories(
 }
 
 int16_t ut_log_init(void) {
+    if (ut_mutex_new(&ut_log_output_lock)) {
+        return -1;
+    }
+
+    if (ut_cond_new(&ut_log_status_cond)) {
+        return -1;
+    }
+
+    ut_log_status_tty = isatty(STDERR_FILENO);
+
     return ut_tls_new(&UT_KEY_LOG, ut_lasterrorFree);
 }
 
@@ -1938,7 +2212,7 @@ void ut_log(char *fmt, ...) {
 
     colorized = ut_log_colorize(formatted);
     len = printlen(colorized);
-    fprintf(stderr, "%s", colorized);
+    ut_log_write(data, stderr, colorized, false);
 
     /* If no newline is printed, keep track of how many backtrace characters
      * need to ba appended before printing the next log statement */
@@ -1982,8 +2256,276 @@ bool ut_log_useColors(
 }
 
 void ut_log_deinit() {
+    if (ut_log_trace_events) {
+        uint32_t i;
+        for (i = 0; i < ut_log_trace_count; i ++) {
+            free(ut_log_trace_events[i].name);
+            free(ut_log_trace_events[i].detail);
+        }
+        free(ut_log_trace_events);
+        ut_log_trace_events = NULL;
+        ut_log_trace_count = ut_log_trace_size = 0;
+    }
+    ut_log_tracing = false;
+
+    if (ut_log_status_thread) {
+        ut_mutex_lock(&ut_log_output_lock);
+        ut_log_status_stop = true;
+        ut_cond_signal(&ut_log_status_cond);
+        ut_mutex_unlock(&ut_log_output_lock);
+        ut_thread_join(ut_log_status_thread, NULL);
+        ut_log_status_thread = 0;
+        ut_log_status_stop = false;
+    }
+
+    if (ut_log_status_msg) {
+        free(ut_log_status_msg);
+        ut_log_status_msg = NULL;
+    }
+
     if (UT_LOG_FMT_APPLICATION) {
         free(UT_LOG_FMT_APPLICATION);
         UT_LOG_FMT_APPLICATION = NULL;
     }
 }
+
+void ut_log_job_begin(void) {
+    ut_log_tlsData *data = ut_getThreadData();
+    data->job_active = true;
+    data->job_pid = getpid();
+}
+
+void ut_log_job_end(void) {
+    ut_log_tlsData *data = ut_getThreadData();
+    if (data->job_active) {
+        data->job_active = false;
+        if (data->job.length) {
+            ut_log_console(stderr, data->job.buf, data->job.length, false);
+        }
+        ut_strbuf_reset(&data->job);
+    }
+}
+
+bool ut_log_job_active(void) {
+    ut_log_tlsData *data = ut_getThreadData();
+    return ut_log_job_buffering(data);
+}
+
+void ut_log_job_write(
+    const char *str,
+    size_t len)
+{
+    ut_log_tlsData *data = ut_getThreadData();
+    if (ut_log_job_buffering(data)) {
+        ut_strbuf_appendstrn(&data->job, str, len);
+    } else {
+        ut_log_console(stderr, str, len, false);
+    }
+}
+
+/* Redraw the status line when it changed, at most once per interval. The
+ * thread sleeps until signalled when there is no status line. */
+static
+void* ut_log_statusRender(
+    void *arg)
+{
+    (void)arg;
+
+    ut_mutex_lock(&ut_log_output_lock);
+    while (!ut_log_status_stop) {
+        if (ut_log_status_dirty) {
+            ut_log_statusErase();
+            if (ut_log_status_msg) {
+                ut_log_statusDraw();
+            }
+            fflush(stderr);
+            ut_log_status_dirty = false;
+        }
+
+        if (ut_log_status_msg) {
+            ut_cond_timedwait(
+                &ut_log_status_cond, &ut_log_output_lock,
+                UT_LOG_STATUS_INTERVAL);
+        } else {
+            ut_cond_wait(&ut_log_status_cond, &ut_log_output_lock);
+        }
+    }
+
+    ut_log_statusErase();
+    fflush(stderr);
+    ut_mutex_unlock(&ut_log_output_lock);
+
+    return NULL;
+}
+
+void ut_log_status(
+    const char *fmt,
+    ...)
+{
+    char *msg = NULL;
+
+    if (fmt && ut_log_status_tty && UT_LOG_LEVEL <= UT_INFO) {
+        va_list arglist;
+        va_start(arglist, fmt);
+        char *formatted = ut_vasprintf(fmt, arglist);
+        va_end(arglist);
+
+        msg = ut_log_colorize(formatted);
+        free(formatted);
+    }
+
+    ut_mutex_lock(&ut_log_output_lock);
+    if (!msg && !ut_log_status_msg) {
+        ut_mutex_unlock(&ut_log_output_lock);
+        return;
+    }
+
+    if (msg && !ut_log_status_thread) {
+        ut_log_status_thread = ut_thread_new(ut_log_statusRender, NULL);
+    }
+
+    bool wake = msg && !ut_log_status_msg;
+
+    free(ut_log_status_msg);
+    ut_log_status_msg = msg;
+    ut_log_status_dirty = true;
+
+    if (wake) {
+        ut_cond_signal(&ut_log_status_cond);
+    }
+    ut_mutex_unlock(&ut_log_output_lock);
+}
+
+void ut_log_trace_enable(void) {
+    if (!ut_log_tracing) {
+        timespec_gettime(&ut_log_trace_start);
+        ut_log_tracing = true;
+    }
+}
+
+void ut_log_trace_begin(
+    const char *category,
+    const char *name,
+    const char *detail)
+{
+    if (!ut_log_tracing) {
+        return;
+    }
+
+    ut_log_tlsData *data = ut_getThreadData();
+    if (data->span_sp == UT_MAX_LOG_CATEGORIES) {
+        return;
+    }
+
+    ut_log_trace_span *span = &data->spans[data->span_sp ++];
+    span->category = category;
+    span->name = ut_strdup(name);
+    span->detail = detail ? ut_strdup(detail) : NULL;
+    timespec_gettime(&span->start);
+}
+
+void ut_log_trace_end(void) {
+    if (!ut_log_tracing) {
+        return;
+    }
+
+    ut_log_tlsData *data = ut_getThreadData();
+    if (!data->span_sp) {
+        return;
+    }
+
+    ut_log_trace_span *span = &data->spans[-- data->span_sp];
+    ut_log_traceAdd(data, span->category, span->name, span->detail, span->start);
+    free(span->name);
+    free(span->detail);
+}
+
+/* Write string as JSON string literal */
+static
+void ut_log_traceString(
+    FILE *f,
+    const char *str)
+{
+    const char *ptr;
+    char ch;
+
+    fputc('"', f);
+    for (ptr = str; (ch = *ptr); ptr ++) {
+        if (ch == '"' || ch == '\\') {
+            fputc('\\', f);
+            fputc(ch, f);
+        } else if ((unsigned char)ch < 0x20) {
+            fprintf(f, "\\u%04x", ch);
+        } else {
+            fputc(ch, f);
+        }
+    }
+    fputc('"', f);
+}
+
+int16_t ut_log_trace_write(
+    const char *file)
+{
+    ut_log_tlsData *data = ut_getThreadData();
+    uint32_t i;
+
+    if (!ut_log_tracing) {
+        return 0;
+    }
+
+    /* Close categories and spans of the calling thread that are still open,
+     * which happens when the build is aborted because of an error */
+    while (data->span_sp) {
+        ut_log_trace_end();
+    }
+    for (i = data->sp; i > 0; i --) {
+        ut_log_frame *frame = &data->frames[i - 1];
+        ut_log_traceAdd(data, "category", frame->category, NULL, frame->start);
+    }
+
+    FILE *f = fopen(file, "w");
+    if (!f) {
+        ut_throw("failed to open '%s': %s", file, strerror(errno));
+        return -1;
+    }
+
+    ut_mutex_lock(&ut_log_lock);
+    int pid = ut_proc();
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+        "\"tid\":1,\"args\":{\"name\":", pid);
+    ut_log_traceString(f, ut_log_appName ? ut_log_appName : "");
+    fprintf(f, "}}");
+
+    for (i = 1; i <= (uint32_t)ut_log_trace_threads; i ++) {
+        char thread_name[32] = "main";
+        if (i > 1) {
+            snprintf(thread_name, sizeof(thread_name), "worker %u", i - 1);
+        }
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+            "\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+            pid, i, thread_name);
+    }
+
+    for (i = 0; i < ut_log_trace_count; i ++) {
+        ut_log_trace_event *e = &ut_log_trace_events[i];
+        fprintf(f, ",\n{\"name\":");
+        ut_log_traceString(f, e->name);
+        fprintf(f, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+            "\"pid\":%d,\"tid\":%d",
+            e->category, e->ts, e->dur, pid, e->tid);
+        if (e->detail) {
+            fprintf(f, ",\"args\":{\"detail\":");
+            ut_log_traceString(f, e->detail);
+            fprintf(f, "}");
+        }
+        fprintf(f, "}");
+    }
+
+    fprintf(f, "\n]}\n");
+    ut_mutex_unlock(&ut_log_lock);
+
+    fclose(f);
+    return 0;
+}
@@ -19,13 +19,113 @@
  * THE SOFTWARE.
  */
 
+/* wait4 is a BSD extension */
+#ifndef _WIN32
+#define _DEFAULT_SOURCE
+#endif
+
 #include "../include/util.h"
+#include <sys/resource.h>
+
+#define UT_PROC_MAX_LIVE (256)
+
+/* Processes that have been started and not waited for. A negative value is
+ * the id of a process group. Slots are claimed with compare and swap, so the
+ * list can be read from a signal handler without locking. */
+static volatile pid_t ut_proc_live[UT_PROC_MAX_LIVE];
+
+static
+void ut_proc_register(
+    pid_t pid)
+{
+    int i;
+    for (i = 0; i < UT_PROC_MAX_LIVE; i ++) {
+        if (ut_cas(&ut_proc_live[i], 0, pid)) {
+            return;
+        }
+    }
+    /* Registry is full, process can't be killed by ut_proc_kill_all */
+}
+
+static
+void ut_proc_unregister(
+    pid_t pid)
+{
+    int i;
+    for (i = 0; i < UT_PROC_MAX_LIVE; i ++) {
+        if (ut_cas(&ut_proc_live[i], pid, 0) ||
+            ut_cas(&ut_proc_live[i], -pid, 0))
+        {
+            return;
+        }
+    }
+}
+
+void ut_proc_kill_all(
+    ut_procsignal sig)
+{
+    int i;
+    for (i = 0; i < UT_PROC_MAX_LIVE; i ++) {
+        pid_t pid = ut_proc_live[i];
+        if (pid) {
+            kill(pid, sig);
+        }
+    }
+}
+
+/* Fork and register the child. A child in its own process group no longer
+ * receives signals from the terminal (like Ctrl-C), which is why it must be
+ * tracked. Signals are blocked on the calling thread so its handler doesn't
+ * run between the fork and the registration. Another thread may still handle
+ * a signal in that window and miss the child, which then runs to completion
+ * before the caller can observe the cancellation. */
+static
+pid_t ut_proc_fork(
+    bool group,
+    const char *dir)
+{
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    sigaddset(&block, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (group) {
+            setpgid(0, 0);
+        }
+        if (dir && chdir(dir)) {
+            /* Only use async-signal-safe functions after fork */
+            static const char msg[] = "failed to change directory to '";
+            if (write(STDERR_FILENO, msg, sizeof(msg) - 1) < 0 ||
+                write(STDERR_FILENO, dir, strlen(dir)) < 0 ||
+                write(STDERR_FILENO, "'\n", 2) < 0)
+            {
+                /* Nothing left to report the error with */
+            }
+            _exit(127);
+        }
+    } else if (pid > 0) {
+        /* Also set the group from the parent, so the group exists before the
+         * child is signalled. Fails harmlessly if the child already exec'd. */
+        if (group) {
+            setpgid(pid, pid);
+        }
+        ut_proc_register(group ? -pid : pid);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    return pid;
+}
 
 ut_proc ut_proc_run(
     const char* exec,
     char *argv[])
 {
-    pid_t pid = fork();
+    pid_t pid = ut_proc_fork(false, NULL);
 
     if (pid == 0) {
 
@@ -61,14 +161,17 @@ ut_proc ut_proc_run(
     return pid;
 }
 
-ut_proc ut_proc_runRedirect(
+static
+ut_proc ut_proc_runRedirect_intern(
     const char* exec,
     char *argv[],
     FILE *in,
     FILE *out,
-    FILE *err)
+    FILE *err,
+    bool group,
+    const char *dir)
 {
-    pid_t pid = fork();
+    pid_t pid = ut_proc_fork(group, dir);
 
     if (pid == 0) {
         FILE *devnull = NULL;
@@ -84,7 +187,7 @@ ut_proc ut_proc_runRedirect(
             ut_error("failed to redirect stdout for '%s': %s", exec, strerror(errno));
             abort();
         }
-        if (out && (err != stdout)) fclose(out);
+        if (out && (out != stdout) && (out != err)) fclose(out);
 
         if (dup2(fileno(err ? err : devnull), STDERR_FILENO) < 0) {
             ut_error("failed to redirect stderr for '%s': %s", exec, strerror(errno));
@@ -114,18 +217,51 @@ ut_proc ut_proc_runRedirect(
     return pid;
 }
 
+ut_proc ut_proc_runRedirect(
+    const char* exec,
+    char *argv[],
+    FILE *in,
+    FILE *out,
+    FILE *err)
+{
+    return ut_proc_runRedirect_intern(exec, argv, in, out, err, false, NULL);
+}
+
 int ut_proc_kill(ut_proc pid, ut_procsignal sig) {
     return kill(pid, sig);
 }
 
 int ut_proc_wait(ut_proc pid, int8_t *rc) {
+    return ut_proc_wait_usage(pid, rc, NULL);
+}
+
+int ut_proc_wait_usage(ut_proc pid, int8_t *rc, ut_proc_usage *usage) {
     int status = 0;
     int result = 0;
     bool retry = false;
+    struct rusage ru;
 
+    /* Wait for the process to exit without reaping it, so its id can't be
+     * reused by another process while ut_proc_kill_all can still signal it */
     do {
+        siginfo_t info;
         retry = false;
-        if (waitpid(pid, &status, 0) != pid) {
+        if (waitid(P_PID, pid, &info, WEXITED | WNOWAIT)) {
+            if (errno == EINTR) {
+                retry = true;
+                ut_debug("waitid(%d) returned EINTR, retrying", pid);
+            } else {
+                ut_throw("wait for %d failed: %s", pid, strerror(errno));
+                return -1;
+            }
+        }
+    } while (retry);
+
+    ut_proc_unregister(pid);
+
+    do {
+        retry = false;
+        if (wait4(pid, &status, 0, &ru) != pid) {
             if (errno == EINTR) {
                 retry = true;
                 ut_debug("waitpid(%d) returned EINT, retrying", pid);
@@ -136,6 +272,16 @@ int ut_proc_wait(ut_proc pid, int8_t *rc) {
         }
     } while (retry);
 
+    if (usage) {
+        usage->user = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1000000.0;
+        usage->sys = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1000000.0;
+#ifdef __MACH__
+        usage->max_rss = ru.ru_maxrss / 1024; /* bytes on macOS */
+#else
+        usage->max_rss = ru.ru_maxrss;
+#endif
+    }
+
     if (WIFSIGNALED(status)) {
         result = WTERMSIG(status);
     } else {
@@ -155,13 +301,20 @@ int ut_proc_wait(ut_proc pid, int8_t *rc) {
 
 #define BUFFER_SIZE (256)
 
-/* Simple blocking function to create and wait for a process */
+/* Simple blocking function to create and wait for a process. When quiet_fail
+ * is set, output of the process is only reported if it succeeds. */
 static
 int ut_proc_cmd_intern(
     char* cmd,
+    const char *dir,
     int8_t *rc,
-    bool stderr_only)
+    ut_proc_usage *usage,
+    bool stderr_only,
+    bool quiet_fail)
 {
+    struct timespec start;
+    timespec_gettime(&start);
+
     int pid;
     char *args[UT_MAX_CMD_ARGS];
     char stack_buffer[BUFFER_SIZE];
@@ -194,19 +347,63 @@ int ut_proc_cmd_intern(
             *ptr = '\0';
             newArg = true;
         } else if (newArg) {
+            if (argCount + 2 >= UT_MAX_CMD_ARGS) {
+                ut_throw("too many arguments in command '%s'", cmd);
+                if (buffer != stack_buffer) free(buffer);
+                return -1;
+            }
             args[++argCount] = ptr;
             newArg = false;
         }
     }
     args[argCount + 1] = NULL;
 
+    /* If the thread is running a job, capture output of the process in a
+     * temporary file so it can be added to the job output in one piece. Jobs
+     * don't interact with the terminal, and run in their own process group so
+     * they can be cancelled with the processes they start. */
+    FILE *capture = NULL;
+    bool job = ut_log_job_active();
+    if (job || quiet_fail) {
+        capture = tmpfile();
+    }
+
+    ut_log_trace_begin("process", args[0], cmd);
+
     if (stderr_only) {
-        if (!(pid = ut_proc_runRedirect(
+        if (!(pid = ut_proc_runRedirect_intern(
             args[0],
             args,
             stdin,
             NULL,
-            stderr)))
+            capture ? capture : stderr,
+            job,
+            dir)))
+        {
+            goto error;
+        }
+    } else if (capture) {
+        if (!(pid = ut_proc_runRedirect_intern(
+            args[0],
+            args,
+            stdin,
+            capture,
+            capture,
+            job,
+            dir)))
+        {
+            goto error;
+        }
+    } else if (dir) {
+        /* No capture (tmpfile failed), still run in the right directory */
+        if (!(pid = ut_proc_runRedirect_intern(
+            args[0],
+            args,
+            stdin,
+            stdout,
+            stderr,
+            job,
+            dir)))
         {
             goto error;
         }
@@ -217,18 +414,58 @@ int ut_proc_cmd_intern(
     }
 
     if (buffer != stack_buffer) free(buffer);
-    return ut_proc_wait(pid, rc);
+
+    int result = ut_proc_wait_usage(pid, rc, usage);
+    if (usage) {
+        struct timespec now;
+        timespec_gettime(&now);
+        usage->wall = timespec_toDouble(timespec_sub(now, start));
+    }
+    ut_log_trace_end();
+
+    if (capture) {
+        char output[BUFSIZ];
+        size_t n;
+        rewind(capture);
+        if (!quiet_fail || (!result && (!rc || !*rc))) {
+            while ((n = fread(output, 1, sizeof(output), capture))) {
+                if (job) {
+                    ut_log_job_write(output, n);
+                } else {
+                    fwrite(output, 1, n, stderr);
+                }
+            }
+        }
+        fclose(capture);
+    }
+
+    return result;
 error:
+    ut_log_trace_end();
     if (buffer != stack_buffer) free(buffer);
+    if (capture) fclose(capture);
     return -1;
 }
 
 int ut_proc_cmd(char* cmd, int8_t *rc) {
-    return ut_proc_cmd_intern(cmd, rc, false);
+    return ut_proc_cmd_intern(cmd, NULL, rc, NULL, false, false);
+}
+
+int ut_proc_cmd_usage(char* cmd, int8_t *rc, ut_proc_usage *usage) {
+    return ut_proc_cmd_intern(cmd, NULL, rc, usage, false, false);
+}
+
+int ut_proc_cmd_try(
+    const char *dir,
+    char* cmd,
+    int8_t *rc,
+    ut_proc_usage *usage)
+{
+    return ut_proc_cmd_intern(cmd, dir, rc, usage, false, true);
 }
 
 int ut_proc_cmd_stderr_only(char* cmd, int8_t *rc) {
-    return ut_proc_cmd_intern(cmd, rc, true);
+    return ut_proc_cmd_intern(cmd, NULL, rc, NULL, true, false);
 }
 
 int ut_proc_check(ut_proc pid, int8_t *rc) {
@@ -238,7 +475,14 @@ int ut_proc_check(ut_proc pid, int8_t *rc) {
     result = waitpid(pid, &status, WNOHANG);
     if (!result) {
         /* Process did not change state, still running */
-    } else if (WIFSIGNALED(status)) {
+        return 0;
+    }
+
+    if (result == pid) {
+        ut_proc_unregister(pid);
+    }
+
+    if (WIFSIGNALED(status)) {
         /* Process exited with a signal */
         result = WTERMSIG(status);
     } else {
@@ -1,240 +1,96 @@
-
 #include "../include/util.h"
 
-/* Add an extra element to the buffer */
-static
-void ut_strbuf_grow(
-    ut_strbuf *b)
-{
-    /* Allocate new element */
-    ut_strbuf_element_embedded *e = malloc(sizeof(ut_strbuf_element_embedded));
-    b->size += b->current->pos;
-    b->current->next = (ut_strbuf_element*)e;
-    b->current = (ut_strbuf_element*)e;
-    b->elementCount ++;
-    e->super.buffer_embedded = true;
-    e->super.buf = e->buf;
-    e->super.pos = 0;
-    e->super.next = NULL;
-}
+/* Initial size of buffer, enough for most short strings & command lines */
+#define UT_STRBUF_INITIAL_SIZE (256)
 
-/* Add an extra dynamic element */
+/* Make sure buffer can hold 'len' more characters plus a terminator. If the
+ * buffer has a max, 'len' is clipped to what is left. Returns the number of
+ * characters that can be appended. */
 static
-void ut_strbuf_grow_str(
+uint32_t ut_strbuf_reserve(
     ut_strbuf *b,
-    char *str,
-    char *alloc_str,
-    uint32_t size)
-{
-    /* Allocate new element */
-    ut_strbuf_element_str *e = malloc(sizeof(ut_strbuf_element_str));
-    b->size += b->current->pos;
-    b->current->next = (ut_strbuf_element*)e;
-    b->current = (ut_strbuf_element*)e;
-    b->elementCount ++;
-    e->super.buffer_embedded = false;
-    e->super.pos = size ? size : strlen(str);
-    e->super.next = NULL;
-    e->super.buf = str;
-    e->alloc_str = alloc_str;
-}
-
-static
-char* ut_strbuf_ptr(
-    ut_strbuf *b)
+    uint32_t len)
 {
-    if (b->buf) {
-        return &b->buf[b->current->pos];
-    } else {
-        return &b->current->buf[b->current->pos];
+    if (b->max && (b->length + len > b->max)) {
+        len = b->max - b->length;
     }
-}
 
-/* Compute the amount of space left in the current element */
-static
-int32_t ut_strbuf_memLeftInCurrentElement(
-    ut_strbuf *b)
-{
-    if (b->current->buffer_embedded) {
-        return UT_STRBUF_ELEMENT_SIZE - b->current->pos;
-    } else {
-        return 0;
-    }
-}
+    uint32_t required = b->length + len + 1;
+    if (required > b->size) {
+        uint32_t size = b->size ? b->size : UT_STRBUF_INITIAL_SIZE;
+        while (size < required) {
+            size *= 2;
+        }
 
-/* Compute the amount of space left */
-static
-int32_t ut_strbuf_memLeft(
-    ut_strbuf *b)
-{
-    if (b->max) {
-        return b->max - b->size - b->current->pos;
-    } else {
-        return INT_MAX;
+        b->buf = realloc(b->buf, size);
+        b->size = size;
     }
-}
 
-static
-void ut_strbuf_init(
-    ut_strbuf *b)
-{
-    /* Initialize buffer structure only once */
-    if (!b->elementCount) {
-        b->size = 0;
-        b->firstElement.super.next = NULL;
-        b->firstElement.super.pos = 0;
-        b->firstElement.super.buffer_embedded = true;
-        b->firstElement.super.buf = b->firstElement.buf;
-        b->elementCount ++;
-        b->current = (ut_strbuf_element*)&b->firstElement;
-    }
+    return len;
 }
 
-/* Quick custom function to copy a maxium number of characters and
- * simultaneously determine length of source string. */
+/* Append len characters of str. Returns false if max was reached */
 static
-unsigned int fast_strncpy(
-    char * dst,
-    const char * src,
-    unsigned int n_cpy,
-    unsigned int n)
+bool ut_strbuf_append_intern(
+    ut_strbuf *b,
+    const char *str,
+    uint32_t len)
 {
-    const char *ptr, *orig = src;
-    char ch;
+    uint32_t copy = ut_strbuf_reserve(b, len);
 
-    for (ptr = src; (ptr - orig < n) && (ch = *ptr); ptr ++) {
-        if (ptr - orig < n_cpy) {
-            *dst = ch;
-            dst ++;
-        }
-    }
+    memcpy(&b->buf[b->length], str, copy);
+    b->length += copy;
+    b->buf[b->length] = '\0';
 
-    return ptr - orig;
+    return copy == len;
 }
 
-/* Append a format string to a buffer */
-static
-bool ut_strbuf_append_intern(
+bool ut_strbuf_vappend(
     ut_strbuf *b,
-    const char* str,
-    int n,
-    bool fmt_string,
+    const char* fmt,
     va_list args)
 {
-    bool result = true;
     va_list arg_cpy;
 
-    if (!str) {
-        return result;
+    if (!fmt) {
+        return true;
     }
 
-    ut_strbuf_init(b);
-
-    int32_t memLeftInElement = ut_strbuf_memLeftInCurrentElement(b);
-    int32_t memLeft = ut_strbuf_memLeft(b);
-
-    if (!memLeft) {
-        return false;
+    /* Make sure there is some space, so that most strings are formatted in
+     * one pass */
+    if (b->size - b->length < UT_STRBUF_INITIAL_SIZE / 2) {
+        ut_strbuf_reserve(b, UT_STRBUF_INITIAL_SIZE / 2);
     }
 
-    /* Compute the memory required to add the string to the buffer. If user
-     * provided buffer, use space left in buffer, otherwise use space left in
-     * current element. */
-    int32_t max_copy = b->buf ? memLeft : memLeftInElement;
-    int32_t memRequired;
+    uint32_t left = b->size - b->length;
 
-    if (n < 0) n = INT_MAX;
+    /* Try to format into space left in buffer, only grow if it didn't fit */
+    va_copy(arg_cpy, args);
+    int len = vsnprintf(&b->buf[b->length], left, fmt, arg_cpy);
+    va_end(arg_cpy);
 
-    if (!fmt_string) {
-        memRequired = fast_strncpy(ut_strbuf_ptr(b), str, max_copy, n);
-    } else {
-        va_copy(arg_cpy, args);
-        memRequired = vsnprintf(ut_strbuf_ptr(b), max_copy + 1, str, args);
+    if (len < 0) {
+        return false;
     }
 
-    if (memRequired <= memLeftInElement) {
-        /* Element was large enough to fit string */
-        b->current->pos += memRequired;
-    } else if ((memRequired - memLeftInElement) < memLeft) {
-        /* Element was not large enough, but buffer still has space */
-        if (!fmt_string) {
-            b->current->pos += memLeftInElement;
-            memRequired -= memLeftInElement;
-
-            /* Current element was too small, copy remainder into new element */
-            if (memRequired < UT_STRBUF_ELEMENT_SIZE) {
-                /* A standard-size buffer is large enough for the new string */
-                ut_strbuf_grow(b);
-
-                /* Copy the remainder to the new buffer */
-                if (n) {
-                    /* If a max number of characters to write is set, only a
-                     * subset of the string should be copied to the buffer */
-                    strncpy(
-                        ut_strbuf_ptr(b),
-                        str + memLeftInElement,
-                        memRequired);
-                } else {
-                    strcpy(ut_strbuf_ptr(b), str + memLeftInElement);
-                }
-
-                /* Update to number of characters copied to new buffer */
-                b->current->pos += memRequired;
-            } else {
-                char *remainder = strdup(str + memLeftInElement);
-                ut_strbuf_grow_str(b, remainder, remainder, memRequired);
-            }
+    if ((uint32_t)len >= left || (b->max && b->length + len > b->max)) {
+        uint32_t copy = ut_strbuf_reserve(b, len);
+        if (copy == (uint32_t)len) {
+            vsnprintf(&b->buf[b->length], len + 1, fmt, args);
         } else {
-            /* If string is a format string, a new buffer of size memRequired is
-             * needed to re-evaluate the format string and only use the part that
-             * wasn't already copied to the previous element */
-            if (memRequired <= UT_STRBUF_ELEMENT_SIZE) {
-                /* Resulting string fits in standard-size buffer. Note that the
-                 * entire string needs to fit, not just the remainder, as the
-                 * format string cannot be partially evaluated */
-                ut_strbuf_grow(b);
-
-                /* Copy entire string to new buffer */
-                vsprintf(ut_strbuf_ptr(b), str, arg_cpy);
-
-                /* Ignore the part of the string that was copied into the
-                 * previous buffer. The string copied into the new buffer could
-                 * be memmoved so that only the remainder is left, but that is
-                 * most likely more expensive than just keeping the entire
-                 * string. */
-
-                /* Update position in buffer */
-                b->current->pos += memRequired;
-            } else {
-                /* Resulting string does not fit in standard-size buffer.
-                 * Allocate a new buffer that can hold the entire string. */
-                char *dst = malloc(memRequired + 1);
-                vsprintf(dst, str, arg_cpy);
-                ut_strbuf_grow_str(b, dst, dst, memRequired);
-            }
+            /* Max is reached, format in temporary buffer and copy what fits */
+            char *tmp = ut_vasprintf(fmt, args);
+            memcpy(&b->buf[b->length], tmp, copy);
+            free(tmp);
         }
-    } else {
-        /* Buffer max has been reached */
-        result = false;
-    }
 
-    if (fmt_string) {
-        va_end(arg_cpy);
+        b->length += copy;
+        b->buf[b->length] = '\0';
+        return copy == (uint32_t)len;
     }
 
-    return result;
-}
-
-bool ut_strbuf_vappend(
-    ut_strbuf *b,
-    const char* fmt,
-    va_list args)
-{
-    bool result = ut_strbuf_append_intern(
-        b, fmt, -1, true, args
-    );
-
-    return result;
+    b->length += len;
+    return true;
 }
 
 bool ut_strbuf_append(
@@ -244,9 +100,7 @@ bool ut_strbuf_append(
 {
     va_list args;
     va_start(args, fmt);
-    bool result = ut_strbuf_append_intern(
-        b, fmt, -1, true, args
-    );
+    bool result = ut_strbuf_vappend(b, fmt, args);
     va_end(args);
 
     return result;
@@ -257,114 +111,103 @@ bool ut_strbuf_appendstrn(
     const char* str,
     uint32_t len)
 {
-    return ut_strbuf_append_intern(
-        b, str, len, false, NULL
-    );
+    uint32_t n = 0;
+
+    /* Don't read past the end of str when it is shorter than len */
+    while (n < len && str[n]) {
+        n ++;
+    }
+
+    return ut_strbuf_append_intern(b, str, n);
 }
 
-bool ut_strbuf_appendstr_zerocpy(
+bool ut_strbuf_appendstr(
     ut_strbuf *b,
-    char* str)
+    const char* str)
 {
-    ut_strbuf_init(b);
-    ut_strbuf_grow_str(b, str, str, 0);
-    return true;
+    if (!str) {
+        return true;
+    }
+
+    return ut_strbuf_append_intern(b, str, strlen(str));
 }
 
-bool ut_strbuf_appendstr_zerocpy_const(
+bool ut_strbuf_appendch(
     ut_strbuf *b,
-    const char* str)
+    char ch)
 {
-    /* Removes const modifier, but logic prevents changing / delete string */
-    ut_strbuf_init(b);
-    ut_strbuf_grow_str(b, (char*)str, NULL, 0);
+    if (b->length + 2 > b->size || b->max) {
+        return ut_strbuf_append_intern(b, &ch, 1);
+    }
+
+    b->buf[b->length ++] = ch;
+    b->buf[b->length] = '\0';
+
     return true;
 }
 
+bool ut_strbuf_appendint(
+    ut_strbuf *b,
+    int64_t value)
+{
+    char buf[21], *ptr = &buf[sizeof(buf)];
+    uint64_t v = value < 0 ? -(uint64_t)value : (uint64_t)value;
+
+    do {
+        *(--ptr) = '0' + (v % 10);
+        v /= 10;
+    } while (v);
 
-bool ut_strbuf_appendstr(
+    if (value < 0) {
+        *(--ptr) = '-';
+    }
+
+    return ut_strbuf_append_intern(b, ptr, &buf[sizeof(buf)] - ptr);
+}
+
+bool ut_strbuf_appendstr_zerocpy(
+    ut_strbuf *b,
+    char* str)
+{
+    bool result = ut_strbuf_appendstr(b, str);
+    free(str);
+    return result;
+}
+
+bool ut_strbuf_appendstr_zerocpy_const(
     ut_strbuf *b,
     const char* str)
 {
-    return ut_strbuf_append_intern(
-        b, str, -1, false, NULL
-    );
+    return ut_strbuf_appendstr(b, str);
 }
 
 bool ut_strbuf_mergebuff(
     ut_strbuf *dst_buffer,
     ut_strbuf *src_buffer)
 {
-    if (src_buffer->elementCount) {
-        if (src_buffer->buf) {
-            return ut_strbuf_appendstr(dst_buffer, src_buffer->buf);
-        } else {
-            ut_strbuf_element *e = (ut_strbuf_element*)&src_buffer->firstElement;
-
-            /* Copy first element as it is inlined in the src buffer */
-            ut_strbuf_appendstrn(dst_buffer, e->buf, e->pos);
-
-            while ((e = e->next)) {
-                dst_buffer->current->next = malloc(sizeof(ut_strbuf_element));
-                *dst_buffer->current->next = *e;
-            }
-        }
+    bool result = true;
 
-        *src_buffer = UT_STRBUF_INIT;
+    if (src_buffer->buf) {
+        result = ut_strbuf_append_intern(
+            dst_buffer, src_buffer->buf, src_buffer->length);
     }
 
-    return true;
+    ut_strbuf_reset(src_buffer);
+
+    return result;
 }
 
 char* ut_strbuf_get(ut_strbuf *b) {
-    char* result = NULL;
-
-    if (b->elementCount) {
-        if (b->buf) {
-            result = strdup(b->buf);
-        } else {
-            void *next = NULL;
-            uint32_t len = b->size + b->current->pos + 1;
-
-            ut_strbuf_element *e = (ut_strbuf_element*)&b->firstElement;
-
-            result = malloc(len);
-            char* ptr = result;
-
-            do {
-                memcpy(ptr, e->buf, e->pos);
-                ptr += e->pos;
-                next = e->next;
-                if (e != &b->firstElement.super) {
-                    if (!e->buffer_embedded) {
-                        free(((ut_strbuf_element_str*)e)->alloc_str);
-                    }
-                    free(e);
-                }
-            } while ((e = next));
-
-            result[len - 1] = '\0';
-        }
-    } else {
-        result = NULL;
-    }
+    char *result = b->buf;
+    uint32_t max = b->max;
 
-    b->elementCount = 0;
+    *b = UT_STRBUF_INIT;
+    b->max = max;
 
     return result;
 }
 
 void ut_strbuf_reset(ut_strbuf *b) {
-    if (b->elementCount && !b->buf) {
-        void *next = NULL;
-        ut_strbuf_element *e = (ut_strbuf_element*)&b->firstElement;
-        do {
-            next = e->next;
-            if (e != (ut_strbuf_element*)&b->firstElement) {
-                free(e);
-            }
-        } while ((e = next));
-    }
-
+    free(b->buf);
     *b = UT_STRBUF_INIT;
 }
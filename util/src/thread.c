@@ -351,6 +351,17 @@ int ut_cond_signal(
     return result;
 }
 
+/* Signal all threads waiting for condition variable */
+int ut_cond_broadcast(
+    ut_cond cond)
+{
+    int result = 0;
+    if ((result = pthread_cond_broadcast(&cond->cond))) {
+        ut_throw("cond_broadcast failed: %s", strerror(result));
+    }
+    return result;
+}
+
 /* Wait for condition variable */
 int ut_cond_wait(
     ut_cond cond,
@@ -363,6 +374,32 @@ int ut_cond_wait(
     return result;
 }
 
+/* Wait for condition variable or until timeout expires */
+int ut_cond_timedwait(
+    ut_cond cond,
+    ut_mutex mutex,
+    int64_t timeout_ns)
+{
+    int result = 0;
+    struct timespec deadline;
+
+    timespec_gettime(&deadline);
+    deadline.tv_sec += timeout_ns / 1000000000;
+    deadline.tv_nsec += timeout_ns % 1000000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec ++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    result = pthread_cond_timedwait(&cond->cond, &mutex->mutex, &deadline);
+    if (result == ETIMEDOUT) {
+        result = 0;
+    } else if (result) {
+        ut_throw("cond_timedwait failed: %s", strerror(result));
+    }
+    return result;
+}
+
 /* Free condition variable */
 int ut_cond_free(
     ut_cond cond)
@@ -31,6 +31,7 @@ ut_mutex_s UT_LOAD_LOCK;
 extern char *ut_log_appName;
 
 ut_tls UT_KEY_THREAD_STRING;
+ut_tls UT_KEY_SCRATCH;
 
 void ut_init(
     char *appName)
@@ -51,6 +52,10 @@ void ut_init(
         ut_critical("failed to obtain tls key for thread admin");
     }
 
+    if (ut_tls_new(&UT_KEY_SCRATCH, ut_scratch_free)) {
+        ut_critical("failed to obtain tls key for scratch arena");
+    }
+
     if (ut_log_init()) {
         ut_critical("failed to initialize logging framework");
     }